@@ -1,24 +1,94 @@
 #include "site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient.h"
+#include <cstring>
+#include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
+#include "channel_pool.h"
 #include "kv_client.h"
+#include "sharded_kv_client.h"
 #include "common.h"
 
+// Classes and member ids looked up once in JNI_OnLoad, FindClass/GetMethodID per call cost
+// more than the glue they serve
+static struct {
+    jclass array_list;
+    jmethodID array_list_init;
+    jmethodID array_list_add;
+    jclass kv_pairs;
+    jmethodID kv_pairs_init;
+    jfieldID kv_pairs_keys;
+    jfieldID kv_pairs_values;
+    jclass packed_kvs;
+    jmethodID packed_kvs_init;
+    jfieldID packed_kvs_data;
+    jfieldID packed_kvs_offsets;
+    jfieldID packed_kvs_codes;
+} jni_ids;
+
+static jclass find_global_class(JNIEnv *env, const char *name) {
+    jclass clz = env->FindClass(name);
+
+    if (clz == nullptr) {
+        // Older Java bindings lack some classes, the entry points using them fail instead
+        env->ExceptionClear();
+        return nullptr;
+    }
+    auto global = static_cast<jclass>(env->NewGlobalRef(clz));
+    env->DeleteLocalRef(clz);
+    return global;
+}
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+    JNIEnv *env;
+
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    jni_ids.array_list = find_global_class(env, "java/util/ArrayList");
+    jni_ids.array_list_init = env->GetMethodID(jni_ids.array_list, "<init>", "(I)V");
+    jni_ids.array_list_add = env->GetMethodID(jni_ids.array_list, "add", "(Ljava/lang/Object;)Z");
+
+    jni_ids.kv_pairs = find_global_class(env, "site/ycsb/db/grpc/rocksdb/GRPCRocksDBClient$KVPairs");
+    if (jni_ids.kv_pairs != nullptr) {
+        jni_ids.kv_pairs_init = env->GetMethodID(jni_ids.kv_pairs, "<init>", "()V");
+        jni_ids.kv_pairs_keys = env->GetFieldID(jni_ids.kv_pairs, "keys", "Ljava/util/List;");
+        jni_ids.kv_pairs_values = env->GetFieldID(jni_ids.kv_pairs, "values", "Ljava/util/List;");
+    }
+    jni_ids.packed_kvs = find_global_class(env, "site/ycsb/db/grpc/rocksdb/GRPCRocksDBClient$PackedKVs");
+    if (jni_ids.packed_kvs != nullptr) {
+        jni_ids.packed_kvs_init = env->GetMethodID(jni_ids.packed_kvs, "<init>", "()V");
+        jni_ids.packed_kvs_data = env->GetFieldID(jni_ids.packed_kvs, "data", "[B");
+        jni_ids.packed_kvs_offsets = env->GetFieldID(jni_ids.packed_kvs, "offsets", "[I");
+        jni_ids.packed_kvs_codes = env->GetFieldID(jni_ids.packed_kvs, "codes", "[B");
+    }
+    if (env->ExceptionCheck()) {
+        return JNI_ERR;
+    }
+    return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
+    JNIEnv *env;
+
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return;
+    }
+    for (jclass clz: {jni_ids.array_list, jni_ids.kv_pairs, jni_ids.packed_kvs}) {
+        if (clz != nullptr) {
+            env->DeleteGlobalRef(clz);
+        }
+    }
+}
+
 std::string jstring2string(JNIEnv *env, jstring jStr) {
     if (!jStr)
         return "";
 
-    const jclass stringClass = env->GetObjectClass(jStr);
-    const jmethodID getBytes = env->GetMethodID(stringClass, "getBytes", "(Ljava/lang/String;)[B");
-    const jbyteArray stringJbytes = (jbyteArray) env->CallObjectMethod(jStr, getBytes, env->NewStringUTF("UTF-8"));
-
-    size_t length = (size_t) env->GetArrayLength(stringJbytes);
-    jbyte *pBytes = env->GetByteArrayElements(stringJbytes, NULL);
+    const char *chars = env->GetStringUTFChars(jStr, nullptr);
+    std::string ret(chars, env->GetStringUTFLength(jStr));
 
-    std::string ret = std::string((char *) pBytes, length);
-    env->ReleaseByteArrayElements(stringJbytes, pBytes, JNI_ABORT);
-
-    env->DeleteLocalRef(stringJbytes);
-    env->DeleteLocalRef(stringClass);
+    env->ReleaseStringUTFChars(jStr, chars);
     return ret;
 }
 
@@ -33,38 +103,196 @@ jbyteArray to_jbyte_array(JNIEnv *env, const std::string &s) {
     return arr;
 }
 
+// Copies straight into the string, GetByteArrayElements may copy the array a second time
 std::string to_string(JNIEnv *env, jbyteArray data) {
-    jboolean is_copy;
-    jbyte *b = env->GetByteArrayElements(data, &is_copy);
-    jsize len = env->GetArrayLength(data);
+    std::string ret(env->GetArrayLength(data), '\0');
 
-    std::string ret = std::string(reinterpret_cast<char *>(b), len);
-    env->ReleaseByteArrayElements(data, b, JNI_ABORT);
+    env->GetByteArrayRegion(data, 0, ret.size(), reinterpret_cast<jbyte *>(&ret[0]));
     return ret;
 }
 
+// Raises exception_class with msg in the JVM, the caller returns right after
+void throw_new(JNIEnv *env, const char *exception_class, const std::string &msg) {
+    jclass clz = env->FindClass(exception_class);
+
+    if (clz != nullptr) {
+        env->ThrowNew(clz, msg.c_str());
+        env->DeleteLocalRef(clz);
+    }
+}
+
+void throw_illegal_argument(JNIEnv *env, const std::string &msg) {
+    throw_new(env, "java/lang/IllegalArgumentException", msg);
+}
+
+// Byte array without the size cap of to_jbyte_array, for results packing many kvs. Returns
+// nullptr with an exception pending if the array can not be allocated
+jbyteArray new_packed_byte_array(JNIEnv *env, const std::string &s) {
+    if (s.size() > (size_t) std::numeric_limits<jsize>::max()) {
+        throw_new(env, "java/lang/OutOfMemoryError",
+                  "Result of " + std::to_string(s.size()) + " bytes does not fit in a Java array");
+        return nullptr;
+    }
+    jbyteArray arr = env->NewByteArray(s.size());
+
+    if (arr != nullptr) {
+        env->SetByteArrayRegion(arr, 0, s.size(), reinterpret_cast<const jbyte *>(s.data()));
+    }
+    return arr;
+}
+
+// Copies the first len bytes of the direct ByteBuffer buffer to out. Returns false with an
+// IllegalArgumentException pending if buffer is not direct or shorter than len
+bool direct_to_string(JNIEnv *env, jobject buffer, jint len, std::string *out) {
+    auto *addr = buffer == nullptr ? nullptr : static_cast<const char *>(env->GetDirectBufferAddress(buffer));
+
+    if (addr == nullptr) {
+        throw_illegal_argument(env, "Not a direct ByteBuffer");
+        return false;
+    }
+    if (len < 0 || len > env->GetDirectBufferCapacity(buffer)) {
+        throw_illegal_argument(env, "Length " + std::to_string(len) + " is out of the buffer");
+        return false;
+    }
+    out->assign(addr, len);
+    return true;
+}
+
 jobject new_array_list(JNIEnv *env, jsize size) {
-    auto array_list_clz = static_cast<jclass>(env->NewGlobalRef(env->FindClass("java/util/ArrayList")));
-    auto array_list_constructor = env->GetMethodID(array_list_clz, "<init>", "(I)V");
-    return env->NewObject(array_list_clz, array_list_constructor, size);
+    return env->NewObject(jni_ids.array_list, jni_ids.array_list_init, size);
 }
 
-JNIEXPORT jlong JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_connect
-        (JNIEnv *j_env, jobject j_obj, jstring j_addr) {
-    auto addr = jstring2string(j_env, j_addr);
-    std::string val;
-    auto kv_cli = new kvstore::KVClient(addr);
+// PackedKVs holding data and offsets, entry i is data[offsets[i], offsets[i + 1])
+jobject new_packed_kvs(JNIEnv *env, const std::string &data, const std::vector<jint> &offsets,
+                       const std::vector<jbyte> *codes) {
+    if (jni_ids.packed_kvs == nullptr) {
+        throw_new(env, "java/lang/NoClassDefFoundError", "GRPCRocksDBClient$PackedKVs is missing");
+        return nullptr;
+    }
+    jbyteArray j_data = new_packed_byte_array(env, data);
 
-    for (int i = 0; i < 10000; i++) {
-        kvstore::WarmupReq req;
+    if (j_data == nullptr) {
+        return nullptr;
+    }
+    jobject obj = env->NewObject(jni_ids.packed_kvs, jni_ids.packed_kvs_init);
+    jintArray j_offsets = env->NewIntArray(offsets.size());
 
-        req.mutable_data()->resize(kvstore::random(1, 1024));
-        req.set_resp_size(kvstore::random(1, 1024));
+    if (obj == nullptr || j_offsets == nullptr) {
+        return nullptr;
+    }
+    env->SetIntArrayRegion(j_offsets, 0, offsets.size(), offsets.data());
+    env->SetObjectField(obj, jni_ids.packed_kvs_data, j_data);
+    env->SetObjectField(obj, jni_ids.packed_kvs_offsets, j_offsets);
+    env->DeleteLocalRef(j_data);
+    env->DeleteLocalRef(j_offsets);
+    if (codes != nullptr) {
+        jbyteArray j_codes = env->NewByteArray(codes->size());
 
-        kv_cli->Warmup(req);
+        env->SetByteArrayRegion(j_codes, 0, codes->size(), codes->data());
+        env->SetObjectField(obj, jni_ids.packed_kvs_codes, j_codes);
+        env->DeleteLocalRef(j_codes);
     }
+    return obj;
+}
 
-    return reinterpret_cast<jlong>(kv_cli);
+// Splits j_data by j_offsets into offsets.size() - 1 strings. Returns false with an
+// IllegalArgumentException pending if the offsets do not lie in order within j_data
+bool unpack(JNIEnv *env, jbyteArray j_data, jintArray j_offsets, std::vector<std::string> *parts) {
+    if (j_data == nullptr || j_offsets == nullptr) {
+        throw_illegal_argument(env, "Data and offsets are required");
+        return false;
+    }
+    jsize size = env->GetArrayLength(j_data);
+    std::vector<jint> offsets(env->GetArrayLength(j_offsets));
+
+    env->GetIntArrayRegion(j_offsets, 0, offsets.size(), offsets.data());
+    parts->reserve(offsets.size());
+    for (size_t i = 0; i + 1 < offsets.size(); i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i + 1] || offsets[i + 1] > size) {
+            throw_illegal_argument(env, "Bad offsets " + std::to_string(offsets[i]) + ", " +
+                                        std::to_string(offsets[i + 1]) + " for " + std::to_string(size) + " bytes");
+            return false;
+        }
+        auto &part = parts->emplace_back(offsets[i + 1] - offsets[i], '\0');
+        env->GetByteArrayRegion(j_data, offsets[i], part.size(), reinterpret_cast<jbyte *>(&part[0]));
+    }
+    return true;
+}
+
+const int DEFAULT_POOL_CHANNELS = 4;
+const int WARMUP_THREADS = 4;
+
+// Channels shared by all connections of the process, sized by the first connect
+static std::unique_ptr<kvstore::ChannelPool> channel_pool;
+static std::mutex channel_pool_mutex;
+
+kvstore::ChannelPool &get_channel_pool(int num_channels) {
+    std::lock_guard<std::mutex> lock(channel_pool_mutex);
+
+    if (channel_pool == nullptr) {
+        channel_pool = std::make_unique<kvstore::ChannelPool>(num_channels > 0 ? num_channels : DEFAULT_POOL_CHANNELS);
+    }
+    return *channel_pool;
+}
+
+// Sends num_rpcs small Warmup RPCs from a few threads at once
+void warmup(kvstore::KVClient *kv_cli, int num_rpcs) {
+    std::vector<std::thread> ths;
+
+    for (int tid = 0; tid < WARMUP_THREADS; tid++) {
+        ths.emplace_back([kv_cli, num_rpcs, tid]() {
+            for (int i = tid; i < num_rpcs; i += WARMUP_THREADS) {
+                kvstore::WarmupReq req;
+
+                req.mutable_data()->resize(kvstore::random(1, 1024));
+                req.set_resp_size(kvstore::random(1, 1024));
+                kv_cli->Warmup(req);
+            }
+        });
+    }
+    for (auto &th: ths) {
+        th.join();
+    }
+}
+
+// Builds a client on channels of the shared pool, only the connect that opens the channels
+// waits for them and warms them up. Servers on this host are reached over their unix sockets
+kvstore::KVClient *connect_pooled(const std::string &addr, int num_channels, int num_warmup_rpcs) {
+    auto &pool = get_channel_pool(num_channels);
+    auto endpoints = kvstore::splitEndpoints(addr);
+    std::vector<std::shared_ptr<grpc::Channel>> channels;
+    bool created = false;
+    kvstore::KVClient *kv_cli;
+
+    for (auto &endpoint: endpoints) {
+        bool endpoint_created;
+
+        channels.push_back(pool.Acquire(endpoint, &endpoint_created));
+        created |= endpoint_created;
+    }
+    // A comma separated list shards the keys over several servers
+    if (endpoints.size() > 1) {
+        kv_cli = new kvstore::ShardedKVClient(endpoints, channels);
+    } else {
+        kv_cli = new kvstore::KVClient(channels.front());
+    }
+    if (created && num_warmup_rpcs > 0) {
+        warmup(kv_cli, num_warmup_rpcs);
+    }
+    return kv_cli;
+}
+
+JNIEXPORT jlong JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_connect
+        (JNIEnv *j_env, jobject j_obj, jstring j_addr) {
+    return reinterpret_cast<jlong>(connect_pooled(jstring2string(j_env, j_addr), DEFAULT_POOL_CHANNELS, 0));
+}
+
+// Like connect, with the number of pooled channels per server, which only the first connect of
+// the process decides, and the number of Warmup RPCs sent when the channels are opened
+JNIEXPORT jlong JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_connectPooled
+        (JNIEnv *j_env, jobject j_obj, jstring j_addr, jint j_num_channels, jint j_num_warmup_rpcs) {
+    return reinterpret_cast<jlong>(connect_pooled(jstring2string(j_env, j_addr), j_num_channels,
+                                                  j_num_warmup_rpcs));
 }
 
 JNIEXPORT jbyteArray JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_get
@@ -100,42 +328,156 @@ JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_scan
     auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
     std::vector<kvstore::KV> kvs;
 
+    if (jni_ids.kv_pairs == nullptr) {
+        throw_new(j_env, "java/lang/NoClassDefFoundError", "GRPCRocksDBClient$KVPairs is missing");
+        return nullptr;
+    }
     cli->Scan(to_string(j_env, j_key), kvs, j_limit);
-
-    jclass clazz = j_env->FindClass("site/ycsb/db/grpc/rocksdb/GRPCRocksDBClient$KVPairs");
-    assert(clazz != nullptr);
-    jmethodID constructor = j_env->GetMethodID(clazz, "<init>", "()V");
-    assert(constructor != nullptr);
-    jfieldID j_keys_id = j_env->GetFieldID(clazz, "keys", "Ljava/util/List;");
-    jfieldID j_vals_id = j_env->GetFieldID(clazz, "values", "Ljava/util/List;");
-    assert(j_keys_id != nullptr && j_vals_id != nullptr);
-
     auto j_keys = new_array_list(j_env, kvs.size());
     auto j_vals = new_array_list(j_env, kvs.size());
-    auto array_list_clz = static_cast<jclass>(j_env->NewGlobalRef(j_env->FindClass("java/util/ArrayList")));
-    auto list_add = j_env->GetMethodID(array_list_clz, "add", "(Ljava/lang/Object;)Z");
 
     for (auto &kv: kvs) {
         if (j_return_keys) {
             auto j_bytes = to_jbyte_array(j_env, kv.key());
-            j_env->CallBooleanMethod(j_keys, list_add, j_bytes);
+            j_env->CallBooleanMethod(j_keys, jni_ids.array_list_add, j_bytes);
             j_env->DeleteLocalRef(j_bytes);
         }
         auto j_bytes = to_jbyte_array(j_env, kv.value());
-        j_env->CallBooleanMethod(j_vals, list_add, j_bytes);
+        j_env->CallBooleanMethod(j_vals, jni_ids.array_list_add, j_bytes);
         j_env->DeleteLocalRef(j_bytes);
     }
 
 
-    jobject obj = j_env->NewObject(clazz, constructor);
+    jobject obj = j_env->NewObject(jni_ids.kv_pairs, jni_ids.kv_pairs_init);
 
     if (j_return_keys) {
-        j_env->SetObjectField(obj, j_keys_id, j_keys);
+        j_env->SetObjectField(obj, jni_ids.kv_pairs_keys, j_keys);
     }
-    j_env->SetObjectField(obj, j_vals_id, j_vals);
+    j_env->SetObjectField(obj, jni_ids.kv_pairs_values, j_vals);
+    j_env->DeleteLocalRef(j_keys);
+    j_env->DeleteLocalRef(j_vals);
     return obj;
 }
 
+// Copies the value into the direct buffer j_value and returns its length. A value longer than
+// the buffer is not copied, the caller retries with a buffer of the returned length. Returns
+// -1 on error
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_getDirect
+        (JNIEnv *j_env, jobject j_obj, jlong j_handle, jobject j_key, jint j_key_len, jobject j_value) {
+    auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
+    std::string key, val;
+    auto *addr = j_value == nullptr ? nullptr : static_cast<char *>(j_env->GetDirectBufferAddress(j_value));
+
+    if (addr == nullptr) {
+        throw_illegal_argument(j_env, "Not a direct ByteBuffer");
+        return -1;
+    }
+    if (!direct_to_string(j_env, j_key, j_key_len, &key)) {
+        return -1;
+    }
+    auto status = cli->Get(key, val);
+
+    if (status.error_code() != kvstore::ErrorCode::OK) {
+        return -1;
+    }
+    if ((jlong) val.size() <= j_env->GetDirectBufferCapacity(j_value)) {
+        memcpy(addr, val.data(), val.size());
+    }
+    return val.size();
+}
+
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_putDirect
+        (JNIEnv *j_env, jobject j_obj, jlong j_handle, jobject j_key, jint j_key_len, jobject j_value,
+         jint j_value_len) {
+    auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
+    std::string key, value;
+
+    if (!direct_to_string(j_env, j_key, j_key_len, &key) || !direct_to_string(j_env, j_value, j_value_len, &value)) {
+        return -1;
+    }
+    auto status = cli->Put(key, value);
+    return status.error_code() == kvstore::ErrorCode::OK ? 0 : status.error_code();
+}
+
+// Scan returning all kvs in one byte array, with keys entry 2i is the i-th key and entry
+// 2i + 1 its value, without keys entry i is the i-th value
+JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_scanPacked
+        (JNIEnv *j_env, jobject j_obj, jlong j_handle, jbyteArray j_key, jint j_limit, jboolean j_return_keys) {
+    auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
+    std::vector<kvstore::KV> kvs;
+    std::string data;
+    std::vector<jint> offsets;
+    size_t size = 0;
+
+    cli->Scan(to_string(j_env, j_key), kvs, j_limit);
+    for (auto &kv: kvs) {
+        size += (j_return_keys ? kv.key().size() : 0) + kv.value().size();
+    }
+    data.reserve(size);
+    offsets.reserve(kvs.size() * 2 + 1);
+    offsets.push_back(0);
+    for (auto &kv: kvs) {
+        if (j_return_keys) {
+            data += kv.key();
+            offsets.push_back(data.size());
+        }
+        data += kv.value();
+        offsets.push_back(data.size());
+    }
+    return new_packed_kvs(j_env, data, offsets, nullptr);
+}
+
+// Gets the keys packed in j_keys by j_offsets with one MultiGet. Entry i of the result is the
+// value of key i and codes[i] its ErrorCode
+JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_multiGet
+        (JNIEnv *j_env, jobject j_obj, jlong j_handle, jbyteArray j_keys, jintArray j_offsets) {
+    auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
+    std::vector<std::string> keys;
+
+    if (!unpack(j_env, j_keys, j_offsets, &keys)) {
+        return nullptr;
+    }
+    std::vector<std::string> values;
+    std::vector<kvstore::Status> statuses;
+    auto status = cli->MultiGet(keys, values, &statuses);
+    std::string data;
+    std::vector<jint> offsets{0};
+    std::vector<jbyte> codes;
+
+    if (status.error_code() != kvstore::ErrorCode::OK) {
+        statuses.assign(keys.size(), status);
+        values.assign(keys.size(), "");
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        data += values[i];
+        offsets.push_back(data.size());
+        codes.push_back((jbyte) statuses[i].error_code());
+    }
+    return new_packed_kvs(j_env, data, offsets, &codes);
+}
+
+// Puts the kvs packed in j_data by j_offsets with one MultiPut, entry 2i is a key and entry
+// 2i + 1 its value
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_multiPut
+        (JNIEnv *j_env, jobject j_obj, jlong j_handle, jbyteArray j_data, jintArray j_offsets) {
+    auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
+    std::vector<std::string> parts;
+    std::vector<std::pair<std::string, std::string>> kvs;
+
+    if (!unpack(j_env, j_data, j_offsets, &parts)) {
+        return -1;
+    }
+    if (parts.size() % 2 != 0) {
+        throw_illegal_argument(j_env, "Keys and values must come in pairs");
+        return -1;
+    }
+    for (size_t i = 0; i < parts.size(); i += 2) {
+        kvs.emplace_back(std::move(parts[i]), std::move(parts[i + 1]));
+    }
+    auto status = cli->MultiPut(kvs);
+    return status.error_code() == kvstore::ErrorCode::OK ? 0 : status.error_code();
+}
+
 JNIEXPORT void JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_disconnect
         (JNIEnv *j_env, jobject j_obj, jlong j_handle) {
     auto *cli = reinterpret_cast<kvstore::KVClient *>(j_handle);
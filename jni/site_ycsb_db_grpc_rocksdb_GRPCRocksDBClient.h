@@ -15,6 +15,14 @@ extern "C" {
 JNIEXPORT jlong JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_connect
         (JNIEnv *, jobject, jstring);
 
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    connectPooled
+ * Signature: (Ljava/lang/String;II)J
+ */
+JNIEXPORT jlong JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_connectPooled
+        (JNIEnv *, jobject, jstring, jint, jint);
+
 /*
  * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
  * Method:    get
@@ -47,6 +55,46 @@ JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_delete
 JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_scan
         (JNIEnv *, jobject, jlong, jbyteArray, jint, jboolean);
 
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    getDirect
+ * Signature: (JLjava/nio/ByteBuffer;ILjava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_getDirect
+        (JNIEnv *, jobject, jlong, jobject, jint, jobject);
+
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    putDirect
+ * Signature: (JLjava/nio/ByteBuffer;ILjava/nio/ByteBuffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_putDirect
+        (JNIEnv *, jobject, jlong, jobject, jint, jobject, jint);
+
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    scanPacked
+ * Signature: (J[BIZ)Lsite/ycsb/db/grpc/rocksdb/GRPCRocksDBClient/PackedKVs;
+ */
+JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_scanPacked
+        (JNIEnv *, jobject, jlong, jbyteArray, jint, jboolean);
+
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    multiGet
+ * Signature: (J[B[I)Lsite/ycsb/db/grpc/rocksdb/GRPCRocksDBClient/PackedKVs;
+ */
+JNIEXPORT jobject JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_multiGet
+        (JNIEnv *, jobject, jlong, jbyteArray, jintArray);
+
+/*
+ * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
+ * Method:    multiPut
+ * Signature: (J[B[I)I
+ */
+JNIEXPORT jint JNICALL Java_site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient_multiPut
+        (JNIEnv *, jobject, jlong, jbyteArray, jintArray);
+
 /*
  * Class:     site_ycsb_db_grpc_rocksdb_GRPCRocksDBClient
  * Method:    disconnect
@@ -0,0 +1,169 @@
+#ifndef GRPC_KVSTORE_ASYNC_KV_CLIENT_H
+#define GRPC_KVSTORE_ASYNC_KV_CLIENT_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+#include "kvstore.grpc.pb.h"
+#include "local_endpoint.h"
+
+
+namespace kvstore {
+    // Pipelined client: requests are issued without waiting for the previous response and
+    // completed by a poller thread draining a grpc::CompletionQueue. At most max_in_flight
+    // requests are outstanding on the channel, further submissions block until a slot is free.
+    // Callbacks run on the poller thread. The slot of a request is freed before its callback
+    // runs, so a callback may issue another request, but it must not call Flush().
+    class AsyncKVClient {
+    public:
+        using GetCallback = std::function<void(const Status &, const std::string &)>;
+        using WriteCallback = std::function<void(const Status &)>;
+
+        AsyncKVClient(const std::shared_ptr<grpc::Channel> &channel, size_t max_in_flight) :
+                stub_(KVStore::NewStub(channel)),
+                max_in_flight_(max_in_flight) {
+            CHECK_GT(max_in_flight_, 0);
+            poller_ = std::thread([this]() { poll(); });
+        }
+
+        AsyncKVClient(const std::string &addr, size_t max_in_flight) :
+                AsyncKVClient(grpc::CreateChannel(localEndpoint(addr), grpc::InsecureChannelCredentials()),
+                              max_in_flight) {
+            LOG(INFO) << "Async client is trying to connect to " << addr;
+        }
+
+        ~AsyncKVClient() {
+            Flush();
+            cq_.Shutdown();
+            poller_.join();
+        }
+
+        void GetAsync(const std::string &key, GetCallback callback) {
+            GetReq req;
+
+            CHECK(key.size() <= 4 * 1024 * 1024);
+            req.set_key(key);
+            issue<GetResp>([&](grpc::ClientContext *ctx) {
+                return stub_->PrepareAsyncGet(ctx, req, &cq_);
+            }, [callback](const Status &status, GetResp &resp) {
+                callback(status, resp.value());
+            });
+        }
+
+        void PutAsync(const std::string &key, const std::string &value, WriteCallback callback) {
+            PutReq req;
+
+            CHECK(key.size() <= 4 * 1024 * 1024);
+            CHECK(value.size() <= 4 * 1024 * 1024);
+            *req.mutable_kv()->mutable_key() = key;
+            *req.mutable_kv()->mutable_value() = value;
+            issue<PutResp>([&](grpc::ClientContext *ctx) {
+                return stub_->PrepareAsyncPut(ctx, req, &cq_);
+            }, [callback](const Status &status, PutResp &) {
+                callback(status);
+            });
+        }
+
+        void DeleteAsync(const std::string &key, WriteCallback callback) {
+            DeleteReq req;
+
+            CHECK(key.size() <= 4 * 1024 * 1024);
+            req.set_key(key);
+            issue<DeleteResp>([&](grpc::ClientContext *ctx) {
+                return stub_->PrepareAsyncDelete(ctx, req, &cq_);
+            }, [callback](const Status &status, DeleteResp &) {
+                callback(status);
+            });
+        }
+
+        // Blocks until every issued request has completed and its callback returned
+        void Flush() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return pending_ == 0; });
+        }
+
+        size_t max_in_flight() const {
+            return max_in_flight_;
+        }
+
+    private:
+        struct AsyncCallBase {
+            grpc::ClientContext ctx;
+            grpc::Status grpc_status;
+
+            virtual ~AsyncCallBase() = default;
+
+            virtual void Done() = 0;
+        };
+
+        template<typename RESP_T>
+        struct AsyncCall : public AsyncCallBase {
+            RESP_T resp;
+            std::unique_ptr<grpc::ClientAsyncResponseReader<RESP_T>> reader;
+            std::function<void(const Status &, RESP_T &)> callback;
+
+            explicit AsyncCall(std::function<void(const Status &, RESP_T &)> cb) : callback(std::move(cb)) {}
+
+            void Done() override {
+                if (!grpc_status.ok()) {
+                    resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                    resp.mutable_status()->set_error_msg(grpc_status.error_message());
+                }
+                callback(resp.status(), resp);
+            }
+        };
+
+        std::unique_ptr<KVStore::Stub> stub_;
+        grpc::CompletionQueue cq_;
+        std::thread poller_;
+        size_t max_in_flight_;
+        size_t in_flight_{};
+        // Issued requests whose callback has not returned yet
+        size_t pending_{};
+        std::mutex mutex_;
+        std::condition_variable cv_;
+
+        template<typename RESP_T, typename PREPARE_T>
+        void issue(PREPARE_T &&prepare, std::function<void(const Status &, RESP_T &)> callback) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return in_flight_ < max_in_flight_; });
+                in_flight_++;
+                pending_++;
+            }
+            auto *call = new AsyncCall<RESP_T>(std::move(callback));
+
+            call->ctx.set_wait_for_ready(true);
+            call->reader = prepare(&call->ctx);
+            call->reader->StartCall();
+            call->reader->Finish(&call->resp, &call->grpc_status, call);
+        }
+
+        void poll() {
+            void *tag;
+            bool ok;
+
+            while (cq_.Next(&tag, &ok)) {
+                auto *call = static_cast<AsyncCallBase *>(tag);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    in_flight_--;
+                }
+                cv_.notify_all();
+                call->Done();
+                delete call;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    pending_--;
+                }
+                cv_.notify_all();
+            }
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_ASYNC_KV_CLIENT_H
@@ -0,0 +1,210 @@
+#ifndef GRPC_KVSTORE_BENCH_DRIVER_H
+#define GRPC_KVSTORE_BENCH_DRIVER_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#include "channel_pool.h"
+#include "kv_client.h"
+#include "replicated_kv_client.h"
+#include "sharded_kv_client.h"
+#include "histogram.h"
+
+namespace kvstore {
+    struct DriverOptions {
+        std::string addr;          // "host:port" or a comma separated list of servers to shard over
+        std::string replicas;      // comma separated replicas of addr that serve the reads, if any
+        int threads = 1;
+        bool shared_channel = false;
+        double duration_sec = 0;   // run for a fixed time if > 0, otherwise until num_ops are done
+        size_t num_ops = 0;
+        int report_interval_ms = 1000;
+        std::string output;        // throughput timeline, JSON if the path ends with .json, CSV otherwise
+    };
+
+    // Closed-loop load generator: every client thread issues its next request as soon as the
+    // previous one returns. Each thread records per-op latency into its own histograms, which
+    // are merged once all threads are done. A reporter thread samples the completed op count
+    // every report_interval_ms to build the throughput-over-time series.
+    class BenchDriver {
+    public:
+        // Runs one request and returns its index into op_names, or -1 when the thread has no more work
+        using Op = std::function<int(KVClient &)>;
+        // Called once on every client thread to build its Op, so ops can keep per-thread state
+        using OpFactory = std::function<Op(int tid)>;
+
+        explicit BenchDriver(DriverOptions options) : options_(std::move(options)) {
+            CHECK_GT(options_.threads, 0);
+            CHECK(options_.duration_sec > 0 || options_.num_ops > 0) << "Either duration or op count is needed";
+            CHECK_GT(options_.report_interval_ms, 0);
+        }
+
+        void Run(const std::vector<std::string> &op_names, const OpFactory &op_factory) {
+            std::vector<std::shared_ptr<KVClient>> clients;
+            std::vector<std::vector<Histogram>> histograms(options_.threads,
+                                                           std::vector<Histogram>(op_names.size()));
+            std::vector<std::thread> ths;
+            std::atomic_size_t issued{0};
+            std::atomic_int running{options_.threads};
+
+            if (options_.shared_channel) {
+                clients.assign(options_.threads, NewClient(options_.addr, options_.replicas));
+            } else {
+                for (int tid = 0; tid < options_.threads; tid++) {
+                    clients.push_back(NewClient(options_.addr, options_.replicas));
+                }
+            }
+            completed_ = 0;
+            stop_ = false;
+            timeline_.clear();
+
+            auto begin = std::chrono::steady_clock::now();
+            std::thread reporter([this, &running, begin]() { report(running, begin); });
+
+            for (int tid = 0; tid < options_.threads; tid++) {
+                ths.emplace_back([&, tid]() {
+                    auto op = op_factory(tid);
+                    auto &cli = *clients[tid];
+                    auto &op_histograms = histograms[tid];
+
+                    while (!stop_.load(std::memory_order_relaxed)) {
+                        if (options_.duration_sec <= 0 && issued.fetch_add(1) >= options_.num_ops) {
+                            break;
+                        }
+                        auto t1 = std::chrono::steady_clock::now();
+                        int op_idx = op(cli);
+                        auto t2 = std::chrono::steady_clock::now();
+
+                        if (op_idx < 0) {
+                            break;
+                        }
+                        op_histograms[op_idx].Record(
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+                        completed_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    running--;
+                });
+            }
+
+            for (auto &th: ths) {
+                th.join();
+            }
+            stop_ = true;
+            reporter.join();
+            double elapsed_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - begin).count() / 1000.0;
+
+            Histogram all;
+            LOG(INFO) << "Threads: " << options_.threads << " shared channel: " << options_.shared_channel
+                      << " ops: " << completed_ << " Time: " << elapsed_ms << " ms, avg: "
+                      << completed_ / (elapsed_ms / 1000) << " ops/s";
+            for (size_t i = 0; i < op_names.size(); i++) {
+                Histogram merged;
+
+                for (auto &thread_histograms: histograms) {
+                    merged.Merge(thread_histograms[i]);
+                }
+                if (merged.count() > 0) {
+                    LOG(INFO) << "[" << op_names[i] << "] latency (us) " << merged.ToString(1000);
+                }
+                all.Merge(merged);
+            }
+            LOG(INFO) << "[OVERALL] latency (us) " << all.ToString(1000);
+            if (!options_.output.empty()) {
+                dump(all, elapsed_ms);
+            }
+        }
+
+        static std::shared_ptr<grpc::Channel> NewChannel(const std::string &addr) {
+            return newDedicatedChannel(addr);
+        }
+
+        // Client with its own channels, sharded if addr lists several servers, reading from
+        // replicas if there are any
+        static std::shared_ptr<KVClient> NewClient(const std::string &addr, const std::string &replicas = "") {
+            auto endpoints = splitEndpoints(addr);
+
+            if (!replicas.empty()) {
+                std::vector<std::shared_ptr<KVClient>> replica_clients;
+
+                CHECK_EQ(endpoints.size(), 1) << "Replicas need a single primary";
+                for (auto &replica: splitEndpoints(replicas)) {
+                    replica_clients.push_back(std::make_shared<KVClient>(NewChannel(replica)));
+                }
+                return std::make_shared<ReplicatedKVClient>(NewClient(addr), replica_clients);
+            }
+            if (endpoints.size() > 1) {
+                std::vector<std::shared_ptr<grpc::Channel>> channels;
+
+                for (auto &endpoint: endpoints) {
+                    channels.push_back(NewChannel(endpoint));
+                }
+                return std::make_shared<ShardedKVClient>(endpoints, channels);
+            }
+            return std::make_shared<KVClient>(NewChannel(addr));
+        }
+
+    private:
+        DriverOptions options_;
+        std::atomic_size_t completed_{0};
+        std::atomic_bool stop_{false};
+        std::vector<std::pair<double, size_t>> timeline_; // (elapsed seconds, ops completed in interval)
+
+        void report(std::atomic_int &running, std::chrono::steady_clock::time_point begin) {
+            auto interval = std::chrono::milliseconds(options_.report_interval_ms);
+            auto next = begin + interval;
+            size_t last = 0;
+
+            while (running > 0) {
+                std::this_thread::sleep_until(next);
+                size_t curr = completed_.load();
+                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - begin).count() / 1000.0;
+
+                timeline_.emplace_back(elapsed, curr - last);
+                LOG(INFO) << "[" << elapsed << " s] " << (curr - last) * 1000.0 / options_.report_interval_ms
+                          << " ops/s";
+                last = curr;
+                next += interval;
+                if (options_.duration_sec > 0 && elapsed >= options_.duration_sec) {
+                    stop_ = true;
+                }
+            }
+        }
+
+        void dump(const Histogram &all, double elapsed_ms) {
+            std::ofstream out(options_.output);
+            bool json = options_.output.size() >= 5 &&
+                        options_.output.compare(options_.output.size() - 5, 5, ".json") == 0;
+            double interval_s = options_.report_interval_ms / 1000.0;
+
+            CHECK(out.is_open()) << "Can not open " << options_.output;
+            if (json) {
+                out << "{\"threads\": " << options_.threads << ", \"ops\": " << completed_
+                    << ", \"time_ms\": " << elapsed_ms << ", \"throughput\": " << completed_ / (elapsed_ms / 1000)
+                    << ", \"latency_us\": {\"p50\": " << all.Percentile(50) / 1000.0
+                    << ", \"p99\": " << all.Percentile(99) / 1000.0
+                    << ", \"p99.9\": " << all.Percentile(99.9) / 1000.0
+                    << ", \"max\": " << all.max() / 1000.0 << "}, \"timeline\": [";
+                for (size_t i = 0; i < timeline_.size(); i++) {
+                    out << (i > 0 ? ", " : "") << "{\"time_s\": " << timeline_[i].first
+                        << ", \"throughput\": " << timeline_[i].second / interval_s << "}";
+                }
+                out << "]}\n";
+            } else {
+                out << "time_s,ops,throughput\n";
+                for (auto &point: timeline_) {
+                    out << point.first << "," << point.second << "," << point.second / interval_s << "\n";
+                }
+            }
+            LOG(INFO) << "Timeline is written to " << options_.output;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_BENCH_DRIVER_H
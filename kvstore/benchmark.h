@@ -1,9 +1,16 @@
 #ifndef GRPC_KVSTORE_BENCHMARK_H
 #define GRPC_KVSTORE_BENCHMARK_H
 
+#include <iostream>
+#include <random>
 #include "glog/logging.h"
 #include "kv_client.h"
+#include "async_kv_client.h"
+#include "raw_kv_client.h"
+#include "bench_driver.h"
+#include "workload.h"
 #include "stopwatch.h"
+#include "metrics.h"
 #include "common.h"
 
 namespace kvstore {
@@ -23,14 +30,14 @@ namespace kvstore {
     }
 
     void TestScan(const std::shared_ptr<KVClient> &kv_cli,
-                  size_t batch_size) {
+                  size_t batch_size, const ScanOptions &options = ScanOptions()) {
         Stopwatch sw;
         std::vector<KV> kvs;
         kvs.reserve(1000000);
         size_t size_in_byte = 0;
 
         sw.start();
-        Status status = kv_cli->Scan("", kvs, batch_size);
+        Status status = kv_cli->Scan("", kvs, batch_size, options);
         sw.stop();
 
         if (status.error_code() != ErrorCode::OK) {
@@ -46,8 +53,33 @@ namespace kvstore {
         LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << kvs.size() / (sw.ms() / 1000) << " kv/s";
     }
 
+    void TestGetPipelined(const std::shared_ptr<KVClient> &kv_cli,
+                          const std::vector<KV> &kvs, size_t pipeline_depth) {
+        Stopwatch sw;
+        AsyncKVClient async_cli(kv_cli->channel(), pipeline_depth);
+        size_t size_in_byte = 0;
+
+        sw.start();
+        for (auto &kv: kvs) {
+            async_cli.GetAsync(kv.key(), [&kv, &size_in_byte](const Status &status, const std::string &value) {
+                if (status.error_code() != ErrorCode::OK) {
+                    LOG(FATAL) << "Failed to get key " << kv.key() << " ErrorCode: " << status.error_code()
+                               << " msg: " << status.error_msg();
+                }
+                CHECK_EQ(kv.value(), value) << "Value does not match with the value from GetBatch: " << value
+                                            << " vs " << kv.value();
+                size_in_byte += kv.key().size() + kv.value().size();
+            });
+        }
+        async_cli.Flush();
+        sw.stop();
+        LOG(INFO) << kvs.size() << " kvs are found, pipeline depth: " << pipeline_depth << " total data size: "
+                  << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
+        LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << kvs.size() / (sw.ms() / 1000) << " kv/s";
+    }
+
     void TestGet(const std::shared_ptr<KVClient> &kv_cli,
-                 size_t batch_size) {
+                 size_t batch_size, size_t pipeline_depth = 1) {
         Stopwatch sw;
         std::vector<KV> kvs;
         Status status;
@@ -57,6 +89,10 @@ namespace kvstore {
         if (status.error_code() != ErrorCode::OK) {
             LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
         }
+        if (pipeline_depth > 1) {
+            TestGetPipelined(kv_cli, kvs, pipeline_depth);
+            return;
+        }
         sw.start();
         for (auto &kv: kvs) {
             std::string value;
@@ -78,7 +114,7 @@ namespace kvstore {
 
     void TestPut(const std::shared_ptr<KVClient> &kv_cli,
                  size_t key_size, size_t max_val_size, size_t batch_size,
-                 bool variable_value_size) {
+                 bool variable_value_size, size_t pipeline_depth = 1) {
         Stopwatch sw;
         std::vector<std::pair<std::string, std::string>> reqs;
         size_t size_in_byte = 0;
@@ -93,19 +129,34 @@ namespace kvstore {
             size_in_byte += key_size + val_size;
         }
 
-        sw.start();
-        for (size_t i = 0; i < batch_size; i++) {
-            auto &req = reqs[i];
-            auto status = kv_cli->Put(req.first, req.second);
+        if (pipeline_depth > 1) {
+            AsyncKVClient async_cli(kv_cli->channel(), pipeline_depth);
 
-            if (status.error_code() != ErrorCode::OK) {
-                LOG(FATAL) << "Put Error: " << status.error_code() << " msg: " << status.error_msg();
+            sw.start();
+            for (auto &req: reqs) {
+                async_cli.PutAsync(req.first, req.second, [](const Status &status) {
+                    if (status.error_code() != ErrorCode::OK) {
+                        LOG(FATAL) << "Put Error: " << status.error_code() << " msg: " << status.error_msg();
+                    }
+                });
+            }
+            async_cli.Flush();
+            sw.stop();
+        } else {
+            sw.start();
+            for (size_t i = 0; i < batch_size; i++) {
+                auto &req = reqs[i];
+                auto status = kv_cli->Put(req.first, req.second);
+
+                if (status.error_code() != ErrorCode::OK) {
+                    LOG(FATAL) << "Put Error: " << status.error_code() << " msg: " << status.error_msg();
+                }
             }
+            sw.stop();
         }
-        sw.stop();
 
         LOG(INFO) << batch_size << " kvs are inserted, max Value size: " << max_val_size << " Batch size: "
-                  << batch_size
+                  << batch_size << " pipeline depth: " << pipeline_depth
                   << " Total data size: " << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
         LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << batch_size / (sw.ms() / 1000) << " kv/s";
     }
@@ -136,6 +187,397 @@ namespace kvstore {
         LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << kvs.size() / (sw.ms() / 1000) << " kv/s";
     }
 
+    void TestMultiGet(const std::shared_ptr<KVClient> &kv_cli,
+                      size_t batch_size, size_t multi_size) {
+        Stopwatch sw;
+        std::vector<KV> kvs;
+        Status status;
+        size_t size_in_byte = 0;
+
+        CHECK_GT(multi_size, 0);
+        status = kv_cli->Scan("", kvs, batch_size);
+        if (status.error_code() != ErrorCode::OK) {
+            LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
+        }
+        sw.start();
+        for (size_t begin = 0; begin < kvs.size(); begin += multi_size) {
+            size_t end = std::min(begin + multi_size, kvs.size());
+            std::vector<std::string> keys, values;
+            std::vector<Status> statuses;
+
+            for (size_t i = begin; i < end; i++) {
+                keys.push_back(kvs[i].key());
+            }
+            status = kv_cli->MultiGet(keys, values, &statuses);
+            if (status.error_code() != ErrorCode::OK) {
+                LOG(FATAL) << "MultiGet Error: " << status.error_code() << " msg: " << status.error_msg();
+            }
+            CHECK_EQ(values.size(), keys.size());
+            for (size_t i = begin; i < end; i++) {
+                auto &kv = kvs[i];
+                auto &key_status = statuses[i - begin];
+
+                if (key_status.error_code() != ErrorCode::OK) {
+                    LOG(FATAL) << "Failed to get key " << kv.key() << " ErrorCode: " << key_status.error_code()
+                               << " msg: " << key_status.error_msg();
+                }
+                CHECK_EQ(kv.value(), values[i - begin]) << "Value does not match with the value from GetBatch";
+                size_in_byte += kv.key().size() + kv.value().size();
+            }
+        }
+        sw.stop();
+        LOG(INFO) << kvs.size() << " kvs are found, keys per RPC: " << multi_size << " total data size: "
+                  << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
+        LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << kvs.size() / (sw.ms() / 1000) << " kv/s";
+    }
+
+    void TestMultiPut(const std::shared_ptr<KVClient> &kv_cli,
+                      size_t key_size, size_t max_val_size, size_t batch_size,
+                      bool variable_value_size, size_t multi_size) {
+        Stopwatch sw;
+        std::vector<std::vector<std::pair<std::string, std::string>>> reqs;
+        size_t size_in_byte = 0;
+
+        CHECK_GT(multi_size, 0);
+        for (size_t i = 0; i < batch_size; i++) {
+            std::string key = gen_random_string(key_size), value;
+            auto val_size = variable_value_size ? random(1, max_val_size) : max_val_size;
+
+            if (i % multi_size == 0) {
+                reqs.emplace_back();
+                reqs.back().reserve(multi_size);
+            }
+            value.resize(val_size);
+            reqs.back().emplace_back(std::make_pair(key, value));
+            size_in_byte += key_size + val_size;
+        }
+
+        sw.start();
+        for (auto &req: reqs) {
+            auto status = kv_cli->MultiPut(req);
+
+            if (status.error_code() != ErrorCode::OK) {
+                LOG(FATAL) << "MultiPut Error: " << status.error_code() << " msg: " << status.error_msg();
+            }
+        }
+        sw.stop();
+
+        LOG(INFO) << batch_size << " kvs are inserted, max Value size: " << max_val_size << " Batch size: "
+                  << batch_size << " keys per RPC: " << multi_size
+                  << " Total data size: " << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
+        LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << batch_size / (sw.ms() / 1000) << " kv/s";
+    }
+
+    void TestMultiDelete(const std::shared_ptr<KVClient> &kv_cli,
+                         size_t batch_size, size_t multi_size) {
+        Stopwatch sw;
+        std::vector<KV> kvs;
+        Status status = kv_cli->Scan("", kvs, batch_size);
+        size_t size_in_byte = 0;
+
+        CHECK_GT(multi_size, 0);
+        if (status.error_code() != ErrorCode::OK) {
+            LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
+        }
+
+        sw.start();
+        for (size_t begin = 0; begin < kvs.size(); begin += multi_size) {
+            size_t end = std::min(begin + multi_size, kvs.size());
+            std::vector<std::string> keys;
+
+            for (size_t i = begin; i < end; i++) {
+                keys.push_back(kvs[i].key());
+                size_in_byte += kvs[i].key().size() + kvs[i].value().size();
+            }
+            status = kv_cli->MultiDelete(keys);
+            if (status.error_code() != ErrorCode::OK) {
+                LOG(FATAL) << "MultiDelete Error: " << status.error_code() << " msg: " << status.error_msg();
+            }
+        }
+        sw.stop();
+        LOG(INFO) << kvs.size() << " kvs are deleted, keys per RPC: " << multi_size << " total data size: "
+                  << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
+        LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << kvs.size() / (sw.ms() / 1000) << " kv/s";
+    }
+
+    // Loads batch_size random kvs through the BulkLoad stream, the kvs are generated while
+    // they are sent, so the time includes generating them
+    void TestBulkLoad(const std::shared_ptr<KVClient> &kv_cli,
+                      size_t key_size, size_t max_val_size, size_t batch_size, bool variable_value_size) {
+        Stopwatch sw;
+        size_t size_in_byte = 0, generated = 0;
+        uint64_t loaded = 0;
+
+        sw.start();
+        auto status = kv_cli->BulkLoad([&](KV *kv) {
+            if (generated == batch_size) {
+                return false;
+            }
+            auto val_size = variable_value_size ? random(1, max_val_size) : max_val_size;
+
+            *kv->mutable_key() = gen_random_string(key_size);
+            kv->mutable_value()->assign(val_size, 0);
+            size_in_byte += key_size + val_size;
+            generated++;
+            return true;
+        }, &loaded);
+        sw.stop();
+
+        if (status.error_code() != ErrorCode::OK) {
+            LOG(FATAL) << "BulkLoad Error: " << status.error_code() << " msg: " << status.error_msg();
+        }
+        LOG(INFO) << loaded << " kvs are bulk loaded, max Value size: " << max_val_size
+                  << " Total data size: " << (float) size_in_byte / 1024.0 / 1024.0 << " MB";
+        LOG(INFO) << "Time: " << sw.ms() << " ms, avg: " << loaded / (sw.ms() / 1000) << " kv/s";
+    }
+
+    void ShowReplicationStatus(const std::shared_ptr<KVClient> &kv_cli) {
+        ReplicationStatusResp resp;
+
+        CHECK(kv_cli->channel() != nullptr) << "Replication status is read from a single server";
+        auto grpc_status = GetReplicationStatus(kv_cli->channel(), &resp);
+
+        CHECK(grpc_status.ok()) << grpc_status.error_message();
+        if (resp.replica()) {
+            LOG(INFO) << "Replica of " << resp.primary();
+        } else {
+            LOG(INFO) << "Primary";
+        }
+        for (int i = 0; i < resp.shards_size(); i++) {
+            auto &shard = resp.shards(i);
+
+            LOG(INFO) << "Shard " << i << " applied sequence: " << shard.applied_sequence() << " primary sequence: "
+                      << shard.primary_sequence() << " lag: " << shard.lag_ms() << " ms"
+                      << (resp.replica() && !shard.connected() ? " (disconnected)" : "");
+        }
+    }
+
+    // Gets up to batch_size keys with tracing and logs where the server spent the time of each
+    void TraceGet(const std::shared_ptr<KVClient> &kv_cli, size_t batch_size) {
+        std::vector<KV> kvs;
+        Status status = kv_cli->Scan("", kvs, batch_size);
+
+        CHECK(kv_cli->channel() != nullptr) << "Traces are read from a single server";
+        if (status.error_code() != ErrorCode::OK) {
+            LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
+        }
+        for (auto &kv: kvs) {
+            std::string value, trace;
+
+            status = GetTraced(kv_cli->channel(), kv.key(), value, &trace);
+            CHECK_EQ(status.error_code(), ErrorCode::OK) << status.error_msg();
+            LOG_IF(WARNING, trace.empty()) << "No trace for " << kv.key() << ", is the server running with --async --trace?";
+            LOG_IF(INFO, !trace.empty()) << kv.key() << ": " << trace;
+        }
+    }
+
+    void ShowStats(const std::shared_ptr<KVClient> &kv_cli, bool prometheus) {
+        StatsResp resp;
+
+        CHECK(kv_cli->channel() != nullptr) << "Stats are read from a single server";
+        auto grpc_status = GetStats(kv_cli->channel(), prometheus, &resp);
+
+        CHECK(grpc_status.ok()) << grpc_status.error_message();
+        if (prometheus) {
+            std::cout << resp.prometheus();
+            return;
+        }
+        LOG(INFO) << "Uptime: " << resp.uptime_sec() << " s, CPU: " << resp.cpu_sec() << " s, bytes in: "
+                  << resp.bytes_in() << ", bytes out: " << resp.bytes_out();
+        for (auto &latency: resp.latencies()) {
+            LOG(INFO) << latency.method() << " count: " << latency.count() << " mean: " << latency.mean_us()
+                      << " us P50: " << latency.p50_us() << " us P99: " << latency.p99_us() << " us P999: "
+                      << latency.p999_us() << " us max: " << latency.max_us() << " us";
+        }
+        for (int cq = 0; cq < resp.in_flight_size(); cq++) {
+            LOG(INFO) << "Completion queue " << cq << " in flight: " << resp.in_flight(cq)
+                      << ", calls allocated: " << resp.calls_allocated(cq) << ", reused: " << resp.calls_reused(cq);
+        }
+        for (int i = 0; i < resp.shards_size(); i++) {
+            for (auto &property: resp.shards(i).properties()) {
+                LOG(INFO) << "Shard " << i << " " << property.first << ": " << property.second;
+            }
+        }
+    }
+
+    // CPU time of the server process in microseconds, from its Stats RPC
+    inline double serverCpuMicros(const std::shared_ptr<grpc::Channel> &channel) {
+        StatsResp resp;
+        auto grpc_status = GetStats(channel, false, &resp);
+
+        CHECK(grpc_status.ok()) << grpc_status.error_message();
+        return resp.cpu_sec() * 1e6;
+    }
+
+    // Gets the same keys through the protobuf service and through the raw service and reports
+    // latency and client and server CPU per op of both, the server has to run with the raw
+    // service. Nothing else should load the server meanwhile, its CPU is counted as a whole
+    void TestRawGet(const std::shared_ptr<KVClient> &kv_cli, size_t batch_size) {
+        CHECK(kv_cli->channel() != nullptr) << "Raw gets go to a single server";
+        std::vector<KV> kvs;
+        Status status = kv_cli->Scan("", kvs, batch_size);
+
+        if (status.error_code() != ErrorCode::OK) {
+            LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
+        }
+        if (kvs.empty()) {
+            LOG(WARNING) << "No kvs to get";
+            return;
+        }
+        KVClient proto_cli(kv_cli->channel());
+        RawKVClient raw_cli(kv_cli->channel());
+        std::pair<const char *, KVClient *> clients[] = {{"proto", &proto_cli}, {"raw", &raw_cli}};
+
+        for (auto &client: clients) {
+            Stopwatch sw;
+            double cpu_begin = cpuMicros();
+            double server_cpu_begin = serverCpuMicros(kv_cli->channel());
+
+            sw.start();
+            for (auto &kv: kvs) {
+                std::string value;
+
+                status = client.second->Get(kv.key(), value);
+                if (status.error_code() != ErrorCode::OK) {
+                    LOG(FATAL) << "Failed to get key " << kv.key() << " ErrorCode: " << status.error_code()
+                               << " msg: " << status.error_msg();
+                }
+                CHECK_EQ(kv.value(), value) << "Value does not match with the value from GetBatch";
+            }
+            sw.stop();
+            double cpu = cpuMicros() - cpu_begin;
+            double server_cpu = serverCpuMicros(kv_cli->channel()) - server_cpu_begin;
+
+            LOG(INFO) << client.first << ": " << kvs.size() << " gets, " << sw.ms() * 1000 / kvs.size()
+                      << " us/op, client CPU " << cpu / kvs.size() << " us/op, server CPU "
+                      << server_cpu / kvs.size() << " us/op";
+        }
+    }
+
+    // Multi-threaded closed-loop version of TestGet/TestPut/TestScan/TestDelete that reports
+    // latency percentiles instead of a single average
+    void TestClosedLoop(const DriverOptions &options, const std::string &op,
+                        size_t key_size, size_t max_val_size, size_t batch_size,
+                        bool variable_value_size, size_t scan_length) {
+        BenchDriver driver(options);
+        std::vector<KV> kvs;
+
+        if (op != "put") {
+            auto kv_cli = NewKVClient(options.addr);
+            Status status = kv_cli->Scan("", kvs, batch_size);
+
+            if (status.error_code() != ErrorCode::OK) {
+                LOG(FATAL) << "GetBatch Error: " << status.error_code() << " msg: " << status.error_msg();
+            }
+            CHECK(!kvs.empty()) << "No kvs are found, put some first";
+        }
+
+        if (op == "get") {
+            driver.Run({"GET"}, [&](int tid) -> BenchDriver::Op {
+                auto rng = std::make_shared<std::mt19937_64>(tid);
+                return [&kvs, rng](KVClient &cli) {
+                    auto &kv = kvs[(*rng)() % kvs.size()];
+                    std::string value;
+                    auto status = cli.Get(kv.key(), value);
+
+                    if (status.error_code() != ErrorCode::OK) {
+                        LOG(FATAL) << "Failed to get key " << kv.key() << " ErrorCode: " << status.error_code()
+                                   << " msg: " << status.error_msg();
+                    }
+                    return 0;
+                };
+            });
+        } else if (op == "put") {
+            driver.Run({"PUT"}, [=](int tid) -> BenchDriver::Op {
+                auto rng = std::make_shared<std::mt19937_64>(tid);
+                return [=](KVClient &cli) {
+                    static const char alphanum[] =
+                            "0123456789"
+                            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz";
+                    std::string key, value;
+
+                    key.resize(key_size);
+                    for (auto &c: key) {
+                        c = alphanum[(*rng)() % (sizeof(alphanum) - 1)];
+                    }
+                    value.resize(variable_value_size ? 1 + (*rng)() % max_val_size : max_val_size);
+                    auto status = cli.Put(key, value);
+
+                    if (status.error_code() != ErrorCode::OK) {
+                        LOG(FATAL) << "Put Error: " << status.error_code() << " msg: " << status.error_msg();
+                    }
+                    return 0;
+                };
+            });
+        } else if (op == "scan") {
+            driver.Run({"SCAN"}, [&](int tid) -> BenchDriver::Op {
+                auto rng = std::make_shared<std::mt19937_64>(tid);
+                return [&kvs, rng, scan_length](KVClient &cli) {
+                    std::vector<KV> result;
+                    auto status = cli.Scan(kvs[(*rng)() % kvs.size()].key(), result, scan_length);
+
+                    if (status.error_code() != ErrorCode::OK) {
+                        LOG(FATAL) << "Scan Error: " << status.error_code() << " msg: " << status.error_msg();
+                    }
+                    return 0;
+                };
+            });
+        } else if (op == "delete") {
+            driver.Run({"DELETE"}, [&](int tid) -> BenchDriver::Op {
+                auto next = std::make_shared<size_t>(tid);
+                return [&kvs, next, &options](KVClient &cli) {
+                    if (*next >= kvs.size()) {
+                        return -1;
+                    }
+                    auto &kv = kvs[*next];
+                    auto status = cli.Delete(kv.key());
+
+                    if (status.error_code() != ErrorCode::OK) {
+                        LOG(FATAL) << "Failed to delete key " << kv.key() << " ErrorCode: " << status.error_code()
+                                   << " msg: " << status.error_msg();
+                    }
+                    *next += options.threads;
+                    return 0;
+                };
+            });
+        } else {
+            LOG(FATAL) << "Bad bench op: " << op;
+        }
+    }
+
+    // YCSB core workload without the JVM: phase "load" inserts recordcount records,
+    // phase "run" issues operationcount operations with the configured mix
+    void TestWorkload(DriverOptions options, const std::string &phase, const std::string &preset,
+                      const std::string &workload_file, const std::string &workload_props,
+                      size_t val_size, bool variable_value_size) {
+        auto props = CoreWorkload::Preset(preset);
+
+        props["fieldlength"] = std::to_string(val_size);
+        props["fieldlengthdistribution"] = variable_value_size ? "uniform" : "constant";
+        if (!workload_file.empty()) {
+            CoreWorkload::LoadFile(workload_file, props);
+        }
+        CoreWorkload::LoadString(workload_props, props);
+
+        CoreWorkload workload(props);
+        for (auto &kv: props) {
+            LOG(INFO) << "Workload property " << kv.first << "=" << kv.second;
+        }
+        if (phase == "load") {
+            options.num_ops = workload.record_count();
+            BenchDriver(options).Run(CoreWorkload::OpNames(), workload.LoadOps());
+        } else if (phase == "run") {
+            options.num_ops = workload.operation_count();
+            BenchDriver(options).Run(CoreWorkload::OpNames(), workload.RunOps());
+        } else {
+            LOG(FATAL) << "Bad workload phase: " << phase;
+        }
+        if (workload.failed() > 0) {
+            LOG(WARNING) << workload.failed() << " operations failed";
+        }
+    }
+
     void Warmup(const std::shared_ptr<KVClient> &kv_cli,
                 size_t size_in_byte,
                 bool big_req,
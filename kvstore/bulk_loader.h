@@ -0,0 +1,259 @@
+#ifndef GRPC_KVSTORE_BULK_LOADER_H
+#define GRPC_KVSTORE_BULK_LOADER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/sst_file_writer.h"
+
+namespace kvstore {
+    const size_t DEFAULT_BULK_LOAD_CHUNK_BYTES = 64 * 1024 * 1024;
+
+    // Loads kvs into the shards without the WAL and the memtable. Kvs are buffered per shard,
+    // every full buffer is sorted and written to an SST file by a background task, so several
+    // files are written in parallel while more kvs arrive. Finish() ingests all files of a
+    // shard with one IngestExternalFile call, which makes them visible at once. If the files
+    // of a shard overlap, because kvs did not arrive in key order, they are ingested one after
+    // another in arrival order so a later value of a key still wins. Shards are ingested one
+    // after another, a failure can leave the earlier shards loaded.
+    class BulkLoader {
+    public:
+        BulkLoader(std::vector<rocksdb::DB *> dbs, std::function<size_t(const std::string &)> shard_index,
+                   size_t chunk_bytes = DEFAULT_BULK_LOAD_CHUNK_BYTES) :
+                dbs_(std::move(dbs)), shard_index_(std::move(shard_index)), chunk_bytes_(chunk_bytes),
+                shards_(dbs_.size()),
+                max_tasks_(std::max<size_t>(std::thread::hardware_concurrency(), 1)) {
+            static std::atomic_uint64_t next_id{0};
+            auto id = std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "-" +
+                      std::to_string(next_id++);
+
+            for (size_t i = 0; i < dbs_.size(); i++) {
+                // Next to the DB, so ingesting can move the files instead of copying them
+                shards_[i].dir = dbs_[i]->GetName() + "/bulkload-" + id;
+            }
+        }
+
+        BulkLoader(const BulkLoader &) = delete;
+
+        ~BulkLoader() {
+            Abort();
+        }
+
+        void Add(const std::string &key, const std::string &value) {
+            size_t i = shard_index_(key);
+            auto &shard = shards_[i];
+
+            shard.bytes += key.size() + value.size();
+            shard.kvs.emplace_back(key, value);
+            added_++;
+            if (shard.bytes >= chunk_bytes_) {
+                spill(i);
+            }
+        }
+
+        size_t added() const {
+            return added_;
+        }
+
+        // Writes the rest of the kvs, waits for all files and ingests them. The number of
+        // ingested files is stored in files
+        rocksdb::Status Finish(size_t *files = nullptr) {
+            rocksdb::Status status;
+            size_t num_files = 0;
+
+            for (size_t i = 0; i < shards_.size(); i++) {
+                spill(i);
+            }
+            while (!tasks_.empty()) {
+                auto s = wait();
+                if (status.ok() && !s.ok()) {
+                    status = s;
+                }
+            }
+            for (size_t i = 0; i < shards_.size() && status.ok(); i++) {
+                auto &shard = shards_[i];
+
+                if (shard.files.empty()) {
+                    continue;
+                }
+                rocksdb::IngestExternalFileOptions options;
+                options.move_files = true;
+                if (overlapping(shard.files)) {
+                    LOG(WARNING) << "Bulk load files of shard " << i << " overlap, ingesting them one by one";
+                    for (auto &file: shard.files) {
+                        status = dbs_[i]->IngestExternalFile({file.path}, options);
+                        if (!status.ok()) {
+                            break;
+                        }
+                    }
+                } else {
+                    std::vector<std::string> paths;
+                    for (auto &file: shard.files) {
+                        paths.push_back(file.path);
+                    }
+                    status = dbs_[i]->IngestExternalFile(paths, options);
+                }
+                num_files += shard.files.size();
+            }
+            if (files != nullptr) {
+                *files = num_files;
+            }
+            cleanup();
+            return status;
+        }
+
+        // Drops everything not ingested yet
+        void Abort() {
+            while (!tasks_.empty()) {
+                wait();
+            }
+            cleanup();
+        }
+
+    private:
+        struct File {
+            std::string path;
+            std::string smallest;
+            std::string largest;
+        };
+
+        struct Shard {
+            std::string dir;
+            std::vector<std::pair<std::string, std::string>> kvs;
+            size_t bytes{};
+            bool dir_created{};
+            std::vector<File> files;
+        };
+
+        struct Written {
+            rocksdb::Status status;
+            std::string smallest;
+            std::string largest;
+        };
+
+        struct Task {
+            size_t shard;
+            size_t file;
+            std::future<Written> written;
+        };
+
+        std::vector<rocksdb::DB *> dbs_;
+        std::function<size_t(const std::string &)> shard_index_;
+        size_t chunk_bytes_;
+        std::vector<Shard> shards_;
+        size_t max_tasks_;
+        size_t added_{};
+        std::deque<Task> tasks_;
+
+        // Hands the buffered kvs of a shard to a background writer, at most max_tasks_ run at once
+        void spill(size_t i) {
+            auto &shard = shards_[i];
+
+            if (shard.kvs.empty()) {
+                return;
+            }
+            if (!shard.dir_created) {
+                CHECK(rocksdb::Env::Default()->CreateDirIfMissing(shard.dir).ok()) << "Cannot create " << shard.dir;
+                shard.dir_created = true;
+            }
+            while (tasks_.size() >= max_tasks_) {
+                wait();
+            }
+            auto path = shard.dir + "/" + std::to_string(shard.files.size()) + ".sst";
+            auto kvs = std::make_shared<std::vector<std::pair<std::string, std::string>>>(std::move(shard.kvs));
+            auto options = dbs_[i]->GetOptions();
+
+            shard.files.push_back({path, "", ""});
+            shard.kvs.clear();
+            shard.bytes = 0;
+            tasks_.push_back({i, shard.files.size() - 1, std::async(std::launch::async, [kvs, path, options]() {
+                return write(options, *kvs, path);
+            })});
+        }
+
+        rocksdb::Status wait() {
+            auto task = std::move(tasks_.front());
+            auto written = task.written.get();
+            auto &file = shards_[task.shard].files[task.file];
+
+            tasks_.pop_front();
+            file.smallest = std::move(written.smallest);
+            file.largest = std::move(written.largest);
+            return written.status;
+        }
+
+        // Sorts kvs, keeps the last value of every key and writes them to an SST file
+        static Written write(const rocksdb::Options &options, std::vector<std::pair<std::string, std::string>> &kvs,
+                             const std::string &path) {
+            auto *cmp = options.comparator;
+            Written written;
+
+            std::stable_sort(kvs.begin(), kvs.end(), [cmp](const auto &a, const auto &b) {
+                return cmp->Compare(a.first, b.first) < 0;
+            });
+            rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), options);
+            written.status = writer.Open(path);
+            for (size_t j = 0; j < kvs.size() && written.status.ok(); j++) {
+                if (j + 1 < kvs.size() && cmp->Compare(kvs[j].first, kvs[j + 1].first) == 0) {
+                    continue;
+                }
+                written.status = writer.Put(kvs[j].first, kvs[j].second);
+            }
+            if (written.status.ok()) {
+                written.status = writer.Finish();
+                written.smallest = kvs.front().first;
+                written.largest = kvs.back().first;
+            }
+            return written;
+        }
+
+        // Whether the key ranges of the files intersect, under the bytewise order of the default comparator
+        static bool overlapping(const std::vector<File> &files) {
+            auto sorted = files;
+
+            std::sort(sorted.begin(), sorted.end(), [](const File &a, const File &b) {
+                return a.smallest < b.smallest;
+            });
+            for (size_t j = 1; j < sorted.size(); j++) {
+                if (sorted[j].smallest <= sorted[j - 1].largest) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void cleanup() {
+            auto *env = rocksdb::Env::Default();
+
+            for (auto &shard: shards_) {
+                if (!shard.dir_created) {
+                    continue;
+                }
+                std::vector<std::string> children;
+                env->GetChildren(shard.dir, &children);
+                for (auto &child: children) {
+                    if (child != "." && child != "..") {
+                        env->DeleteFile(shard.dir + "/" + child);
+                    }
+                }
+                env->DeleteDir(shard.dir);
+                shard.dir_created = false;
+                shard.files.clear();
+                shard.kvs.clear();
+                shard.bytes = 0;
+            }
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_BULK_LOADER_H
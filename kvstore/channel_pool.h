@@ -0,0 +1,80 @@
+#ifndef GRPC_KVSTORE_CHANNEL_POOL_H
+#define GRPC_KVSTORE_CHANNEL_POOL_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include "glog/logging.h"
+#include "local_endpoint.h"
+
+namespace kvstore {
+    // Channel with a connection of its own, over the unix socket of a server on this host
+    inline std::shared_ptr<grpc::Channel> newDedicatedChannel(const std::string &addr) {
+        grpc::ChannelArguments args;
+        // Without a local subchannel pool, channels with equal arguments share one connection
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        return grpc::CreateCustomChannel(localEndpoint(addr), grpc::InsecureChannelCredentials(), args);
+    }
+
+    // Fixed number of channels per endpoint shared by all clients of a process, so the number of
+    // connections does not grow with the number of client threads. Acquire() hands out the
+    // channel with the fewest clients, which spreads the clients round-robin as they connect.
+    class ChannelPool {
+    public:
+        explicit ChannelPool(size_t channels_per_endpoint, int connect_timeout_sec = 10) :
+                channels_per_endpoint_(channels_per_endpoint), connect_timeout_sec_(connect_timeout_sec) {
+            CHECK_GT(channels_per_endpoint, 0);
+        }
+
+        // The first call for an endpoint opens its channels and waits until all are connected.
+        // Sets created if that happened in this call
+        std::shared_ptr<grpc::Channel> Acquire(const std::string &endpoint, bool *created = nullptr) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &channels = channels_[endpoint];
+            bool fresh = channels.empty();
+
+            if (fresh) {
+                auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(connect_timeout_sec_);
+
+                for (size_t i = 0; i < channels_per_endpoint_; i++) {
+                    channels.push_back(newDedicatedChannel(endpoint));
+                }
+                for (auto &channel: channels) {
+                    if (!channel->WaitForConnected(deadline)) {
+                        LOG(WARNING) << "Channel to " << endpoint << " is not connected after "
+                                     << connect_timeout_sec_ << " s";
+                        break;
+                    }
+                }
+                LOG(INFO) << "Opened " << channels.size() << " channels to " << endpoint;
+            }
+            if (created != nullptr) {
+                *created = fresh;
+            }
+            // The pool holds one reference, every client holds the rest
+            auto *least = &channels.front();
+            for (auto &channel: channels) {
+                if (channel.use_count() < least->use_count()) {
+                    least = &channel;
+                }
+            }
+            return *least;
+        }
+
+        size_t channels_per_endpoint() const {
+            return channels_per_endpoint_;
+        }
+
+    private:
+        size_t channels_per_endpoint_;
+        int connect_timeout_sec_;
+        std::mutex mutex_;
+        std::unordered_map<std::string, std::vector<std::shared_ptr<grpc::Channel>>> channels_;
+    };
+}
+
+#endif //GRPC_KVSTORE_CHANNEL_POOL_H
@@ -7,6 +7,10 @@
 #include <ctime>
 
 namespace kvstore {
+    // Clients send this metadata to have a request traced, the breakdown comes back in the
+    // trailing metadata of the same key
+    const char *const TRACE_METADATA_KEY = "x-kvstore-trace";
+
     int random(size_t min, size_t max) { //range : [min, max]
         static bool first = true;
         if (first) {
@@ -0,0 +1,268 @@
+#ifndef GRPC_KVSTORE_CPU_TOPOLOGY_H
+#define GRPC_KVSTORE_CPU_TOPOLOGY_H
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace kvstore {
+    // Parses a kernel style cpu list such as "0-3,8,10-11"
+    inline std::vector<int> parseCpuList(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+
+        while (std::getline(ss, range, ',')) {
+            range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+            if (range.empty()) {
+                continue;
+            }
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+            CHECK_LE(first, last) << "Bad cpu range " << range;
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    inline std::string formatCpuList(const std::vector<int> &cpus) {
+        std::string list;
+
+        for (size_t i = 0; i < cpus.size(); i++) {
+            size_t j = i;
+            while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+                j++;
+            }
+            list += (list.empty() ? "" : ",") + std::to_string(cpus[i]);
+            if (j > i) {
+                list += "-" + std::to_string(cpus[j]);
+            }
+            i = j;
+        }
+        return list;
+    }
+
+    // Online cpus with their physical core and NUMA node, read from sysfs. Machines without
+    // the topology files are treated as one node with one core per cpu.
+    class CpuTopology {
+    public:
+        struct Cpu {
+            int id;
+            int package;
+            int core;
+            int node;
+        };
+
+        CpuTopology() {
+            auto online = parseCpuList(readFirstLine("/sys/devices/system/cpu/online"));
+
+            if (online.empty()) {
+                long n = 1;
+#ifdef __linux__
+                n = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+#endif
+                for (int cpu = 0; cpu < n; cpu++) {
+                    online.push_back(cpu);
+                }
+            }
+            for (int cpu: online) {
+                auto dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                auto package = readFirstLine(dir + "physical_package_id");
+                auto core = readFirstLine(dir + "core_id");
+
+                cpus_.push_back({cpu, package.empty() ? 0 : std::stoi(package),
+                                 core.empty() ? cpu : std::stoi(core), 0});
+            }
+            for (int node: parseCpuList(readFirstLine("/sys/devices/system/node/online"))) {
+                auto list = readFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+                for (int cpu: parseCpuList(list)) {
+                    for (auto &c: cpus_) {
+                        if (c.id == cpu) {
+                            c.node = node;
+                        }
+                    }
+                }
+            }
+        }
+
+        const std::vector<Cpu> &cpus() const {
+            return cpus_;
+        }
+
+        const Cpu *Find(int cpu) const {
+            for (auto &c: cpus_) {
+                if (c.id == cpu) {
+                    return &c;
+                }
+            }
+            return nullptr;
+        }
+
+        // First cpu of every physical core, ordered by node so the leading entries share a node
+        std::vector<int> OnePerCore() const {
+            std::set<std::pair<int, int>> seen; // (package, core)
+            auto sorted = cpus_;
+            std::vector<int> cpus;
+
+            std::stable_sort(sorted.begin(), sorted.end(), [](const Cpu &a, const Cpu &b) {
+                return a.node < b.node;
+            });
+            for (auto &c: sorted) {
+                if (seen.emplace(c.package, c.core).second) {
+                    cpus.push_back(c.id);
+                }
+            }
+            return cpus;
+        }
+
+        size_t num_cores() const {
+            return OnePerCore().size();
+        }
+
+        size_t num_nodes() const {
+            std::set<int> nodes;
+
+            for (auto &c: cpus_) {
+                nodes.insert(c.node);
+            }
+            return nodes.size();
+        }
+
+    private:
+        std::vector<Cpu> cpus_;
+
+        static std::string readFirstLine(const std::string &path) {
+            std::ifstream in(path);
+            std::string line;
+
+            std::getline(in, line);
+            return line;
+        }
+    };
+
+    // Where a group of threads runs: thread i is pinned to cpus[i % cpus.size()] and, with
+    // bind_memory, allocates only from the NUMA node of that cpu. An empty placement leaves
+    // the threads to the scheduler.
+    class ThreadPlacement {
+    public:
+        ThreadPlacement() = default;
+
+        ThreadPlacement(const CpuTopology &topology, std::vector<int> cpus, bool bind_memory) :
+                cpus_(std::move(cpus)), bind_memory_(bind_memory) {
+            for (int cpu: cpus_) {
+                auto *c = topology.Find(cpu);
+
+                CHECK(c != nullptr) << "Cpu " << cpu << " is not online";
+                nodes_.push_back(c->node);
+            }
+        }
+
+        // spec is empty, "cores" for one thread per physical core or an explicit cpu list
+        static ThreadPlacement Parse(const CpuTopology &topology, const std::string &spec, bool bind_memory) {
+            if (spec.empty()) {
+                return ThreadPlacement();
+            }
+            return ThreadPlacement(topology, spec == "cores" ? topology.OnePerCore() : parseCpuList(spec),
+                                   bind_memory);
+        }
+
+        bool empty() const {
+            return cpus_.empty();
+        }
+
+        size_t size() const {
+            return cpus_.size();
+        }
+
+        // Placement of the threads that follow the first skip threads of this one
+        ThreadPlacement Skip(size_t skip) const {
+            ThreadPlacement placement(*this);
+
+            if (!empty()) {
+                std::rotate(placement.cpus_.begin(), placement.cpus_.begin() + skip % size(), placement.cpus_.end());
+                std::rotate(placement.nodes_.begin(), placement.nodes_.begin() + skip % size(),
+                            placement.nodes_.end());
+            }
+            return placement;
+        }
+
+        // Pins the calling thread as the i-th thread of the group
+        void Apply(size_t i) const {
+            if (empty()) {
+                return;
+            }
+            int cpu = cpus_[i % size()];
+            int node = nodes_[i % size()];
+#ifdef __linux__
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (err != 0) {
+                LOG(WARNING) << "Failed to pin thread to cpu " << cpu << ", error " << err;
+            }
+            if (bind_memory_) {
+                unsigned long mask[4] = {};
+
+                CHECK_LT(node, (int) (sizeof(mask) * 8));
+                mask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+                if (syscall(SYS_set_mempolicy, MPOL_BIND, mask, sizeof(mask) * 8) != 0) {
+                    PLOG(WARNING) << "Failed to bind memory of thread to node " << node;
+                }
+            }
+#else
+            LOG_FIRST_N(WARNING, 1) << "Thread pinning is only supported on Linux";
+#endif
+        }
+
+        // "cpus 0-3 (node 0)" style description of the first n threads
+        std::string Describe(size_t n) const {
+            if (empty()) {
+                return "unpinned";
+            }
+            std::vector<int> cpus;
+            std::set<int> nodes;
+
+            for (size_t i = 0; i < std::min(n, size()); i++) {
+                cpus.push_back(cpus_[i]);
+                nodes.insert(nodes_[i]);
+            }
+            std::sort(cpus.begin(), cpus.end());
+            std::string desc = "cpus " + formatCpuList(cpus) + " (node";
+            for (int node: nodes) {
+                desc += " " + std::to_string(node);
+            }
+            desc += bind_memory_ ? ", memory bound)" : ")";
+            if (n > size()) {
+                desc += ", " + std::to_string(n) + " threads share " + std::to_string(size()) + " cpus";
+            }
+            return desc;
+        }
+
+    private:
+        std::vector<int> cpus_;
+        std::vector<int> nodes_;
+        bool bind_memory_{};
+    };
+}
+
+#endif //GRPC_KVSTORE_CPU_TOPOLOGY_H
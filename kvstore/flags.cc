@@ -6,7 +6,7 @@ DEFINE_string(addr, "0.0.0.0", "");
 DEFINE_int32(port, 12345, "");
 DEFINE_bool(server, false, "is server or client");
 DEFINE_bool(async, false, "Async server");
-DEFINE_int32(thread, 4, "Thread number for serving");
+DEFINE_int32(thread, 4, "Thread number for serving, 0 means one per physical core of --cpus or the machine");
 DEFINE_int32(repeat, 1, "repeat times");
 DEFINE_uint32(key_size, 128, "key size in bytes");
 DEFINE_uint32(val_size, 4096, "value size");
@@ -16,4 +16,49 @@ DEFINE_string(cmd, "put", "get/get_batch/put");
 DEFINE_int32(big_kv_in_kb, 4, "kv size in kb");
 DEFINE_bool(big_k, true, "");
 DEFINE_bool(big_v, false, "");
-DEFINE_bool(warmup, true, "");
\ No newline at end of file
+DEFINE_bool(warmup, true, "");
+DEFINE_uint32(multi_size, 100, "Keys per MultiGet/MultiPut/MultiDelete RPC");
+DEFINE_uint32(pipeline_depth, 1, "Max in-flight requests per client for get/put, >1 uses the async client");
+DEFINE_string(bench_op, "get", "Operation of the closed-loop benchmark (cmd=bench): get/put/scan/delete");
+DEFINE_int32(client_threads, 1, "Client threads of the closed-loop benchmark");
+DEFINE_bool(shared_channel, false, "Share one channel among all client threads");
+DEFINE_double(duration, 0, "Run the closed-loop benchmark for given seconds, 0 means run batch_size ops");
+DEFINE_int32(report_interval_ms, 1000, "Interval of throughput reports");
+DEFINE_string(bench_output, "", "Write throughput over time to the given .csv or .json file");
+DEFINE_uint32(scan_length, 100, "Max kvs returned by each scan of the closed-loop benchmark");
+DEFINE_string(workload, "a", "YCSB core workload a-f used by cmd=workload");
+DEFINE_string(workload_file, "", "YCSB workload properties file, overrides the core workload");
+DEFINE_string(workload_props, "", "Comma separated YCSB properties, e.g. recordcount=100000,readproportion=0.9");
+DEFINE_string(phase, "run", "Workload phase: load/run");
+DEFINE_bool(group_commit, false, "Coalesce concurrent Put/Delete requests into one WriteBatch");
+DEFINE_int32(group_commit_window_us, 100, "Max time a write waits for others to join its group");
+DEFINE_uint32(group_commit_max_batch, 256, "Max writes per group commit");
+DEFINE_int32(cq_threads, 0, "Completion queue threads of the async server, 0 means --thread");
+DEFINE_int32(io_threads, 0, "Storage worker threads of the async server, 0 runs RocksDB calls on the CQ threads");
+DEFINE_uint32(scan_block_bytes, 0, "Bytes per streamed scan block requested by the client, 0 means the server default");
+DEFINE_string(scan_end, "", "Exclusive end key of --cmd=scan, empty scans to the last key");
+DEFINE_bool(scan_reverse, false, "Scan from the last key backwards");
+DEFINE_bool(scan_keys_only, false, "Scan keys without their values");
+DEFINE_uint32(read_cache_mb, 0, "Capacity of the server side read cache in MB, 0 disables it");
+DEFINE_uint32(read_cache_shards, 16, "Shards of the read cache, each with its own lock");
+DEFINE_int32(shards, 1, "RocksDB instances of the server, keys are hash partitioned over db_file/shard-<i>");
+DEFINE_string(endpoints, "", "Comma separated host:port list, clients shard keys over these servers instead of addr:port");
+DEFINE_bool(callback, false, "Callback API server, ignored if async is set");
+DEFINE_string(cpus, "", "Cpus of the async serving threads: a list like 0-7,16-23 or 'cores' for one per physical core, empty leaves them unpinned");
+DEFINE_string(io_cpus, "", "Cpus of the async storage threads in the format of --cpus, empty continues after the serving threads");
+DEFINE_bool(numa_bind, false, "Pinned threads allocate memory only from the NUMA node of their cpu");
+DEFINE_bool(raw, false, "Serve (async server) or send Get/Put/Delete as raw frames instead of protobuf messages");
+DEFINE_uint32(bulk_load_chunk_mb, 64, "Kvs buffered per shard before the server writes them to an SST file during a bulk load");
+DEFINE_string(replica_of, "", "host:port of the primary, the server becomes a read-only replica that tails its WAL");
+DEFINE_string(replicas, "", "Comma separated host:port list of replicas, clients send reads to them and writes to the primary");
+DEFINE_uint64(wal_ttl_sec, 0, "Keep WAL files this long for replicas that fall behind, 0 deletes them once flushed");
+DEFINE_bool(rocksdb_statistics, false, "Collect RocksDB tickers for the Stats RPC, costs a few percent of throughput");
+DEFINE_string(stats_file, "", "Server rewrites this file with its stats in Prometheus text format, empty disables it");
+DEFINE_int32(stats_interval_sec, 10, "Seconds between rewrites of --stats_file");
+DEFINE_bool(stats_prometheus, false, "cmd=stats prints the stats in Prometheus text format");
+DEFINE_bool(trace, false, "Async server traces the stages of the requests that ask for it and of sampled ones");
+DEFINE_uint32(trace_sample, 0, "With --trace, trace one in this many requests of every serving thread, 0 for none");
+DEFINE_string(trace_file, "", "With --trace, write the traces to this file in Chrome trace event JSON");
+DEFINE_string(engine, "rocksdb", "Storage engine of the server: rocksdb, or memory for a volatile cache tier");
+DEFINE_bool(unix_socket, true, "Server also listens on /tmp/kvstore-<port>.sock, clients on the same host connect there");
+DEFINE_int32(snapshot_ttl_sec, 600, "Scan snapshots no scan used for this long are released, 0 keeps them until released");
\ No newline at end of file
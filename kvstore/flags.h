@@ -19,4 +19,49 @@ DECLARE_int32(big_kv_in_kb);
 DECLARE_bool(big_k);
 DECLARE_bool(big_v);
 DECLARE_bool(warmup);
+DECLARE_uint32(multi_size);
+DECLARE_uint32(pipeline_depth);
+DECLARE_string(bench_op);
+DECLARE_int32(client_threads);
+DECLARE_bool(shared_channel);
+DECLARE_double(duration);
+DECLARE_int32(report_interval_ms);
+DECLARE_string(bench_output);
+DECLARE_uint32(scan_length);
+DECLARE_string(workload);
+DECLARE_string(workload_file);
+DECLARE_string(workload_props);
+DECLARE_string(phase);
+DECLARE_bool(group_commit);
+DECLARE_int32(group_commit_window_us);
+DECLARE_uint32(group_commit_max_batch);
+DECLARE_int32(cq_threads);
+DECLARE_int32(io_threads);
+DECLARE_uint32(scan_block_bytes);
+DECLARE_string(scan_end);
+DECLARE_bool(scan_reverse);
+DECLARE_bool(scan_keys_only);
+DECLARE_uint32(read_cache_mb);
+DECLARE_uint32(read_cache_shards);
+DECLARE_int32(shards);
+DECLARE_string(endpoints);
+DECLARE_bool(callback);
+DECLARE_string(cpus);
+DECLARE_string(io_cpus);
+DECLARE_bool(numa_bind);
+DECLARE_bool(raw);
+DECLARE_uint32(bulk_load_chunk_mb);
+DECLARE_string(replica_of);
+DECLARE_string(replicas);
+DECLARE_uint64(wal_ttl_sec);
+DECLARE_bool(rocksdb_statistics);
+DECLARE_string(stats_file);
+DECLARE_int32(stats_interval_sec);
+DECLARE_bool(stats_prometheus);
+DECLARE_bool(trace);
+DECLARE_uint32(trace_sample);
+DECLARE_string(trace_file);
+DECLARE_string(engine);
+DECLARE_bool(unix_socket);
+DECLARE_int32(snapshot_ttl_sec);
 #endif //GRPC_KVSTORE_FLAGS_H
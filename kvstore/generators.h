@@ -0,0 +1,207 @@
+#ifndef GRPC_KVSTORE_GENERATORS_H
+#define GRPC_KVSTORE_GENERATORS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "glog/logging.h"
+
+// Key number generators of YCSB's core workloads. Every generator is owned by one client thread
+// and draws randomness from the thread's engine, only the insert counters are shared.
+namespace kvstore {
+    using Rng = std::mt19937_64;
+
+    inline uint64_t fnvhash64(uint64_t val) {
+        const uint64_t FNV_OFFSET_BASIS_64 = 0xCBF29CE484222325ull;
+        const uint64_t FNV_PRIME_64 = 1099511628211ull;
+        uint64_t hashval = FNV_OFFSET_BASIS_64;
+
+        for (int i = 0; i < 8; i++) {
+            uint64_t octet = val & 0x00ff;
+            val = val >> 8;
+
+            hashval = hashval ^ octet;
+            hashval = hashval * FNV_PRIME_64;
+        }
+        return hashval;
+    }
+
+    inline double next_double(Rng &rng) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    }
+
+    class Generator {
+    public:
+        virtual ~Generator() = default;
+
+        virtual uint64_t Next(Rng &rng) = 0;
+    };
+
+    // Hands out insert key numbers. Last() only covers numbers whose insert and the inserts of
+    // all lower numbers were acknowledged, so readers never pick a key that is still in flight.
+    // Like YCSB's AcknowledgedCounterGenerator, acknowledged numbers are flagged in a ring of
+    // WINDOW_SIZE slots and the limit moves over the flagged prefix
+    class AcknowledgedCounter {
+    public:
+        static constexpr uint64_t WINDOW_SIZE = 1 << 20;
+
+        explicit AcknowledgedCounter(uint64_t start) : next_(start), acked_until_(start), window_(WINDOW_SIZE) {}
+
+        uint64_t Next() {
+            return next_.fetch_add(1);
+        }
+
+        void Acknowledge(uint64_t value) {
+            CHECK_LT(value - acked_until_.load(), WINDOW_SIZE) << "Too many unacknowledged inserts";
+            CHECK(!window_[value % WINDOW_SIZE].exchange(true)) << "Insert " << value << " acknowledged twice";
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t until = acked_until_.load();
+
+            while (window_[until % WINDOW_SIZE].exchange(false)) {
+                until++;
+            }
+            acked_until_.store(until);
+        }
+
+        uint64_t Last() const {
+            uint64_t until = acked_until_.load();
+
+            return until == 0 ? 0 : until - 1;
+        }
+
+    private:
+        std::atomic_uint64_t next_;
+        // First number not acknowledged yet
+        std::atomic_uint64_t acked_until_;
+        std::vector<std::atomic_bool> window_;
+        std::mutex mutex_;
+    };
+
+    class UniformGenerator : public Generator {
+    public:
+        UniformGenerator(uint64_t lb, uint64_t ub) : dist_(lb, ub) {}
+
+        uint64_t Next(Rng &rng) override {
+            return dist_(rng);
+        }
+
+    private:
+        std::uniform_int_distribution<uint64_t> dist_;
+    };
+
+    // Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as in YCSB. Item 0 is
+    // the most popular one. The item count may grow between calls, zeta is then extended incrementally
+    class ZipfianGenerator : public Generator {
+    public:
+        static constexpr double ZIPFIAN_CONSTANT = 0.99;
+
+        ZipfianGenerator(uint64_t min, uint64_t max, double theta = ZIPFIAN_CONSTANT) :
+                ZipfianGenerator(min, max, theta, zeta(0, max - min + 1, theta, 0)) {}
+
+        ZipfianGenerator(uint64_t min, uint64_t max, double theta, double zetan) :
+                base_(min), items_(max - min + 1), theta_(theta), zetan_(zetan), count_for_zeta_(items_) {
+            CHECK_GT(items_, 1);
+            zeta2theta_ = zeta(0, 2, theta_, 0);
+            alpha_ = 1.0 / (1.0 - theta_);
+            eta_ = (1 - std::pow(2.0 / items_, 1 - theta_)) / (1 - zeta2theta_ / zetan_);
+        }
+
+        uint64_t Next(Rng &rng) override {
+            return Next(rng, items_);
+        }
+
+        uint64_t Next(Rng &rng, uint64_t item_count) {
+            if (item_count != count_for_zeta_) {
+                if (item_count > count_for_zeta_) {
+                    zetan_ = zeta(count_for_zeta_, item_count, theta_, zetan_);
+                } else {
+                    zetan_ = zeta(0, item_count, theta_, 0);
+                }
+                count_for_zeta_ = item_count;
+                eta_ = (1 - std::pow(2.0 / item_count, 1 - theta_)) / (1 - zeta2theta_ / zetan_);
+            }
+
+            double u = next_double(rng);
+            double uz = u * zetan_;
+
+            if (uz < 1.0) {
+                return base_;
+            }
+            if (uz < 1.0 + std::pow(0.5, theta_)) {
+                return base_ + 1;
+            }
+            auto ret = (uint64_t) (item_count * std::pow(eta_ * u - eta_ + 1, alpha_));
+            return base_ + std::min(ret, item_count - 1);
+        }
+
+        static double zeta(uint64_t st, uint64_t n, double theta, double initialsum) {
+            double sum = initialsum;
+
+            for (uint64_t i = st; i < n; i++) {
+                sum += 1 / std::pow(i + 1, theta);
+            }
+            return sum;
+        }
+
+    private:
+        uint64_t base_;
+        uint64_t items_;
+        double theta_;
+        double zetan_;
+        uint64_t count_for_zeta_;
+        double zeta2theta_;
+        double alpha_;
+        double eta_{};
+    };
+
+    // Zipfian popularity with the popular items spread over the key space by hashing
+    class ScrambledZipfianGenerator : public Generator {
+    public:
+        ScrambledZipfianGenerator(uint64_t min, uint64_t max) :
+                min_(min), item_count_(max - min + 1),
+                gen_(0, ITEM_COUNT - 1, ZipfianGenerator::ZIPFIAN_CONSTANT, ZETAN) {}
+
+        uint64_t Next(Rng &rng) override {
+            return min_ + fnvhash64(gen_.Next(rng)) % item_count_;
+        }
+
+    private:
+        // Precomputed zeta of YCSB's fixed 10 billion item space with theta = 0.99
+        static constexpr double ZETAN = 26.46902820178302;
+        static constexpr uint64_t ITEM_COUNT = 10000000000ull;
+        uint64_t min_;
+        uint64_t item_count_;
+        ZipfianGenerator gen_;
+    };
+
+    // Zipfian over the inserted keys, with the most recently inserted key being the most popular
+    class SkewedLatestGenerator : public Generator {
+    public:
+        explicit SkewedLatestGenerator(const AcknowledgedCounter &counter) :
+                counter_(counter), zipfian_(0, std::max<uint64_t>(counter.Last(), 1)) {}
+
+        // With the zeta of the first items items computed beforehand
+        SkewedLatestGenerator(const AcknowledgedCounter &counter, uint64_t items, double zetan) :
+                counter_(counter), zipfian_(0, items - 1, ZipfianGenerator::ZIPFIAN_CONSTANT, zetan) {}
+
+        uint64_t Next(Rng &rng) override {
+            uint64_t max = counter_.Last();
+
+            if (max == 0) {
+                return 0;
+            }
+            return max - zipfian_.Next(rng, max + 1);
+        }
+
+    private:
+        const AcknowledgedCounter &counter_;
+        ZipfianGenerator zipfian_;
+    };
+}
+
+#endif //GRPC_KVSTORE_GENERATORS_H
@@ -0,0 +1,135 @@
+#ifndef GRPC_KVSTORE_GROUP_COMMIT_H
+#define GRPC_KVSTORE_GROUP_COMMIT_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "glog/logging.h"
+#include "rocksdb/db.h"
+#include "rocksdb/write_batch.h"
+#include "kvstore.pb.h"
+#include "storage_engine.h"
+
+namespace kvstore {
+    inline Durability effectiveDurability(Durability durability) {
+        return durability == Durability::DURABILITY_DEFAULT ? Durability::DURABILITY_WAL : durability;
+    }
+
+    inline rocksdb::WriteOptions writeOptions(Durability durability) {
+        rocksdb::WriteOptions options;
+
+        durability = effectiveDurability(durability);
+        options.disableWAL = durability == Durability::DURABILITY_NO_WAL;
+        options.sync = durability == Durability::DURABILITY_SYNC;
+        return options;
+    }
+
+    // Coalesces single-key mutations arriving from all serving threads into one WriteBatch.
+    // A batch is committed once window_us has passed since its first mutation or it holds
+    // max_batch_size mutations. It is written with the strongest durability any of its
+    // requests asked for, so no request gets less than requested and the arrival order is
+    // preserved. Callbacks run on the commit thread after the batch is durable.
+    class GroupCommitter {
+    public:
+        using Callback = std::function<void(const rocksdb::Status &)>;
+
+        GroupCommitter(StorageEngine *engine, int window_us, size_t max_batch_size) :
+                engine_(engine),
+                window_(window_us),
+                max_batch_size_(max_batch_size) {
+            CHECK_GT(max_batch_size_, 0);
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~GroupCommitter() {
+            Stop();
+        }
+
+        void Put(const std::string &key, const std::string &value, Durability durability, Callback callback) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            pending_.batch.Put(key, value);
+            add(durability, std::move(callback));
+        }
+
+        void Delete(const std::string &key, Durability durability, Callback callback) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            pending_.batch.Delete(key);
+            add(durability, std::move(callback));
+        }
+
+        // Commits the mutations still pending and stops the commit thread
+        void Stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopped_) {
+                    return;
+                }
+                stopped_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+            LOG(INFO) << "Group commit: " << num_writes_ << " writes in " << num_batches_ << " batches, avg batch size: "
+                      << (num_batches_ == 0 ? 0 : (double) num_writes_ / num_batches_);
+        }
+
+    private:
+        struct Group {
+            rocksdb::WriteBatch batch;
+            std::vector<Callback> callbacks;
+            Durability durability = Durability::DURABILITY_NO_WAL;
+        };
+
+        StorageEngine *engine_;
+        std::chrono::microseconds window_;
+        size_t max_batch_size_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        Group pending_;
+        bool stopped_{};
+        size_t num_batches_{};
+        size_t num_writes_{};
+        std::thread thread_;
+
+        void add(Durability durability, Callback callback) {
+            pending_.callbacks.push_back(std::move(callback));
+            pending_.durability = std::max(pending_.durability, effectiveDurability(durability));
+            if (pending_.callbacks.size() == 1 || pending_.callbacks.size() >= max_batch_size_) {
+                cv_.notify_one();
+            }
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            while (true) {
+                cv_.wait(lock, [this]() { return stopped_ || !pending_.callbacks.empty(); });
+                if (pending_.callbacks.empty()) {
+                    break;
+                }
+                cv_.wait_for(lock, window_, [this]() {
+                    return stopped_ || pending_.callbacks.size() >= max_batch_size_;
+                });
+
+                Group group;
+                std::swap(group, pending_);
+                lock.unlock();
+
+                auto status = engine_->Write(writeOptions(group.durability), &group.batch);
+                for (auto &callback: group.callbacks) {
+                    callback(status);
+                }
+
+                lock.lock();
+                num_batches_++;
+                num_writes_ += group.callbacks.size();
+            }
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_GROUP_COMMIT_H
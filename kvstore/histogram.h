@@ -0,0 +1,132 @@
+#ifndef GRPC_KVSTORE_HISTOGRAM_H
+#define GRPC_KVSTORE_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace kvstore {
+    // HDR-style log-linear histogram. Values below 2^SUB_BUCKET_BITS are counted exactly, larger
+    // values fall into one of 2^(SUB_BUCKET_BITS-1) linear sub-buckets per power of two, which
+    // bounds the relative error by 1/2^(SUB_BUCKET_BITS-1), i.e. 1/64 or about 1.6%. Not
+    // thread-safe: record from one thread and Merge() the per-thread histograms for reporting.
+    class Histogram {
+    public:
+        static constexpr int SUB_BUCKET_BITS = 7;
+        static constexpr uint64_t SUB_BUCKET_COUNT = 1ul << SUB_BUCKET_BITS;
+        static constexpr uint64_t SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+        static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF;
+
+        Histogram() : counts_(BUCKET_COUNT, 0) {}
+
+        void Record(uint64_t value) {
+            counts_[index_of(value)]++;
+            total_++;
+            sum_ += value;
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+        }
+
+        void Merge(const Histogram &other) {
+            for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                counts_[i] += other.counts_[i];
+            }
+            total_ += other.total_;
+            sum_ += other.sum_;
+            min_ = std::min(min_, other.min_);
+            max_ = std::max(max_, other.max_);
+        }
+
+        // Adds values counted elsewhere into the buckets of BucketOf(), e.g. by an AtomicHistogram
+        void MergeCounts(const std::vector<uint64_t> &counts, uint64_t sum, uint64_t min, uint64_t max) {
+            for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                counts_[i] += counts[i];
+                total_ += counts[i];
+            }
+            sum_ += sum;
+            min_ = std::min(min_, min);
+            max_ = std::max(max_, max);
+        }
+
+        static size_t BucketOf(uint64_t value) {
+            return index_of(value);
+        }
+
+        void Reset() {
+            std::fill(counts_.begin(), counts_.end(), 0);
+            total_ = 0;
+            sum_ = 0;
+            min_ = std::numeric_limits<uint64_t>::max();
+            max_ = 0;
+        }
+
+        // Highest value equivalent to the bucket holding the given percentile, in [0, 100]
+        uint64_t Percentile(double percentile) const {
+            if (total_ == 0) {
+                return 0;
+            }
+            auto target = (uint64_t) std::ceil(percentile / 100.0 * total_);
+            uint64_t seen = 0;
+
+            target = std::max<uint64_t>(target, 1);
+            for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                seen += counts_[i];
+                if (seen >= target) {
+                    return std::min(highest_equivalent(i), max_);
+                }
+            }
+            return max_;
+        }
+
+        uint64_t count() const { return total_; }
+
+        uint64_t min() const { return total_ == 0 ? 0 : min_; }
+
+        uint64_t max() const { return max_; }
+
+        double mean() const { return total_ == 0 ? 0 : (double) sum_ / total_; }
+
+        // One-line summary, values are divided by scale (e.g. 1000 to print ns as us)
+        std::string ToString(double scale = 1.0) const {
+            std::stringstream ss;
+
+            ss << "count: " << count() << " avg: " << mean() / scale << " min: " << min() / scale
+               << " p50: " << Percentile(50) / scale << " p99: " << Percentile(99) / scale
+               << " p99.9: " << Percentile(99.9) / scale << " max: " << max() / scale;
+            return ss.str();
+        }
+
+    private:
+        std::vector<uint64_t> counts_;
+        uint64_t total_{};
+        uint64_t sum_{};
+        uint64_t min_{std::numeric_limits<uint64_t>::max()};
+        uint64_t max_{};
+
+        static size_t index_of(uint64_t value) {
+            if (value < SUB_BUCKET_COUNT) {
+                return value;
+            }
+            int msb = 63 - __builtin_clzll(value);
+            int shift = msb - (SUB_BUCKET_BITS - 1);
+
+            return shift * SUB_BUCKET_HALF + (value >> shift);
+        }
+
+        static uint64_t highest_equivalent(size_t index) {
+            if (index < SUB_BUCKET_COUNT) {
+                return index;
+            }
+            int shift = (int) (index / SUB_BUCKET_HALF) - 1;
+            uint64_t top = index % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+
+            return (top << shift) + ((1ul << shift) - 1);
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_HISTOGRAM_H
@@ -6,18 +6,116 @@
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 #include "kvstore.grpc.pb.h"
+#include "local_endpoint.h"
+#include "common.h"
 
 
 namespace kvstore {
+    struct ScanOptions {
+        // Exclusive end key, empty for no end
+        std::string end;
+        bool reverse = false;
+        // Skip reading and sending the values
+        bool keys_only = false;
+        // Take a snapshot for this scan and keep it for later pages
+        bool take_snapshot = false;
+        // Snapshot of an earlier scan to read from, 0 for the latest state
+        uint64_t snapshot_id = 0;
+        uint32_t max_block_bytes = 0;
+    };
+
+    // Bytes of kvs sent per BulkLoadReq
+    const size_t BULK_LOAD_BLOCK_BYTES = 1024 * 1024;
+
+    // Client side of one BulkLoad stream. Kvs are sent in blocks of about BULK_LOAD_BLOCK_BYTES,
+    // the server makes them visible when Finish() closes the stream
+    class BulkLoadWriter {
+    public:
+        explicit BulkLoadWriter(KVStore::Stub *stub) {
+            cli_ctx_.set_wait_for_ready(true);
+            writer_ = stub->BulkLoad(&cli_ctx_, &resp_);
+        }
+
+        void Add(const std::string &key, const std::string &value) {
+            auto *kv = req_.add_kvs();
+
+            *kv->mutable_key() = key;
+            *kv->mutable_value() = value;
+            block_bytes_ += key.size() + value.size();
+            if (block_bytes_ >= BULK_LOAD_BLOCK_BYTES) {
+                flush();
+            }
+        }
+
+        Status Finish(uint64_t *loaded = nullptr) {
+            flush();
+            writer_->WritesDone();
+            auto grpc_status = writer_->Finish();
+
+            if (!grpc_status.ok()) {
+                resp_.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp_.mutable_status()->set_error_msg(grpc_status.error_message());
+            }
+            if (loaded != nullptr) {
+                *loaded = resp_.loaded();
+            }
+            return resp_.status();
+        }
+
+    private:
+        grpc::ClientContext cli_ctx_;
+        BulkLoadReq req_;
+        BulkLoadResp resp_;
+        size_t block_bytes_{};
+        std::unique_ptr<grpc::ClientWriter<BulkLoadReq>> writer_;
+
+        // A failed write means the stream is broken, Finish() reports why
+        void flush() {
+            if (req_.kvs_size() > 0) {
+                writer_->Write(req_);
+                req_.Clear();
+                block_bytes_ = 0;
+            }
+        }
+    };
+
+    // Channel to addr, a server on this host is reached over its unix socket, see localEndpoint()
+    inline std::shared_ptr<grpc::Channel> createLocalChannel(const std::string &addr, const std::string &client) {
+        auto target = localEndpoint(addr);
+
+        LOG(INFO) << client << " is trying to connect to " << target;
+        return grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+    }
+
     class KVClient {
     public:
-        explicit KVClient(const std::string &addr) : stub_(
-                KVStore::NewStub(grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()))) {
-            LOG(INFO) << "Client is trying to connect to " << addr;
+        explicit KVClient(const std::string &addr) : KVClient(createLocalChannel(addr, "Client")) {}
+
+        explicit KVClient(std::shared_ptr<grpc::Channel> channel) :
+                channel_(std::move(channel)),
+                stub_(KVStore::NewStub(channel_)) {
+        }
+
+        virtual ~KVClient() = default;
+
+        std::shared_ptr<grpc::Channel> channel() const {
+            return channel_;
         }
 
         Status Scan(const std::string &start, std::vector<KV> &kvs,
-                    size_t batch_size = std::numeric_limits<size_t>::max()) {
+                    size_t batch_size = std::numeric_limits<size_t>::max(),
+                    uint32_t max_block_bytes = 0) {
+            ScanOptions options;
+
+            options.max_block_bytes = max_block_bytes;
+            return Scan(start, kvs, batch_size, options);
+        }
+
+        // Scans [start, options.end), an empty start or end leaves that side of the range open.
+        // If options.take_snapshot is set the id of the new snapshot is stored in snapshot_id,
+        // it has to be given back with ReleaseSnapshot()
+        virtual Status Scan(const std::string &start, std::vector<KV> &kvs, size_t batch_size,
+                            const ScanOptions &options, uint64_t *snapshot_id = nullptr) {
             ScanReq req;
             grpc::ClientContext cli_ctx;
 
@@ -25,20 +123,60 @@ namespace kvstore {
             if (!start.empty()) {
                 req.set_start(start);
             }
+            if (!options.end.empty()) {
+                req.set_end(options.end);
+            }
             req.set_limit(batch_size);
+            if (options.max_block_bytes > 0) {
+                req.set_max_block_bytes(options.max_block_bytes);
+            }
+            req.set_reverse(options.reverse);
+            req.set_keys_only(options.keys_only);
+            req.set_take_snapshot(options.take_snapshot);
+            if (options.snapshot_id != 0) {
+                req.set_snapshot_id(options.snapshot_id);
+            }
             auto reader = stub_->Scan(&cli_ctx, req);
             ScanResp resp;
             Status status;
 
+            status.set_error_code(ErrorCode::OK);
             while (reader->Read(&resp)) {
-                kvs.push_back(resp.kv());
+                if (resp.has_status()) {
+                    status = resp.status();
+                    if (snapshot_id != nullptr) {
+                        *snapshot_id = resp.snapshot_id();
+                    }
+                }
+                for (auto &kv: *resp.mutable_kvs()) {
+                    kvs.push_back(std::move(kv));
+                }
+            }
+            auto grpc_status = reader->Finish();
+            if (!grpc_status.ok()) {
+                status.set_error_code(ErrorCode::CLIENT_ERROR);
+                status.set_error_msg(grpc_status.error_message());
             }
-
-            status.set_error_code(ErrorCode::OK);
             return status;
         }
 
-        Status Get(const std::string &key, std::string &value) {
+        virtual Status ReleaseSnapshot(uint64_t snapshot_id) {
+            ReleaseSnapshotReq req;
+            ReleaseSnapshotResp resp;
+            grpc::ClientContext cli_ctx;
+
+            req.set_snapshot_id(snapshot_id);
+            cli_ctx.set_wait_for_ready(true);
+            auto grpc_status = stub_->ReleaseSnapshot(&cli_ctx, req, &resp);
+
+            if (!grpc_status.ok()) {
+                resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp.mutable_status()->set_error_msg(grpc_status.error_message());
+            }
+            return resp.status();
+        }
+
+        virtual Status Get(const std::string &key, std::string &value) {
             GetReq req;
             GetResp resp;
             grpc::ClientContext cli_ctx;
@@ -60,7 +198,7 @@ namespace kvstore {
             return resp.status();
         }
 
-        void Warmup(const WarmupReq &req) {
+        virtual void Warmup(const WarmupReq &req) {
             WarmupResp resp;
             grpc::ClientContext cli_ctx;
 
@@ -69,7 +207,8 @@ namespace kvstore {
             CHECK(grpc_status.ok());
         }
 
-        Status Put(const std::string &key, const std::string &value) {
+        virtual Status Put(const std::string &key, const std::string &value,
+                           Durability durability = Durability::DURABILITY_DEFAULT) {
             PutReq req;
             PutResp resp;
             grpc::ClientContext cli_ctx;
@@ -78,6 +217,7 @@ namespace kvstore {
             CHECK(value.size() <= 4 * 1024 * 1024);
             *req.mutable_kv()->mutable_key() = key;
             *req.mutable_kv()->mutable_value() = value;
+            req.set_durability(durability);
 
             cli_ctx.set_wait_for_ready(true);
             auto grpc_status = stub_->Put(&cli_ctx, req, &resp);
@@ -88,13 +228,14 @@ namespace kvstore {
             return resp.status();
         }
 
-        Status Delete(const std::string &key) {
+        virtual Status Delete(const std::string &key, Durability durability = Durability::DURABILITY_DEFAULT) {
             DeleteReq req;
             DeleteResp resp;
             grpc::ClientContext cli_ctx;
 
             CHECK(key.size() <= 4 * 1024 * 1024);
             req.set_key(key);
+            req.set_durability(durability);
             auto grpc_status = stub_->Delete(&cli_ctx, req, &resp);
 
             if (!grpc_status.ok()) {
@@ -104,10 +245,136 @@ namespace kvstore {
             return resp.status();
         }
 
+        virtual Status MultiGet(const std::vector<std::string> &keys, std::vector<std::string> &values,
+                                std::vector<Status> *statuses = nullptr) {
+            MultiGetReq req;
+            MultiGetResp resp;
+            grpc::ClientContext cli_ctx;
+
+            req.mutable_keys()->Reserve(keys.size());
+            for (auto &key: keys) {
+                CHECK(key.size() <= 4 * 1024 * 1024);
+                req.add_keys(key);
+            }
+            cli_ctx.set_wait_for_ready(true);
+            auto grpc_status = stub_->MultiGet(&cli_ctx, req, &resp);
+
+            if (grpc_status.ok()) {
+                values.assign(resp.values().begin(), resp.values().end());
+                if (statuses != nullptr) {
+                    statuses->assign(resp.statuses().begin(), resp.statuses().end());
+                }
+            } else {
+                resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp.mutable_status()->set_error_msg(grpc_status.error_message());
+            }
+            return resp.status();
+        }
+
+        virtual Status MultiPut(const std::vector<std::pair<std::string, std::string>> &kvs,
+                                Durability durability = Durability::DURABILITY_DEFAULT) {
+            MultiPutReq req;
+            MultiPutResp resp;
+            grpc::ClientContext cli_ctx;
+
+            req.set_durability(durability);
+            req.mutable_kvs()->Reserve(kvs.size());
+            for (auto &kv: kvs) {
+                CHECK(kv.first.size() <= 4 * 1024 * 1024);
+                CHECK(kv.second.size() <= 4 * 1024 * 1024);
+                auto *req_kv = req.add_kvs();
+                *req_kv->mutable_key() = kv.first;
+                *req_kv->mutable_value() = kv.second;
+            }
+            cli_ctx.set_wait_for_ready(true);
+            auto grpc_status = stub_->MultiPut(&cli_ctx, req, &resp);
+
+            if (!grpc_status.ok()) {
+                resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp.mutable_status()->set_error_msg(grpc_status.error_message());
+            }
+            return resp.status();
+        }
+
+        virtual Status MultiDelete(const std::vector<std::string> &keys,
+                                   Durability durability = Durability::DURABILITY_DEFAULT) {
+            MultiDeleteReq req;
+            MultiDeleteResp resp;
+            grpc::ClientContext cli_ctx;
+
+            req.set_durability(durability);
+            req.mutable_keys()->Reserve(keys.size());
+            for (auto &key: keys) {
+                CHECK(key.size() <= 4 * 1024 * 1024);
+                req.add_keys(key);
+            }
+            cli_ctx.set_wait_for_ready(true);
+            auto grpc_status = stub_->MultiDelete(&cli_ctx, req, &resp);
+
+            if (!grpc_status.ok()) {
+                resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp.mutable_status()->set_error_msg(grpc_status.error_message());
+            }
+            return resp.status();
+        }
+
+        // Streams the kvs returned by next until it returns false. The server writes them to SST
+        // files and ingests those at the end, loaded kvs skip the WAL and the memtable. The
+        // number of kvs the server loaded is stored in loaded
+        virtual Status BulkLoad(const std::function<bool(KV *)> &next, uint64_t *loaded = nullptr) {
+            BulkLoadWriter writer(stub_.get());
+            KV kv;
+
+            while (next(&kv)) {
+                writer.Add(kv.key(), kv.value());
+            }
+            return writer.Finish(loaded);
+        }
+
+    protected:
+        // For clients that spread the requests over other KVClients
+        KVClient() = default;
+
     private:
+        std::shared_ptr<grpc::Channel> channel_;
         std::unique_ptr<KVStore::Stub> stub_;
     };
 
+    // Get that asks the server to trace it, the stages and RocksDB counters are stored in trace
+    inline Status GetTraced(const std::shared_ptr<grpc::Channel> &channel, const std::string &key,
+                            std::string &value, std::string *trace) {
+        GetReq req;
+        GetResp resp;
+        grpc::ClientContext cli_ctx;
+
+        req.set_key(key);
+        cli_ctx.set_wait_for_ready(true);
+        cli_ctx.AddMetadata(TRACE_METADATA_KEY, "1");
+        auto grpc_status = KVStore::NewStub(channel)->Get(&cli_ctx, req, &resp);
+
+        if (grpc_status.ok()) {
+            value = resp.value();
+        } else {
+            resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+            resp.mutable_status()->set_error_msg(grpc_status.error_message());
+        }
+        auto &trailers = cli_ctx.GetServerTrailingMetadata();
+        auto it = trailers.find(TRACE_METADATA_KEY);
+        trace->clear();
+        if (it != trailers.end()) {
+            trace->assign(it->second.data(), it->second.size());
+        }
+        return resp.status();
+    }
+
+    inline grpc::Status GetStats(const std::shared_ptr<grpc::Channel> &channel, bool prometheus, StatsResp *resp) {
+        StatsReq req;
+        grpc::ClientContext cli_ctx;
+
+        req.set_prometheus(prometheus);
+        cli_ctx.set_wait_for_ready(true);
+        return KVStore::NewStub(channel)->Stats(&cli_ctx, req, resp);
+    }
 
 }
 
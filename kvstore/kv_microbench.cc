@@ -0,0 +1,228 @@
+// Cost per op of each layer of a request, on one machine and without a network: the storage
+// engine (--engine) on its own, and the sync and async servers reached through an in-process
+// channel, which skips the sockets but keeps gRPC, protobuf and the server's threading. The tcp
+// and unix cases reach an async server on --port over the TCP loopback and over its unix socket.
+// Run it with --benchmark_filter to pick the cases, e.g. --benchmark_filter='Get/(direct|async)'.
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include "kv_server.h"
+#include "kv_client.h"
+#include "channel_pool.h"
+
+namespace {
+    enum class Target {
+        DIRECT, SYNC, ASYNC, TCP, UNIX
+    };
+
+    const size_t NUM_KEYS = 10000;
+    const size_t SCAN_LENGTH = 100;
+
+    struct Deployment {
+        std::string db_file;
+        std::unique_ptr<kvstore::KVServer> server;
+        std::thread serving;
+        std::shared_ptr<grpc::Channel> channel;
+        // Channels over sockets, only for the server on --port
+        std::shared_ptr<grpc::Channel> tcp_channel;
+        std::shared_ptr<grpc::Channel> unix_channel;
+        // Keys loaded for every value size
+        std::map<size_t, std::vector<std::string>> keys;
+    };
+
+    std::mutex deployments_mutex;
+    std::map<Target, Deployment> deployments;
+
+    // Direct calls go to the engine of the async server, so both read the same data. The tcp and
+    // unix cases share one async server listening on --port
+    Deployment &startDeployment(Target target) {
+        auto &d = deployments[target];
+
+        if (d.server != nullptr) {
+            return d;
+        }
+        auto name = target == Target::SYNC ? "sync" : target == Target::TCP ? "tcp" : "async";
+        auto port = std::to_string(FLAGS_port);
+
+        d.db_file = (std::filesystem::temp_directory_path() /
+                     ("kv_microbench-" + std::to_string(getpid()) + "-" + name)).string();
+        if (target == Target::SYNC) {
+            d.server = std::make_unique<kvstore::KVServerSync>(d.db_file, "");
+        } else {
+            auto addr = target == Target::TCP ? "127.0.0.1:" + port : "";
+
+            d.server = std::make_unique<kvstore::KVServerAsync>(d.db_file, addr,
+                                                                FLAGS_cq_threads > 0 ? FLAGS_cq_threads : 2,
+                                                                FLAGS_io_threads);
+        }
+        d.serving = std::thread([&d]() { d.server->Start(); });
+        d.channel = d.server->InProcessChannel();
+        if (target == Target::TCP) {
+            d.tcp_channel = kvstore::newDedicatedChannel("ipv4:127.0.0.1:" + port);
+            d.unix_channel = kvstore::newDedicatedChannel("unix:" + kvstore::unixSocketPath(port));
+        }
+        return d;
+    }
+
+    std::shared_ptr<grpc::Channel> channelOf(Deployment &d, Target target) {
+        return target == Target::TCP ? d.tcp_channel : target == Target::UNIX ? d.unix_channel : d.channel;
+    }
+
+    // Starts the server of target and loads NUM_KEYS kvs with values of value_size once, every
+    // thread of a benchmark calls it before its loop
+    Deployment &prepare(Target target, size_t value_size) {
+        std::lock_guard<std::mutex> lock(deployments_mutex);
+        auto &d = startDeployment(target == Target::DIRECT ? Target::ASYNC :
+                                  target == Target::UNIX ? Target::TCP : target);
+        auto &keys = d.keys[value_size];
+
+        if (keys.empty()) {
+            auto *engine = d.server->get_env()->shards[0].engine.get();
+            std::string value(value_size, 'v');
+            char key[32];
+
+            for (size_t i = 0; i < NUM_KEYS; i++) {
+                snprintf(key, sizeof(key), "key-%zu-%08zu", value_size, i);
+                keys.emplace_back(key);
+                CHECK(engine->Put(rocksdb::WriteOptions(), keys.back(), value).ok());
+            }
+        }
+        return d;
+    }
+
+    void stopDeployments() {
+        for (auto &entry: deployments) {
+            auto &d = entry.second;
+
+            d.server->Stop();
+            d.serving.join();
+            if (FLAGS_engine == "rocksdb") {
+                rocksdb::DestroyDB(d.db_file, rocksdb::Options());
+            }
+        }
+    }
+
+    void BM_Get(benchmark::State &state, Target target) {
+        size_t value_size = state.range(0);
+        auto &d = prepare(target, value_size);
+        auto &keys = d.keys[value_size];
+        auto *engine = d.server->get_env()->shards[0].engine.get();
+        kvstore::KVClient client(channelOf(d, target));
+        size_t i = state.thread_index() * 7919;
+        std::string value;
+
+        for (auto _: state) {
+            auto &key = keys[i++ % keys.size()];
+
+            if (target == Target::DIRECT) {
+                if (!engine->Get(rocksdb::ReadOptions(), key, &value).ok()) {
+                    state.SkipWithError("Get failed");
+                    break;
+                }
+            } else if (client.Get(key, value).error_code() != kvstore::ErrorCode::OK) {
+                state.SkipWithError("Get failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * value_size);
+    }
+
+    void BM_Put(benchmark::State &state, Target target) {
+        size_t value_size = state.range(0);
+        auto &d = prepare(target, value_size);
+        auto &keys = d.keys[value_size];
+        auto *engine = d.server->get_env()->shards[0].engine.get();
+        kvstore::KVClient client(channelOf(d, target));
+        size_t i = state.thread_index() * 7919;
+        std::string value(value_size, 'w');
+
+        for (auto _: state) {
+            auto &key = keys[i++ % keys.size()];
+
+            if (target == Target::DIRECT) {
+                if (!engine->Put(rocksdb::WriteOptions(), key, value).ok()) {
+                    state.SkipWithError("Put failed");
+                    break;
+                }
+            } else if (client.Put(key, value).error_code() != kvstore::ErrorCode::OK) {
+                state.SkipWithError("Put failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * value_size);
+    }
+
+    // Reads SCAN_LENGTH kvs per op, the direct case copies them out like the server does
+    void BM_Scan(benchmark::State &state, Target target) {
+        size_t value_size = state.range(0);
+        auto &d = prepare(target, value_size);
+        auto &keys = d.keys[value_size];
+        auto *engine = d.server->get_env()->shards[0].engine.get();
+        kvstore::KVClient client(channelOf(d, target));
+        size_t i = state.thread_index() * 7919;
+        std::vector<kvstore::KV> kvs;
+
+        for (auto _: state) {
+            auto &start = keys[i++ % (keys.size() - SCAN_LENGTH)];
+
+            kvs.clear();
+            if (target == Target::DIRECT) {
+                std::unique_ptr<rocksdb::Iterator> it(engine->NewIterator(rocksdb::ReadOptions()));
+
+                for (it->Seek(start); it->Valid() && kvs.size() < SCAN_LENGTH; it->Next()) {
+                    auto &kv = kvs.emplace_back();
+
+                    kv.set_key(it->key().data(), it->key().size());
+                    kv.set_value(it->value().data(), it->value().size());
+                }
+            } else if (client.Scan(start, kvs, SCAN_LENGTH).error_code() != kvstore::ErrorCode::OK) {
+                state.SkipWithError("Scan failed");
+                break;
+            }
+            benchmark::DoNotOptimize(kvs.data());
+        }
+        state.SetItemsProcessed(state.iterations() * SCAN_LENGTH);
+        state.SetBytesProcessed(state.iterations() * SCAN_LENGTH * value_size);
+    }
+
+    // Value sizes from 16 B to 64 KB, 1 to 8 client threads
+    void sizesAndThreads(benchmark::internal::Benchmark *b) {
+        b->RangeMultiplier(16)->Range(16, 64 << 10)->ThreadRange(1, 8)->UseRealTime();
+    }
+}
+
+BENCHMARK_CAPTURE(BM_Get, direct, Target::DIRECT)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Get, sync, Target::SYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Get, async, Target::ASYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Get, tcp, Target::TCP)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Get, unix, Target::UNIX)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Put, direct, Target::DIRECT)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Put, sync, Target::SYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Put, async, Target::ASYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Put, tcp, Target::TCP)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Put, unix, Target::UNIX)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Scan, direct, Target::DIRECT)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Scan, sync, Target::SYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Scan, async, Target::ASYNC)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Scan, tcp, Target::TCP)->Apply(sizesAndThreads);
+BENCHMARK_CAPTURE(BM_Scan, unix, Target::UNIX)->Apply(sizesAndThreads);
+
+int main(int argc, char *argv[]) {
+    benchmark::Initialize(&argc, argv);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    stopDeployments();
+    return 0;
+}
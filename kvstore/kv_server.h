@@ -1,290 +1,1802 @@
 #ifndef GRPC_KVSTORE_KV_SERVER_H
 #define GRPC_KVSTORE_KV_SERVER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <future>
+#include <optional>
+#include <string_view>
 #include <utility>
+#include <grpcpp/alarm.h>
+#include <grpcpp/generic/async_generic_service.h>
 #include <grpcpp/server_builder.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 
 #include "glog/logging.h"
 #include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/write_batch.h"
 #include "flags.h"
 #include "kvstore.grpc.pb.h"
 #include "common.h"
+#include "bulk_loader.h"
+#include "cpu_topology.h"
+#include "raw_frame.h"
+#include "group_commit.h"
+#include "local_endpoint.h"
+#include "memory_engine.h"
+#include "metrics.h"
+#include "read_cache.h"
+#include "replication.h"
+#include "scan_cursor.h"
+#include "storage_engine.h"
+#include "tracer.h"
+#include "worker_pool.h"
 
 
 namespace kvstore {
 
+    inline grpc::Status wrapStatus(const rocksdb::Status &rdb_status, Status *status) {
+        if (rdb_status.ok()) {
+            status->set_error_code(ErrorCode::OK);
+        } else {
+            status->set_error_code(ErrorCode::SERVER_ERROR);
+            status->set_error_msg(rdb_status.ToString());
+        }
+        return grpc::Status::OK;
+    }
+
+    // FNV-1a, stable across builds and platforms because it decides where a key is stored
+    inline uint64_t keyHash(std::string_view key) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+
+        for (unsigned char c: key) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // One independent storage engine, with its own WAL and memtable for RocksDB
+    struct Shard {
+        std::unique_ptr<StorageEngine> engine;
+        std::unique_ptr<GroupCommitter> committer;
+    };
+
+    // State shared by the sync service and all async calls of a server
+    struct ServerEnv {
+        std::vector<Shard> shards;
+        std::unique_ptr<SnapshotRegistry> snapshots;
+        std::unique_ptr<ReadCache> cache;
+        std::unique_ptr<WorkerPool> workers;
+        size_t bulk_load_chunk_bytes = DEFAULT_BULK_LOAD_CHUNK_BYTES;
+        // Replicas only apply the writes of their primary
+        bool read_only{};
+        ServerMetrics metrics;
+        // Traces sampled async calls, nullptr if tracing is disabled
+        std::unique_ptr<Tracer> tracer;
+
+        size_t shardIndex(std::string_view key) const {
+            return shards.size() == 1 ? 0 : keyHash(key) % shards.size();
+        }
+
+        Shard &shardOf(std::string_view key) {
+            return shards[shardIndex(key)];
+        }
+
+        std::vector<StorageEngine *> engines() const {
+            std::vector<StorageEngine *> engines;
+
+            for (auto &shard: shards) {
+                engines.push_back(shard.engine.get());
+            }
+            return engines;
+        }
+
+        // DBs of the shards for the features that need RocksDB itself, empty with other engines
+        std::vector<rocksdb::DB *> dbs() const {
+            std::vector<rocksdb::DB *> dbs;
+
+            for (auto &shard: shards) {
+                if (shard.engine->rocksdb() == nullptr) {
+                    return {};
+                }
+                dbs.push_back(shard.engine->rocksdb());
+            }
+            return dbs;
+        }
+    };
+
+    inline rocksdb::Status checkWritable(const ServerEnv *env) {
+        return env->read_only ? rocksdb::Status::NotSupported("Read-only replica, writes go to the primary") :
+               rocksdb::Status::OK();
+    }
+
+    // Reads through the read cache when it is enabled
+    inline rocksdb::Status get(ServerEnv *env, const std::string &key, std::string *value) {
+        auto *engine = env->shardOf(key).engine.get();
+
+        if (env->cache == nullptr) {
+            return engine->Get(rocksdb::ReadOptions(), key, value);
+        }
+        if (env->cache->Lookup(key, value)) {
+            return rocksdb::Status::OK();
+        }
+        uint64_t epoch = env->cache->BeginFill(key);
+        auto s = engine->Get(rocksdb::ReadOptions(), key, value);
+
+        if (s.ok()) {
+            env->cache->Fill(key, *value, epoch);
+        }
+        return s;
+    }
+
+    // Like get(), but leaves the value pinned in the block cache or memtable instead of copying it
+    // out. A cached value is copied into the slice's own buffer
+    inline rocksdb::Status getPinned(ServerEnv *env, const std::string &key, rocksdb::PinnableSlice *value) {
+        auto *engine = env->shardOf(key).engine.get();
+
+        if (env->cache == nullptr) {
+            return engine->Get(rocksdb::ReadOptions(), key, value);
+        }
+        if (env->cache->Lookup(key, value->GetSelf())) {
+            value->PinSelf();
+            return rocksdb::Status::OK();
+        }
+        uint64_t epoch = env->cache->BeginFill(key);
+        auto s = engine->Get(rocksdb::ReadOptions(), key, value);
+
+        if (s.ok()) {
+            env->cache->Fill(key, value->ToString(), epoch);
+        }
+        return s;
+    }
+
+    // Must be called after a write of key is applied and before it is acknowledged
+    inline void invalidate(ServerEnv *env, const std::string &key) {
+        if (env->cache != nullptr) {
+            env->cache->Invalidate(key);
+        }
+    }
+
+    // Looks up all keys with one batched MultiGet per shard. RocksDB sorts the keys and probes
+    // the memtables and block cache once per batch instead of once per key
+    inline grpc::Status multiGet(ServerEnv *env, const MultiGetReq &req, MultiGetResp *resp) {
+        size_t num_keys = req.keys_size();
+        std::vector<std::vector<size_t>> positions(env->shards.size());
+        std::vector<rocksdb::PinnableSlice> values(num_keys);
+        std::vector<rocksdb::Status> statuses(num_keys);
+
+        for (size_t i = 0; i < num_keys; i++) {
+            positions[env->shardIndex(req.keys(i))].push_back(i);
+        }
+        for (size_t shard = 0; shard < positions.size(); shard++) {
+            auto &pos = positions[shard];
+            auto *engine = env->shards[shard].engine.get();
+            size_t n = pos.size();
+            std::vector<rocksdb::Slice> keys;
+            std::vector<rocksdb::PinnableSlice> shard_values(n);
+            std::vector<rocksdb::Status> shard_statuses(n);
+
+            if (n == 0) {
+                continue;
+            }
+            keys.reserve(n);
+            for (auto i: pos) {
+                keys.emplace_back(req.keys(i));
+            }
+            engine->MultiGet(rocksdb::ReadOptions(), n, keys.data(), shard_values.data(), shard_statuses.data());
+            for (size_t j = 0; j < n; j++) {
+                values[pos[j]] = std::move(shard_values[j]);
+                statuses[pos[j]] = shard_statuses[j];
+            }
+        }
+
+        resp->mutable_values()->Reserve(num_keys);
+        resp->mutable_statuses()->Reserve(num_keys);
+        for (size_t i = 0; i < num_keys; i++) {
+            resp->add_values()->assign(values[i].data(), values[i].size());
+            wrapStatus(statuses[i], resp->add_statuses());
+        }
+        return wrapStatus(rocksdb::Status::OK(), resp->mutable_status());
+    }
+
+    // Applies one WriteBatch per shard. Each batch is atomic, the request as a whole is only
+    // atomic if all of its keys live on the same shard
+    inline rocksdb::Status writeSharded(ServerEnv *env, std::vector<rocksdb::WriteBatch> &batches,
+                                        Durability durability) {
+        rocksdb::Status status;
+
+        for (size_t shard = 0; shard < batches.size(); shard++) {
+            if (batches[shard].Count() == 0) {
+                continue;
+            }
+            auto s = env->shards[shard].engine->Write(writeOptions(durability), &batches[shard]);
+            if (status.ok() && !s.ok()) {
+                status = s;
+            }
+        }
+        return status;
+    }
+
+    inline grpc::Status multiPut(ServerEnv *env, const MultiPutReq &req, MultiPutResp *resp) {
+        std::vector<rocksdb::WriteBatch> batches(env->shards.size());
+
+        if (env->read_only) {
+            return wrapStatus(checkWritable(env), resp->mutable_status());
+        }
+
+        for (auto &kv: req.kvs()) {
+            batches[env->shardIndex(kv.key())].Put(kv.key(), kv.value());
+        }
+        auto s = writeSharded(env, batches, req.durability());
+        for (auto &kv: req.kvs()) {
+            invalidate(env, kv.key());
+        }
+        return wrapStatus(s, resp->mutable_status());
+    }
+
+    inline grpc::Status multiDelete(ServerEnv *env, const MultiDeleteReq &req, MultiDeleteResp *resp) {
+        std::vector<rocksdb::WriteBatch> batches(env->shards.size());
+
+        if (env->read_only) {
+            return wrapStatus(checkWritable(env), resp->mutable_status());
+        }
+
+        for (auto &key: req.keys()) {
+            batches[env->shardIndex(key)].Delete(key);
+        }
+        auto s = writeSharded(env, batches, req.durability());
+        for (auto &key: req.keys()) {
+            invalidate(env, key);
+        }
+        return wrapStatus(s, resp->mutable_status());
+    }
+
+    // Single-key writes go through the group committer when it is enabled, the callback gets
+    // the result once the write is applied
+    inline void put(ServerEnv *env, const PutReq &req, GroupCommitter::Callback callback) {
+        auto &kv = req.kv();
+        auto &shard = env->shardOf(kv.key());
+
+        if (env->read_only) {
+            callback(checkWritable(env));
+        } else if (shard.committer != nullptr) {
+            shard.committer->Put(kv.key(), kv.value(), req.durability(),
+                                 [env, &kv, callback](const rocksdb::Status &s) {
+                                     invalidate(env, kv.key());
+                                     callback(s);
+                                 });
+        } else {
+            auto s = shard.engine->Put(writeOptions(req.durability()), kv.key(), kv.value());
+            invalidate(env, kv.key());
+            callback(s);
+        }
+    }
+
+    inline void del(ServerEnv *env, const DeleteReq &req, GroupCommitter::Callback callback) {
+        auto &shard = env->shardOf(req.key());
+
+        if (env->read_only) {
+            callback(checkWritable(env));
+        } else if (shard.committer != nullptr) {
+            shard.committer->Delete(req.key(), req.durability(), [env, &req, callback](const rocksdb::Status &s) {
+                invalidate(env, req.key());
+                callback(s);
+            });
+        } else {
+            auto s = shard.engine->Delete(writeOptions(req.durability()), req.key());
+            invalidate(env, req.key());
+            callback(s);
+        }
+    }
+
+    inline void releaseSnapshot(ServerEnv *env, const ReleaseSnapshotReq &req, ReleaseSnapshotResp *resp) {
+        if (env->snapshots->Release(req.snapshot_id())) {
+            resp->mutable_status()->set_error_code(ErrorCode::OK);
+        } else {
+            resp->mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+            resp->mutable_status()->set_error_msg("Unknown snapshot " + std::to_string(req.snapshot_id()));
+        }
+    }
+
+    // Bulk loads ingest SST files and need the rocksdb engine, fills resp if it is not there
+    inline bool bulkLoadSupported(ServerEnv *env, BulkLoadResp *resp) {
+        if (!env->dbs().empty()) {
+            return true;
+        }
+        wrapStatus(rocksdb::Status::NotSupported("Bulk load needs the rocksdb engine"), resp->mutable_status());
+        return false;
+    }
+
+    inline std::unique_ptr<BulkLoader> newBulkLoader(ServerEnv *env) {
+        return std::make_unique<BulkLoader>(env->dbs(), [env](const std::string &key) {
+            return env->shardIndex(key);
+        }, env->bulk_load_chunk_bytes);
+    }
+
+    // Ingests everything added to the loader. Ingested keys may have stale values in the read
+    // cache, which is dropped as a whole rather than invalidated key by key
+    inline grpc::Status finishBulkLoad(ServerEnv *env, BulkLoader *loader, BulkLoadResp *resp) {
+        size_t files = 0;
+        auto s = checkWritable(env);
+
+        if (s.ok()) {
+            s = loader->Finish(&files);
+        } else {
+            loader->Abort();
+        }
+
+        if (env->cache != nullptr) {
+            env->cache->Clear();
+        }
+        resp->set_loaded(loader->added());
+        resp->set_files(files);
+        LOG(INFO) << "Bulk loaded " << loader->added() << " kvs in " << files << " files: " << s.ToString();
+        return wrapStatus(s, resp->mutable_status());
+    }
+
+    inline rocksdb::Status waitFor(const std::function<void(GroupCommitter::Callback)> &write) {
+        std::promise<rocksdb::Status> promise;
+        auto future = promise.get_future();
+
+        write([&promise](const rocksdb::Status &s) { promise.set_value(s); });
+        return future.get();
+    }
+
+    // Records a unary RPC that started at start_ns and is about to respond
+    template<typename REQ_T, typename RESP_T>
+    inline void recordUnary(ServerEnv *env, RpcMethod method, uint64_t start_ns, const REQ_T &req, const RESP_T &resp) {
+        env->metrics.Record(method, steadyNanos() - start_ns, req.ByteSizeLong(), resp.ByteSizeLong());
+    }
+
+    // Integer properties of every shard in StatsResp, the ones that show stalls and backlogs
+    const char *const STATS_PROPERTIES[] = {
+            "rocksdb.estimate-num-keys", "rocksdb.cur-size-all-mem-tables", "rocksdb.num-immutable-mem-table",
+            "rocksdb.mem-table-flush-pending", "rocksdb.num-running-flushes", "rocksdb.compaction-pending",
+            "rocksdb.num-running-compactions", "rocksdb.estimate-pending-compaction-bytes",
+            "rocksdb.actual-delayed-write-rate", "rocksdb.is-write-stopped", "rocksdb.num-snapshots",
+            "rocksdb.block-cache-usage", "rocksdb.live-sst-files-size", "rocksdb.background-errors"
+    };
+
+    inline void fillStats(ServerEnv *env, const StatsReq &req, StatsResp *resp) {
+        env->metrics.Fill(resp);
+        for (auto &shard: env->shards) {
+            auto *shard_stats = resp->add_shards();
+            auto statistics = shard.engine->statistics();
+
+            for (auto *property: STATS_PROPERTIES) {
+                uint64_t value;
+
+                if (shard.engine->GetIntProperty(property, &value)) {
+                    (*shard_stats->mutable_properties())[property] = value;
+                }
+            }
+            if (statistics != nullptr) {
+                for (auto &ticker: rocksdb::TickersNameMap) {
+                    auto count = statistics->getTickerCount(ticker.first);
+
+                    if (count > 0) {
+                        (*shard_stats->mutable_tickers())[ticker.second] = count;
+                    }
+                }
+            }
+        }
+        if (req.prometheus()) {
+            resp->set_prometheus(formatPrometheus(*resp));
+        }
+        resp->mutable_status()->set_error_code(ErrorCode::OK);
+    }
+
     class KVStoreServiceImpl final : public KVStore::Service {
     public:
-        explicit KVStoreServiceImpl(rocksdb::DB *db) : db_(db) {
+        explicit KVStoreServiceImpl(ServerEnv *env) : env_(env) {
 
         }
 
         ::grpc::Status
         Get(::grpc::ServerContext *context, const ::kvstore::GetReq *request, ::kvstore::GetResp *response) override {
-            auto &key = request->key();
-            std::string *value = response->mutable_value();
-            rocksdb::Status s = db_->Get(rocksdb::ReadOptions(), key, value);
+            auto start_ns = steadyNanos();
+            rocksdb::Status s = get(env_, request->key(), response->mutable_value());
+            auto status = wrapStatus(s, response->mutable_status());
 
-            return wrapStatus(s, response->mutable_status());
+            recordUnary(env_, RpcMethod::GET, start_ns, *request, *response);
+            return status;
         }
 
         ::grpc::Status
         Put(::grpc::ServerContext *context, const ::kvstore::PutReq *request, ::kvstore::PutResp *response) override {
-            auto &kv = request->kv();
-            rocksdb::Status s = db_->Put(rocksdb::WriteOptions(), kv.key(), kv.value());
-            return wrapStatus(s, response->mutable_status());
+            auto start_ns = steadyNanos();
+            rocksdb::Status s = waitFor([&](GroupCommitter::Callback callback) {
+                put(env_, *request, std::move(callback));
+            });
+            auto status = wrapStatus(s, response->mutable_status());
+
+            recordUnary(env_, RpcMethod::PUT, start_ns, *request, *response);
+            return status;
         }
 
         ::grpc::Status Delete(::grpc::ServerContext *context, const ::kvstore::DeleteReq *request,
                               ::kvstore::DeleteResp *response) override {
-            auto &key = request->key();
-            rocksdb::Status s = db_->Delete(rocksdb::WriteOptions(), key);
-            return wrapStatus(s, response->mutable_status());
+            auto start_ns = steadyNanos();
+            rocksdb::Status s = waitFor([&](GroupCommitter::Callback callback) {
+                del(env_, *request, std::move(callback));
+            });
+            auto status = wrapStatus(s, response->mutable_status());
+
+            recordUnary(env_, RpcMethod::DELETE, start_ns, *request, *response);
+            return status;
         }
 
         ::grpc::Status Scan(::grpc::ServerContext *context, const ::kvstore::ScanReq *request,
                             ::grpc::ServerWriter<::kvstore::ScanResp> *writer) override {
-            size_t batch_size = request->has_limit() ? request->limit() : std::numeric_limits<size_t>::max();
-            auto *it = db_->NewIterator(rocksdb::ReadOptions());
-
-            for (request->has_start() ? it->Seek(request->start()) : it->SeekToFirst();
-                 it->Valid() && batch_size > 0; it->Next(), batch_size--) {
-                ScanResp resp;
-                resp.mutable_kv()->mutable_key()->assign(it->key().data(), it->key().size());
-                resp.mutable_kv()->mutable_value()->assign(it->value().data(), it->value().size());
+            RpcTimer timer(&env_->metrics, RpcMethod::SCAN, request->ByteSizeLong());
+            ScanCursor cursor;
+            ScanResp resp;
+            bool has_more;
+
+            if (!cursor.Open(env_->engines(), env_->snapshots.get(), *request, resp.mutable_status())) {
+                timer.AddBytes(0, resp.ByteSizeLong());
                 writer->Write(resp);
+                return grpc::Status::OK;
             }
-            CHECK(it->status().ok()) << it->status().ToString();
-            delete it;
+            do {
+                has_more = cursor.Fill(&resp);
+                if (resp.kvs_size() > 0 || resp.has_status()) {
+                    timer.AddBytes(0, resp.ByteSizeLong());
+                    if (!writer->Write(resp)) {
+                        break;
+                    }
+                }
+            } while (has_more);
             return grpc::Status::OK;
         }
 
         ::grpc::Status
         Warmup(::grpc::ServerContext *context, const ::kvstore::WarmupReq *request,
                ::kvstore::WarmupResp *response) override {
+            auto start_ns = steadyNanos();
+
             response->mutable_data()->resize(request->resp_size());
+            recordUnary(env_, RpcMethod::WARMUP, start_ns, *request, *response);
             return grpc::Status::OK;
         }
 
-    private:
-        rocksdb::DB *db_;
+        ::grpc::Status MultiGet(::grpc::ServerContext *context, const ::kvstore::MultiGetReq *request,
+                                ::kvstore::MultiGetResp *response) override {
+            auto start_ns = steadyNanos();
+            auto status = multiGet(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_GET, start_ns, *request, *response);
+            return status;
+        }
+
+        ::grpc::Status MultiPut(::grpc::ServerContext *context, const ::kvstore::MultiPutReq *request,
+                                ::kvstore::MultiPutResp *response) override {
+            auto start_ns = steadyNanos();
+            auto status = multiPut(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_PUT, start_ns, *request, *response);
+            return status;
+        }
+
+        ::grpc::Status MultiDelete(::grpc::ServerContext *context, const ::kvstore::MultiDeleteReq *request,
+                                   ::kvstore::MultiDeleteResp *response) override {
+            auto start_ns = steadyNanos();
+            auto status = multiDelete(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_DELETE, start_ns, *request, *response);
+            return status;
+        }
+
+        ::grpc::Status ReleaseSnapshot(::grpc::ServerContext *context, const ::kvstore::ReleaseSnapshotReq *request,
+                                       ::kvstore::ReleaseSnapshotResp *response) override {
+            auto start_ns = steadyNanos();
+
+            releaseSnapshot(env_, *request, response);
+            recordUnary(env_, RpcMethod::RELEASE_SNAPSHOT, start_ns, *request, *response);
+            return grpc::Status::OK;
+        }
+
+        ::grpc::Status BulkLoad(::grpc::ServerContext *context, ::grpc::ServerReader<::kvstore::BulkLoadReq> *reader,
+                                ::kvstore::BulkLoadResp *response) override {
+            RpcTimer timer(&env_->metrics, RpcMethod::BULK_LOAD);
+
+            if (!bulkLoadSupported(env_, response)) {
+                return grpc::Status::OK;
+            }
+            auto loader = newBulkLoader(env_);
+            BulkLoadReq req;
+
+            while (reader->Read(&req)) {
+                timer.AddBytes(req.ByteSizeLong(), 0);
+                for (auto &kv: req.kvs()) {
+                    loader->Add(kv.key(), kv.value());
+                }
+            }
+            auto status = finishBulkLoad(env_, loader.get(), response);
+            timer.AddBytes(0, response->ByteSizeLong());
+            return status;
+        }
+
+        ::grpc::Status Stats(::grpc::ServerContext *context, const ::kvstore::StatsReq *request,
+                             ::kvstore::StatsResp *response) override {
+            auto start_ns = steadyNanos();
+
+            fillStats(env_, *request, response);
+            recordUnary(env_, RpcMethod::STATS, start_ns, *request, *response);
+            return grpc::Status::OK;
+        }
+
+    private:
+        ServerEnv *env_;
+    };
+
+    // Server side of a Scan in callback mode. Like ScanCall it reads the next block while the
+    // previous one is written, both steps decrement pending_events_ and the last one moves on.
+    // OnWriteDone may run on another thread as soon as StartWrite is called.
+    class ScanReactor : public grpc::ServerWriteReactor<ScanResp> {
+    public:
+        ScanReactor(ServerEnv *env, const ScanReq &req) : timer_(&env->metrics, RpcMethod::SCAN, req.ByteSizeLong()) {
+            if (cursor_.Open(env->engines(), env->snapshots.get(), req, next_.mutable_status())) {
+                has_more_ = cursor_.Fill(&next_);
+            }
+            write();
+        }
+
+        void OnWriteDone(bool ok) override {
+            if (!ok) {
+                cancelled_ = true;
+            }
+            if (--pending_events_ == 0) {
+                write();
+            }
+        }
+
+        void OnDone() override {
+            delete this;
+        }
+
+    private:
+        RpcTimer timer_;
+        ScanCursor cursor_;
+        ScanResp writing_;
+        ScanResp next_;
+        bool has_more_{};
+        bool cancelled_{};
+        std::atomic_int pending_events_{0};
+
+        // Runs on whichever of the prefetch and the write completion ends last. When the write
+        // completes first the prefetching thread goes on with the next block in the loop rather
+        // than recursing, so a long scan does not grow the stack
+        void write() {
+            do {
+                if (cancelled_ || (next_.kvs_size() == 0 && !next_.has_status())) {
+                    Finish(grpc::Status::OK);
+                    return;
+                }
+                std::swap(writing_, next_);
+                timer_.AddBytes(0, writing_.ByteSizeLong());
+                pending_events_ = 2;
+                StartWrite(&writing_);
+                if (has_more_) {
+                    has_more_ = cursor_.Fill(&next_);
+                } else {
+                    next_.Clear();
+                }
+            } while (--pending_events_ == 0);
+        }
+    };
+
+    // Server side of a BulkLoad in callback mode, kvs are added to the loader on the callback
+    // thread that completes each read
+    class BulkLoadReactor : public grpc::ServerReadReactor<BulkLoadReq> {
+    public:
+        BulkLoadReactor(ServerEnv *env, BulkLoadResp *resp) :
+                env_(env), resp_(resp), timer_(&env->metrics, RpcMethod::BULK_LOAD) {
+            if (!bulkLoadSupported(env, resp)) {
+                Finish(grpc::Status::OK);
+                return;
+            }
+            loader_ = newBulkLoader(env);
+            StartRead(&req_);
+        }
+
+        void OnReadDone(bool ok) override {
+            if (!ok) {
+                auto status = finishBulkLoad(env_, loader_.get(), resp_);
+
+                timer_.AddBytes(0, resp_->ByteSizeLong());
+                Finish(status);
+                return;
+            }
+            timer_.AddBytes(req_.ByteSizeLong(), 0);
+            for (auto &kv: req_.kvs()) {
+                loader_->Add(kv.key(), kv.value());
+            }
+            StartRead(&req_);
+        }
+
+        void OnDone() override {
+            delete this;
+        }
+
+    private:
+        ServerEnv *env_;
+        BulkLoadResp *resp_;
+        RpcTimer timer_;
+        std::unique_ptr<BulkLoader> loader_;
+        BulkLoadReq req_;
+    };
+
+    // Service of the callback API server. Requests are handled right on gRPC's callback threads,
+    // writes through the group committer finish their reactor from the commit thread.
+    class KVStoreCallbackServiceImpl final : public KVStore::CallbackService {
+    public:
+        explicit KVStoreCallbackServiceImpl(ServerEnv *env) : env_(env) {}
+
+        grpc::ServerUnaryReactor *Get(grpc::CallbackServerContext *context, const GetReq *request,
+                                      GetResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+            auto status = wrapStatus(get(env_, request->key(), response->mutable_value()), response->mutable_status());
+
+            recordUnary(env_, RpcMethod::GET, start_ns, *request, *response);
+            reactor->Finish(status);
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *Put(grpc::CallbackServerContext *context, const PutReq *request,
+                                      PutResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+
+            put(env_, *request, [this, reactor, request, response, start_ns](const rocksdb::Status &s) {
+                auto status = wrapStatus(s, response->mutable_status());
+
+                recordUnary(env_, RpcMethod::PUT, start_ns, *request, *response);
+                reactor->Finish(status);
+            });
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *Delete(grpc::CallbackServerContext *context, const DeleteReq *request,
+                                         DeleteResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+
+            del(env_, *request, [this, reactor, request, response, start_ns](const rocksdb::Status &s) {
+                auto status = wrapStatus(s, response->mutable_status());
+
+                recordUnary(env_, RpcMethod::DELETE, start_ns, *request, *response);
+                reactor->Finish(status);
+            });
+            return reactor;
+        }
+
+        grpc::ServerWriteReactor<ScanResp> *Scan(grpc::CallbackServerContext *context,
+                                                 const ScanReq *request) override {
+            return new ScanReactor(env_, *request);
+        }
+
+        grpc::ServerUnaryReactor *Warmup(grpc::CallbackServerContext *context, const WarmupReq *request,
+                                         WarmupResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+
+            response->mutable_data()->resize(request->resp_size());
+            recordUnary(env_, RpcMethod::WARMUP, start_ns, *request, *response);
+            reactor->Finish(grpc::Status::OK);
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *MultiGet(grpc::CallbackServerContext *context, const MultiGetReq *request,
+                                           MultiGetResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+            auto status = multiGet(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_GET, start_ns, *request, *response);
+            reactor->Finish(status);
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *MultiPut(grpc::CallbackServerContext *context, const MultiPutReq *request,
+                                           MultiPutResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+            auto status = multiPut(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_PUT, start_ns, *request, *response);
+            reactor->Finish(status);
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *MultiDelete(grpc::CallbackServerContext *context, const MultiDeleteReq *request,
+                                              MultiDeleteResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+            auto status = multiDelete(env_, *request, response);
+
+            recordUnary(env_, RpcMethod::MULTI_DELETE, start_ns, *request, *response);
+            reactor->Finish(status);
+            return reactor;
+        }
+
+        grpc::ServerUnaryReactor *ReleaseSnapshot(grpc::CallbackServerContext *context,
+                                                  const ReleaseSnapshotReq *request,
+                                                  ReleaseSnapshotResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+
+            releaseSnapshot(env_, *request, response);
+            recordUnary(env_, RpcMethod::RELEASE_SNAPSHOT, start_ns, *request, *response);
+            reactor->Finish(grpc::Status::OK);
+            return reactor;
+        }
+
+        grpc::ServerReadReactor<BulkLoadReq> *BulkLoad(grpc::CallbackServerContext *context,
+                                                       BulkLoadResp *response) override {
+            return new BulkLoadReactor(env_, response);
+        }
+
+        grpc::ServerUnaryReactor *Stats(grpc::CallbackServerContext *context, const StatsReq *request,
+                                        StatsResp *response) override {
+            auto *reactor = context->DefaultReactor();
+            auto start_ns = steadyNanos();
+
+            fillStats(env_, *request, response);
+            recordUnary(env_, RpcMethod::STATS, start_ns, *request, *response);
+            reactor->Finish(grpc::Status::OK);
+            return reactor;
+        }
+
+    private:
+        ServerEnv *env_;
+    };
+
+    enum class CallStatus {
+        CREATE, PROCESS, READING, RESPOND, WRITING, FINISH
+    };
+
+    // Get is served raw, so its response can reference the pinned value instead of a copy
+    using AsyncKVService = KVStore::WithRawMethod_Get<KVStore::AsyncService>;
+
+    class Call;
+
+    // Free lists of finished calls, one pool per completion queue. Calls of a queue are only
+    // spawned and released by the thread polling it, so the pool needs no synchronization.
+    class CallPool {
+    public:
+        explicit CallPool(size_t cq_index, grpc::AsyncGenericService *generic_service = nullptr) :
+                cq_index_(cq_index), generic_service_(generic_service) {}
+
+        CallPool(const CallPool &) = delete;
+
+        ~CallPool();
+
+        // Arms a call of the given kind for the next request, reusing a finished one if possible
+        template<typename CALL_T>
+        void Spawn(AsyncKVService *service, grpc::ServerCompletionQueue *cq, ServerEnv *env);
+
+        void Release(Call *call);
+
+        // Service of the raw calls, nullptr if the raw service is disabled
+        grpc::AsyncGenericService *generic_service() const { return generic_service_; }
+
+        size_t cq_index() const { return cq_index_; }
+
+    private:
+        size_t cq_index_;
+        grpc::AsyncGenericService *generic_service_;
+        std::vector<std::vector<Call *>> free_lists_;
+
+        static size_t nextTypeId() {
+            static std::atomic_size_t next{0};
+            return next++;
+        }
+
+        template<typename CALL_T>
+        static size_t typeId() {
+            static const size_t id = nextTypeId();
+            return id;
+        }
+
+        std::vector<Call *> &freeList(size_t type_id) {
+            if (type_id >= free_lists_.size()) {
+                free_lists_.resize(type_id + 1);
+            }
+            return free_lists_[type_id];
+        }
+    };
+
+    // An async call alternates between network steps, which always run on the thread polling
+    // its completion queue, and storage work in Storage(). With a worker pool the storage work
+    // is handed to a worker, which posts the call back to its completion queue with an alarm
+    // when done. Without one it runs inline on the completion queue thread.
+    // Calls are recycled through their CallPool: Request() arms a call for a new request and
+    // Clear() drops the per-request state. Request and response messages live on the call's
+    // arena, whose first block is part of the call, so small requests do not touch the heap.
+    class Call : public WorkerTask {
+    public:
+        Call(AsyncKVService *service,
+             grpc::ServerCompletionQueue *cq,
+             ServerEnv *env,
+             CallPool *pool) : service_(service), cq_(cq), env_(env), pool_(pool),
+                               call_status_(CallStatus::CREATE),
+                               arena_(arena_block_, sizeof(arena_block_)) {
+        }
+
+        virtual ~Call() = default;
+
+        virtual void Proceed() = 0;
+
+        virtual RpcMethod method() const = 0;
+
+        // Entry point of the completion queue loop, times the call from its first event on
+        void Handle(bool ok) {
+            if (call_status_ == CallStatus::PROCESS && ok) {
+                start_ns_ = steadyNanos();
+                env_->metrics.Enter(pool_->cq_index());
+                if (env_->tracer != nullptr) {
+                    startTrace();
+                }
+            } else if (trace_ != nullptr) {
+                trace_->Mark(nullptr);
+            }
+            Proceed(ok);
+        }
+
+        // Handles an event of the completion queue. A failed event means the call is broken: the
+        // server shuts down before a request arrived, or the client cancelled or hit its deadline.
+        // Nothing else is pending then and the call is released. Calls that read a client stream,
+        // where a failed read ends the stream, or that can have another event pending override it
+        virtual void Proceed(bool ok) {
+            if (ok) {
+                Proceed();
+            } else {
+                release();
+            }
+        }
+
+        void Execute() override {
+            if (trace_ != nullptr) {
+                trace_->Add("worker_queue", submit_ns_, steadyNanos());
+                trace_->Storage([this] { Storage(); });
+            } else {
+                Storage();
+            }
+            notify();
+        }
+
+    protected:
+        AsyncKVService *service_;
+        grpc::ServerCompletionQueue *cq_;
+        std::optional<grpc::ServerContext> ctx_;
+
+        ServerEnv *env_;
+        CallPool *pool_;
+        CallStatus call_status_;
+        // Message bytes received and sent, for the metrics
+        uint64_t bytes_in_{};
+        uint64_t bytes_out_{};
+
+        virtual void Request() = 0;
+
+        virtual void Clear() {
+            ctx_.reset();
+            arena_.Reset();
+            start_ns_ = 0;
+            bytes_in_ = 0;
+            bytes_out_ = 0;
+            trace_.reset();
+        }
+
+        virtual void Storage() {}
+
+        template<typename MSG_T>
+        MSG_T *newMessage() {
+            return google::protobuf::Arena::CreateMessage<MSG_T>(&arena_);
+        }
+
+        template<typename CALL_T>
+        void spawn() {
+            pool_->Spawn<CALL_T>(service_, cq_, env_);
+        }
+
+        // Hands the finished call back to its pool, replaces "delete this"
+        void release() {
+            if (start_ns_ != 0) {
+                env_->metrics.Record(method(), steadyNanos() - start_ns_, bytes_in_, bytes_out_);
+                env_->metrics.Leave(pool_->cq_index());
+            }
+            if (trace_ != nullptr) {
+                trace_->Finish();
+                env_->tracer->Emit(trace_.get());
+            }
+            pool_->Release(this);
+        }
+
+        // Runs Storage() and then Proceed() again, must be the last thing Proceed() does
+        void execute() {
+            if (env_->workers != nullptr) {
+                traceMark("storage_wait");
+                submit();
+            } else {
+                if (trace_ != nullptr) {
+                    trace_->Storage([this] { Storage(); });
+                } else {
+                    Storage();
+                }
+                Proceed();
+            }
+        }
+
+        // Hands the call to a worker, which runs Execute()
+        void submit() {
+            if (trace_ != nullptr) {
+                submit_ns_ = steadyNanos();
+            }
+            env_->workers->Submit(this);
+        }
+
+        // Opens the stage the call waits in until its next completion queue event
+        void traceMark(const char *stage) {
+            if (trace_ != nullptr) {
+                trace_->Mark(stage);
+            }
+        }
+
+        // Returns the stages so far to a client that asked for them, call it before finishing
+        void addTraceTrailer(grpc::ServerContext *ctx) {
+            if (trace_ != nullptr && trace_->requested()) {
+                ctx->AddTrailingMetadata(TRACE_METADATA_KEY, trace_->Summary());
+            }
+        }
+
+        // Schedules Proceed() on the completion queue thread, may be called from any thread
+        void notify() {
+            alarm_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), this);
+        }
+
+    private:
+        friend class CallPool;
+
+        static constexpr size_t ARENA_BLOCK_SIZE = 8192;
+
+        size_t type_id_{};
+        uint64_t start_ns_{};
+        uint64_t submit_ns_{};
+        std::unique_ptr<RequestTrace> trace_;
+        grpc::Alarm alarm_;
+        alignas(8) char arena_block_[ARENA_BLOCK_SIZE]{};
+        google::protobuf::Arena arena_;
+
+        // Raw calls have no ServerContext and are only traced when sampled
+        void startTrace() {
+            bool requested = ctx_ && ctx_->client_metadata().count(TRACE_METADATA_KEY) > 0;
+
+            if (requested || env_->tracer->Sample()) {
+                trace_ = std::make_unique<RequestTrace>(method(), requested);
+            }
+        }
+    };
+
+    template<typename CALL_T>
+    void CallPool::Spawn(AsyncKVService *service, grpc::ServerCompletionQueue *cq, ServerEnv *env) {
+        size_t type_id = typeId<CALL_T>();
+        auto &free_list = freeList(type_id);
+        Call *call;
+
+        if (free_list.empty()) {
+            call = new CALL_T(service, cq, env, this);
+            call->type_id_ = type_id;
+            env->metrics.CallAllocated(cq_index_);
+        } else {
+            call = free_list.back();
+            free_list.pop_back();
+            env->metrics.CallReused(cq_index_);
+        }
+        call->Request();
+    }
+
+    inline void CallPool::Release(Call *call) {
+        call->Clear();
+        freeList(call->type_id_).push_back(call);
+    }
+
+    inline CallPool::~CallPool() {
+        for (auto &free_list: free_lists_) {
+            for (auto *call: free_list) {
+                delete call;
+            }
+        }
+    }
+
+    // Unary call whose request and response messages are allocated on the call's arena
+    template<typename REQ_T, typename RESP_T>
+    class UnaryCall : public Call {
+    public:
+        using Call::Call;
+
+    protected:
+        REQ_T *req_{};
+        RESP_T *resp_{};
+        std::optional<grpc::ServerAsyncResponseWriter<RESP_T>> responder_;
+
+        void prepare() {
+            ctx_.emplace();
+            responder_.emplace(&*ctx_);
+            req_ = newMessage<REQ_T>();
+            resp_ = newMessage<RESP_T>();
+            call_status_ = CallStatus::PROCESS;
+        }
+
+        void finish(const grpc::Status &status) {
+            call_status_ = CallStatus::FINISH;
+            bytes_in_ = req_->ByteSizeLong();
+            bytes_out_ = resp_->ByteSizeLong();
+            addTraceTrailer(&*ctx_);
+            traceMark("send");
+            responder_->Finish(*resp_, status, this);
+        }
+
+        void Clear() override {
+            responder_.reset();
+            req_ = nullptr;
+            resp_ = nullptr;
+            Call::Clear();
+        }
+    };
+
+    // Smaller values are copied next to their header, a slice of their own costs more than the copy
+    const size_t MIN_PINNED_VALUE_SIZE = 1024;
+
+    // Slice over a pinned value that keeps it pinned until gRPC drops the slice, value is left empty
+    inline grpc::Slice pinnedSlice(rocksdb::PinnableSlice *value) {
+        auto *pinned = new rocksdb::PinnableSlice(std::move(*value));
+
+        return grpc::Slice(const_cast<char *>(pinned->data()), pinned->size(), [](void *p) {
+            delete static_cast<rocksdb::PinnableSlice *>(p);
+        }, pinned);
+    }
+
+    // Serves Get on the raw method. The response is serialized by hand: the status and the header
+    // of the value field go into one small slice and a large value follows as a slice over the
+    // pinned RocksDB block, which is unpinned when gRPC drops its last reference. Field order
+    // does not matter to protobuf parsers, so clients read it as a regular GetResp.
+    class GetCall : public Call {
+    public:
+        using Call::Call;
+
+        RpcMethod method() const override { return RpcMethod::GET; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<GetCall>();
+                call_status_ = CallStatus::RESPOND;
+                // Storage() deserializes request_, which clears it
+                bytes_in_ = request_.Length();
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                call_status_ = CallStatus::FINISH;
+                addTraceTrailer(&*ctx_);
+                traceMark("send");
+                if (parse_status_.ok()) {
+                    auto response = serialize();
+
+                    bytes_out_ = response.Length();
+                    responder_->Finish(response, grpc::Status::OK, this);
+                } else {
+                    responder_->Finish(grpc::ByteBuffer(), parse_status_, this);
+                }
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            ctx_.emplace();
+            responder_.emplace(&*ctx_);
+            req_ = newMessage<GetReq>();
+            call_status_ = CallStatus::PROCESS;
+            service_->RequestGet(&*ctx_, &request_, &*responder_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            parse_status_ = grpc::SerializationTraits<GetReq>::Deserialize(&request_, req_);
+            if (parse_status_.ok()) {
+                rocksdb_status_ = getPinned(env_, req_->key(), &value_);
+            }
+        }
+
+        void Clear() override {
+            responder_.reset();
+            request_.Clear();
+            req_ = nullptr;
+            value_.Reset();
+            Call::Clear();
+        }
+
+    private:
+        grpc::ByteBuffer request_;
+        std::optional<grpc::ServerAsyncResponseWriter<grpc::ByteBuffer>> responder_;
+        GetReq *req_{};
+        grpc::Status parse_status_;
+        rocksdb::Status rocksdb_status_;
+        rocksdb::PinnableSlice value_;
+
+        grpc::ByteBuffer serialize() {
+            auto *resp = newMessage<GetResp>();
+            std::string header;
+
+            wrapStatus(rocksdb_status_, resp->mutable_status());
+            resp->SerializeToString(&header);
+            if (value_.empty()) {
+                grpc::Slice slice(header);
+                return grpc::ByteBuffer(&slice, 1);
+            }
+            google::protobuf::io::StringOutputStream stream(&header);
+            {
+                google::protobuf::io::CodedOutputStream out(&stream);
+                out.WriteTag(google::protobuf::internal::WireFormatLite::MakeTag(
+                        GetResp::kValueFieldNumber, google::protobuf::internal::WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+                out.WriteVarint32(value_.size());
+                if (value_.size() < MIN_PINNED_VALUE_SIZE) {
+                    out.WriteRaw(value_.data(), (int) value_.size());
+                }
+            }
+            if (value_.size() < MIN_PINNED_VALUE_SIZE) {
+                grpc::Slice slice(header);
+                return grpc::ByteBuffer(&slice, 1);
+            }
+            grpc::Slice slices[2] = {grpc::Slice(header), pinnedSlice(&value_)};
+            return grpc::ByteBuffer(slices, 2);
+        }
+    };
+
+    class WarmupCall : public UnaryCall<WarmupReq, WarmupResp> {
+    public:
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::WARMUP; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<WarmupCall>();
+                resp_->mutable_data()->resize(req_->resp_size());
+                finish(grpc::Status::OK);
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestWarmup(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
+    };
+
+    class PutCall : public UnaryCall<PutReq, PutResp> {
+    public:
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::PUT; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<PutCall>();
+                call_status_ = CallStatus::RESPOND;
+                auto *committer = env_->shardOf(req_->kv().key()).committer.get();
+                if (env_->read_only) {
+                    rocksdb_status_ = checkWritable(env_);
+                    Proceed();
+                } else if (committer != nullptr) {
+                    traceMark("group_commit");
+                    committer->Put(req_->kv().key(), req_->kv().value(), req_->durability(),
+                                   [this](const rocksdb::Status &s) {
+                                       invalidate(env_, req_->kv().key());
+                                       rocksdb_status_ = s;
+                                       notify();
+                                   });
+                } else {
+                    execute();
+                }
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(wrapStatus(rocksdb_status_, resp_->mutable_status()));
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestPut(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            auto &kv = req_->kv();
+            rocksdb_status_ = env_->shardOf(kv.key()).engine->Put(writeOptions(req_->durability()), kv.key(), kv.value());
+            invalidate(env_, req_->kv().key());
+        }
+
+    private:
+        rocksdb::Status rocksdb_status_;
+    };
+
+
+    class DeleteCall : public UnaryCall<DeleteReq, DeleteResp> {
+    public:
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::DELETE; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<DeleteCall>();
+                call_status_ = CallStatus::RESPOND;
+                auto *committer = env_->shardOf(req_->key()).committer.get();
+                if (env_->read_only) {
+                    rocksdb_status_ = checkWritable(env_);
+                    Proceed();
+                } else if (committer != nullptr) {
+                    traceMark("group_commit");
+                    committer->Delete(req_->key(), req_->durability(), [this](const rocksdb::Status &s) {
+                        invalidate(env_, req_->key());
+                        rocksdb_status_ = s;
+                        notify();
+                    });
+                } else {
+                    execute();
+                }
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(wrapStatus(rocksdb_status_, resp_->mutable_status()));
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestDelete(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
 
-        static grpc::Status wrapStatus(const rocksdb::Status &rdb_status, Status *status) {
-            if (rdb_status.ok()) {
-                status->set_error_code(ErrorCode::OK);
-            } else {
-                status->set_error_code(ErrorCode::SERVER_ERROR);
-                status->set_error_msg(rdb_status.ToString());
-            }
-            return grpc::Status::OK;
+        void Storage() override {
+            rocksdb_status_ = env_->shardOf(req_->key()).engine->Delete(writeOptions(req_->durability()), req_->key());
+            invalidate(env_, req_->key());
         }
-    };
 
-    enum class CallStatus {
-        CREATE, PROCESS, WRITING, FINISH
+    private:
+        rocksdb::Status rocksdb_status_;
     };
 
-    class Call {
+    class MultiGetCall : public UnaryCall<MultiGetReq, MultiGetResp> {
     public:
-        Call(KVStore::AsyncService *service,
-             grpc::ServerCompletionQueue *cq,
-             rocksdb::DB *db) : service_(service), cq_(cq), db_(db), call_status_(CallStatus::CREATE) {
-        }
+        using UnaryCall::UnaryCall;
 
-        virtual ~Call() = default;
+        RpcMethod method() const override { return RpcMethod::MULTI_GET; }
 
-        virtual void Proceed() = 0;
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<MultiGetCall>();
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(grpc::Status::OK);
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
 
     protected:
-        KVStore::AsyncService *service_;
-        grpc::ServerCompletionQueue *cq_;
-        grpc::ServerContext ctx_;
-
-        rocksdb::DB *db_;
-        CallStatus call_status_;
+        void Request() override {
+            prepare();
+            service_->RequestMultiGet(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
 
-        static grpc::Status wrapStatus(const rocksdb::Status &rdb_status, Status *status) {
-            if (rdb_status.ok()) {
-                status->set_error_code(ErrorCode::OK);
-            } else {
-                status->set_error_code(ErrorCode::SERVER_ERROR);
-                status->set_error_msg(rdb_status.ToString());
-            }
-            return grpc::Status::OK;
+        void Storage() override {
+            multiGet(env_, *req_, resp_);
         }
     };
 
-    class GetCall : public Call {
+    class MultiPutCall : public UnaryCall<MultiPutReq, MultiPutResp> {
     public:
-        GetCall(KVStore::AsyncService *service,
-                grpc::ServerCompletionQueue *cq,
-                rocksdb::DB *db) :
-                Call(service, cq, db), responder_(&ctx_) {
-            call_status_ = CallStatus::PROCESS;
-            service_->RequestGet(&ctx_, &req_, &responder_, cq_, cq_, this);
-        }
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::MULTI_PUT; }
 
         void Proceed() override {
             if (call_status_ == CallStatus::PROCESS) {
-                new GetCall(service_, cq_, db_);
-                auto rocksdb_status = db_->Get(rocksdb::ReadOptions(), req_.key(), resp_.mutable_value());
-                call_status_ = CallStatus::FINISH;
-                responder_.Finish(resp_, wrapStatus(rocksdb_status, resp_.mutable_status()), this);
+                spawn<MultiPutCall>();
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(grpc::Status::OK);
             } else {
                 GPR_ASSERT(call_status_ == CallStatus::FINISH);
-                delete this;
+                release();
             }
         }
 
-    private:
-        GetReq req_;
-        GetResp resp_;
-        grpc::ServerAsyncResponseWriter<GetResp> responder_;
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestMultiPut(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            multiPut(env_, *req_, resp_);
+        }
     };
 
-    class WarmupCall : public Call {
+    class MultiDeleteCall : public UnaryCall<MultiDeleteReq, MultiDeleteResp> {
     public:
-        WarmupCall(KVStore::AsyncService *service,
-                   grpc::ServerCompletionQueue *cq,
-                   rocksdb::DB *db) :
-                Call(service, cq, db), responder_(&ctx_) {
-            call_status_ = CallStatus::PROCESS;
-            service_->RequestWarmup(&ctx_, &req_, &responder_, cq_, cq_, this);
-        }
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::MULTI_DELETE; }
 
         void Proceed() override {
             if (call_status_ == CallStatus::PROCESS) {
-                new WarmupCall(service_, cq_, db_);
-                resp_.mutable_data()->resize(req_.resp_size());
-                call_status_ = CallStatus::FINISH;
-                responder_.Finish(resp_, grpc::Status::OK, this);
+                spawn<MultiDeleteCall>();
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(grpc::Status::OK);
             } else {
                 GPR_ASSERT(call_status_ == CallStatus::FINISH);
-                delete this;
+                release();
             }
         }
 
-    private:
-        WarmupReq req_;
-        WarmupResp resp_;
-        grpc::ServerAsyncResponseWriter<WarmupResp> responder_;
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestMultiDelete(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            multiDelete(env_, *req_, resp_);
+        }
     };
 
-    class PutCall : public Call {
+    class ReleaseSnapshotCall : public UnaryCall<ReleaseSnapshotReq, ReleaseSnapshotResp> {
     public:
-        PutCall(KVStore::AsyncService *service,
-                grpc::ServerCompletionQueue *cq,
-                rocksdb::DB *db) :
-                Call(service, cq, db), responder_(&ctx_) {
-            call_status_ = CallStatus::PROCESS;
-            service_->RequestPut(&ctx_, &req_, &responder_, cq_, cq_, this);
-        }
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::RELEASE_SNAPSHOT; }
 
         void Proceed() override {
             if (call_status_ == CallStatus::PROCESS) {
-                new PutCall(service_, cq_, db_);
-                auto rocksdb_status = db_->Put(rocksdb::WriteOptions(), req_.kv().key(), req_.kv().value());
-                call_status_ = CallStatus::FINISH;
-                responder_.Finish(resp_, wrapStatus(rocksdb_status, resp_.mutable_status()), this);
+                spawn<ReleaseSnapshotCall>();
+                releaseSnapshot(env_, *req_, resp_);
+                finish(grpc::Status::OK);
             } else {
                 GPR_ASSERT(call_status_ == CallStatus::FINISH);
-                delete this;
+                release();
             }
         }
 
-    private:
-        PutReq req_;
-        PutResp resp_;
-        grpc::ServerAsyncResponseWriter<PutResp> responder_;
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestReleaseSnapshot(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
     };
 
-
-    class DeleteCall : public Call {
+    class StatsCall : public UnaryCall<StatsReq, StatsResp> {
     public:
-        DeleteCall(KVStore::AsyncService *service,
-                   grpc::ServerCompletionQueue *cq,
-                   rocksdb::DB *db) :
-                Call(service, cq, db), responder_(&ctx_) {
-            call_status_ = CallStatus::PROCESS;
-            service_->RequestDelete(&ctx_, &req_, &responder_, cq_, cq_, this);
-        }
+        using UnaryCall::UnaryCall;
+
+        RpcMethod method() const override { return RpcMethod::STATS; }
 
         void Proceed() override {
             if (call_status_ == CallStatus::PROCESS) {
-                new DeleteCall(service_, cq_, db_);
-                auto rocksdb_status = db_->Delete(rocksdb::WriteOptions(), req_.key());
-                call_status_ = CallStatus::FINISH;
-                responder_.Finish(resp_, wrapStatus(rocksdb_status, resp_.mutable_status()), this);
+                spawn<StatsCall>();
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                finish(grpc::Status::OK);
             } else {
                 GPR_ASSERT(call_status_ == CallStatus::FINISH);
-                delete this;
+                release();
             }
         }
 
-    private:
-        DeleteReq req_;
-        DeleteResp resp_;
-        grpc::ServerAsyncResponseWriter<DeleteResp> responder_;
+    protected:
+        void Request() override {
+            prepare();
+            service_->RequestStats(&*ctx_, req_, &*responder_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            fillStats(env_, *req_, resp_);
+        }
     };
 
+    // Streams the scan in packed blocks. While one block is being written the next one is
+    // already read from the iterator, the call moves on once both are done.
     class ScanCall : public Call {
     public:
-        ScanCall(KVStore::AsyncService *service,
-                 grpc::ServerCompletionQueue *cq,
-                 rocksdb::DB *db) :
-                Call(service, cq, db), writer_(&ctx_) {
+        using Call::Call;
+
+        RpcMethod method() const override { return RpcMethod::SCAN; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<ScanCall>();
+                bytes_in_ = req_->ByteSizeLong();
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                write();
+            } else if (call_status_ == CallStatus::FINISH) {
+                release();
+            }
+        }
+
+        // A failed write means the client is gone, the prefetch of the next block may still run
+        // on a worker, so the call is released once that is done too
+        void Proceed(bool ok) override {
+            if (call_status_ != CallStatus::WRITING) {
+                Call::Proceed(ok);
+                return;
+            }
+            broken_ |= !ok;
+            if (--pending_events_ == 0) {
+                if (broken_) {
+                    release();
+                } else {
+                    write();
+                }
+            }
+        }
+
+    protected:
+        void Request() override {
+            ctx_.emplace();
+            writer_.emplace(&*ctx_);
+            req_ = newMessage<ScanReq>();
+            writing_ = newMessage<ScanResp>();
+            next_ = newMessage<ScanResp>();
             call_status_ = CallStatus::PROCESS;
-            service_->RequestScan(&ctx_, &req_, &writer_, cq_, cq_, this);
+            service_->RequestScan(&*ctx_, req_, &*writer_, cq_, cq_, this);
+        }
+
+        void Clear() override {
+            cursor_.Close();
+            has_more_ = false;
+            pending_events_ = 0;
+            broken_ = false;
+            writer_.reset();
+            req_ = nullptr;
+            writing_ = nullptr;
+            next_ = nullptr;
+            Call::Clear();
         }
 
+        // Opens the cursor on the first call, then reads the next block into next_
+        void Storage() override {
+            if (!cursor_.is_open()) {
+                if (!cursor_.Open(env_->engines(), env_->snapshots.get(), *req_, next_->mutable_status())) {
+                    has_more_ = false;
+                    return;
+                }
+            }
+            has_more_ = cursor_.Fill(next_);
+        }
+
+    private:
+        ScanReq *req_{};
+        ScanResp *writing_{};
+        ScanResp *next_{};
+        std::optional<grpc::ServerAsyncWriter<ScanResp>> writer_;
+        ScanCursor cursor_;
+        bool has_more_{};
+        int pending_events_{};
+        bool broken_{};
+
+        // next_ holds a complete block and nothing is in flight
+        void write() {
+            if (next_->kvs_size() == 0 && !next_->has_status()) {
+                call_status_ = CallStatus::FINISH;
+                addTraceTrailer(&*ctx_);
+                traceMark("send");
+                writer_->Finish(grpc::Status::OK, this);
+                return;
+            }
+            std::swap(writing_, next_);
+            bytes_out_ += writing_->ByteSizeLong();
+            call_status_ = CallStatus::WRITING;
+            writer_->Write(*writing_, this);
+            if (!has_more_) {
+                next_->Clear();
+                pending_events_ = 1;
+            } else if (env_->workers != nullptr) {
+                // Completion of the write and the alarm of the prefetch both come back as events
+                pending_events_ = 2;
+                submit();
+            } else {
+                if (trace_ != nullptr) {
+                    trace_->Storage([this] { Storage(); });
+                } else {
+                    Storage();
+                }
+                pending_events_ = 1;
+            }
+        }
+    };
+
+    // Reads the client stream one message at a time. The kvs of every message are added to the
+    // loader in Storage(), so sorting and waiting for SST writers stays off the completion queue
+    // thread, and the next read is only issued after that. The end of the stream arrives as a
+    // failed read, then Storage() ingests the files and the response is sent.
+    class BulkLoadCall : public Call {
+    public:
+        using Call::Call;
+
+        RpcMethod method() const override { return RpcMethod::BULK_LOAD; }
+
         void Proceed() override {
+            Proceed(true);
+        }
+
+        void Proceed(bool ok) override {
             if (call_status_ == CallStatus::PROCESS) {
-                new ScanCall(service_, cq_, db_);
-                rest_size_ = req_.has_limit() ? req_.limit() : std::numeric_limits<size_t>::max();
-                it_ = db_->NewIterator(rocksdb::ReadOptions());
-                if (req_.has_start()) {
-                    it_->Seek(req_.start());
+                if (!ok) {
+                    release();
+                    return;
+                }
+                spawn<BulkLoadCall>();
+                if (!bulkLoadSupported(env_, resp_)) {
+                    call_status_ = CallStatus::FINISH;
+                    reader_->Finish(*resp_, grpc::Status::OK, this);
+                    return;
+                }
+                loader_ = newBulkLoader(env_);
+                read();
+            } else if (call_status_ == CallStatus::READING) {
+                ended_ = !ok;
+                call_status_ = CallStatus::RESPOND;
+                execute();
+            } else if (call_status_ == CallStatus::RESPOND) {
+                if (ended_) {
+                    call_status_ = CallStatus::FINISH;
+                    bytes_out_ = resp_->ByteSizeLong();
+                    addTraceTrailer(&*ctx_);
+                    traceMark("send");
+                    reader_->Finish(*resp_, grpc::Status::OK, this);
                 } else {
-                    it_->SeekToFirst();
+                    read();
                 }
-                call_status_ = CallStatus::WRITING;
-                write();
-            } else if (call_status_ == CallStatus::WRITING) {
-                write();
             } else if (call_status_ == CallStatus::FINISH) {
-                delete it_;
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            ctx_.emplace();
+            reader_.emplace(&*ctx_);
+            req_ = newMessage<BulkLoadReq>();
+            resp_ = newMessage<BulkLoadResp>();
+            call_status_ = CallStatus::PROCESS;
+            service_->RequestBulkLoad(&*ctx_, &*reader_, cq_, cq_, this);
+        }
+
+        void Clear() override {
+            loader_.reset();
+            ended_ = false;
+            reader_.reset();
+            req_ = nullptr;
+            resp_ = nullptr;
+            Call::Clear();
+        }
 
-                delete this;
+        void Storage() override {
+            if (ended_) {
+                finishBulkLoad(env_, loader_.get(), resp_);
+                return;
+            }
+            bytes_in_ += req_->ByteSizeLong();
+            for (auto &kv: req_->kvs()) {
+                loader_->Add(kv.key(), kv.value());
             }
         }
 
     private:
-        ScanReq req_;
-        grpc::ServerAsyncWriter<ScanResp> writer_;
-        size_t rest_size_{};
-        rocksdb::Iterator *it_{};
+        BulkLoadReq *req_{};
+        BulkLoadResp *resp_{};
+        std::optional<grpc::ServerAsyncReader<BulkLoadResp, BulkLoadReq>> reader_;
+        std::unique_ptr<BulkLoader> loader_;
+        bool ended_{};
 
-        void write() {
-            if (it_->Valid() && rest_size_ > 0) {
-                ScanResp resp;
-                CHECK(it_->status().ok()) << it_->status().ToString();
-                resp.mutable_kv()->mutable_key()->assign(it_->key().data(), it_->key().size());
-                resp.mutable_kv()->mutable_value()->assign(it_->value().data(), it_->value().size());
-                writer_.Write(resp, this);
-                it_->Next();
-                rest_size_--;
-            } else {
+        void read() {
+            req_->Clear();
+            call_status_ = CallStatus::READING;
+            reader_->Read(req_, this);
+        }
+    };
+
+    // Get/Put/Delete in the fixed-layout frames of raw_frame.h, received through the generic
+    // service so no protobuf message is parsed or built. Keys and values are views into the
+    // request frame and a large Get value is sent as a slice over the pinned block.
+    class RawCall : public Call {
+    public:
+        using Call::Call;
+
+        RpcMethod method() const override { return RpcMethod::RAW; }
+
+        void Proceed() override {
+            if (call_status_ == CallStatus::PROCESS) {
+                spawn<RawCall>();
+                if (generic_ctx_->method() != RAW_METHOD) {
+                    call_status_ = CallStatus::FINISH;
+                    stream_->Finish(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, generic_ctx_->method()), this);
+                    return;
+                }
+                call_status_ = CallStatus::READING;
+                stream_->Read(&request_, this);
+            } else if (call_status_ == CallStatus::READING) {
+                call_status_ = CallStatus::RESPOND;
+                if (!request_.TrySingleSlice(&request_slice_).ok()) {
+                    request_.DumpToSingleSlice(&request_slice_);
+                }
+                bytes_in_ = request_slice_.size();
+                if (!parseRawRequest(reinterpret_cast<const char *>(request_slice_.begin()), request_slice_.size(),
+                                     &req_)) {
+                    rocksdb_status_ = rocksdb::Status::InvalidArgument("Malformed raw request");
+                    Proceed();
+                    return;
+                }
+                if (req_.op != RawOp::GET && env_->read_only) {
+                    rocksdb_status_ = checkWritable(env_);
+                    Proceed();
+                    return;
+                }
+                auto *committer = req_.op == RawOp::GET ? nullptr : env_->shardOf(req_.key).committer.get();
+                if (committer != nullptr) {
+                    traceMark("group_commit");
+                    auto callback = [this](const rocksdb::Status &s) {
+                        invalidate(env_, key());
+                        rocksdb_status_ = s;
+                        notify();
+                    };
+                    if (req_.op == RawOp::PUT) {
+                        committer->Put(key(), std::string(req_.value), req_.durability, callback);
+                    } else {
+                        committer->Delete(key(), req_.durability, callback);
+                    }
+                } else {
+                    execute();
+                }
+            } else if (call_status_ == CallStatus::RESPOND) {
                 call_status_ = CallStatus::FINISH;
-                writer_.Finish(grpc::Status::OK, this);
+                auto buffer = response();
+
+                bytes_out_ = buffer.Length();
+                traceMark("send");
+                stream_->WriteAndFinish(buffer, grpc::WriteOptions(), grpc::Status::OK, this);
+            } else {
+                GPR_ASSERT(call_status_ == CallStatus::FINISH);
+                release();
+            }
+        }
+
+    protected:
+        void Request() override {
+            generic_ctx_.emplace();
+            stream_.emplace(&*generic_ctx_);
+            call_status_ = CallStatus::PROCESS;
+            pool_->generic_service()->RequestCall(&*generic_ctx_, &*stream_, cq_, cq_, this);
+        }
+
+        void Storage() override {
+            auto *engine = env_->shardOf(req_.key).engine.get();
+            rocksdb::Slice k(req_.key.data(), req_.key.size());
+
+            if (req_.op == RawOp::GET) {
+                rocksdb_status_ = env_->cache == nullptr ? engine->Get(rocksdb::ReadOptions(), k, &value_) :
+                                  getPinned(env_, key(), &value_);
+                return;
+            }
+            if (req_.op == RawOp::PUT) {
+                rocksdb_status_ = engine->Put(writeOptions(req_.durability), k,
+                                              rocksdb::Slice(req_.value.data(), req_.value.size()));
+            } else {
+                rocksdb_status_ = engine->Delete(writeOptions(req_.durability), k);
             }
+            if (env_->cache != nullptr) {
+                invalidate(env_, key());
+            }
+        }
+
+        void Clear() override {
+            stream_.reset();
+            generic_ctx_.reset();
+            request_.Clear();
+            request_slice_ = grpc::Slice();
+            key_.clear();
+            value_.Reset();
+            Call::Clear();
+        }
+
+    private:
+        std::optional<grpc::GenericServerContext> generic_ctx_;
+        std::optional<grpc::GenericServerAsyncReaderWriter> stream_;
+        grpc::ByteBuffer request_;
+        grpc::Slice request_slice_;
+        RawRequest req_{};
+        std::string key_;
+        rocksdb::Status rocksdb_status_;
+        rocksdb::PinnableSlice value_;
+
+        // The key as a string for the shard hash, the read cache and the committer, built once
+        const std::string &key() {
+            if (key_.empty() && !req_.key.empty()) {
+                key_.assign(req_.key.data(), req_.key.size());
+            }
+            return key_;
+        }
+
+        grpc::ByteBuffer response() {
+            if (!rocksdb_status_.ok()) {
+                auto code = rocksdb_status_.IsInvalidArgument() ? ErrorCode::CLIENT_ERROR : ErrorCode::SERVER_ERROR;
+                return frame(code, rocksdb_status_.ToString());
+            }
+            if (value_.size() < MIN_PINNED_VALUE_SIZE) {
+                return frame(ErrorCode::OK, std::string_view(value_.data(), value_.size()));
+            }
+            char header[RAW_RESPONSE_HEADER_SIZE];
+
+            encodeRawResponseHeader(ErrorCode::OK, value_.size(), header);
+            grpc::Slice slices[2] = {grpc::Slice(header, RAW_RESPONSE_HEADER_SIZE), pinnedSlice(&value_)};
+            return grpc::ByteBuffer(slices, 2);
+        }
+
+        // Response with the payload copied behind the header in one slice
+        static grpc::ByteBuffer frame(ErrorCode code, std::string_view payload) {
+            grpc::Slice slice(RAW_RESPONSE_HEADER_SIZE + payload.size());
+            auto *p = reinterpret_cast<char *>(const_cast<uint8_t *>(slice.begin()));
+
+            encodeRawResponseHeader(code, payload.size(), p);
+            memcpy(p + RAW_RESPONSE_HEADER_SIZE, payload.data(), payload.size());
+            return grpc::ByteBuffer(&slice, 1);
         }
     };
 
     class KVServer {
     public:
-        explicit KVServer(const std::string &db_file) {
-            db_ = createAndOpenDB(db_file.c_str());
+        // With more than one shard every shard is opened in db_file/shard-<i>, a key lives in
+        // the shard picked by its hash, so the number of shards of a DB can not change. The
+        // engine of the shards is picked by --engine
+        explicit KVServer(const std::string &db_file, int num_shards = 1) {
+            CHECK_GT(num_shards, 0);
+            if (num_shards == 1) {
+                env_.shards.emplace_back().engine = createEngine(db_file);
+            } else {
+                if (FLAGS_engine == "rocksdb") {
+                    checkShardLayout(db_file, num_shards);
+                }
+                for (int i = 0; i < num_shards; i++) {
+                    env_.shards.emplace_back().engine = createEngine(shardPath(db_file, i));
+                }
+                LOG(INFO) << "Opened " << num_shards << " shards in " << db_file;
+            }
+            env_.snapshots = std::make_unique<SnapshotRegistry>(env_.engines(), FLAGS_snapshot_ttl_sec);
         }
 
         virtual ~KVServer() = default;
@@ -292,55 +1804,236 @@ namespace kvstore {
         virtual void Start() = 0;
 
         virtual void Stop() {
-            if (db_ != nullptr) {
-                closeDB(db_);
+            stopStatsDump();
+            for (auto &shard: env_.shards) {
+                if (shard.committer != nullptr) {
+                    shard.committer->Stop();
+                }
+            }
+            if (env_.cache != nullptr) {
+                auto &cache = *env_.cache;
+                LOG(INFO) << "Read cache: " << cache.hits() << " hits, " << cache.misses() << " misses, "
+                          << cache.inserts() << " inserts, " << cache.evictions() << " evictions, usage: "
+                          << cache.usage() << " bytes";
+            }
+            if (!unix_socket_.empty()) {
+                unlink(unix_socket_.c_str());
+            }
+            // Snapshots not released by their clients would keep the DB from closing
+            env_.snapshots->Clear();
+            for (auto &shard: env_.shards) {
+                if (shard.engine != nullptr) {
+                    auto s = shard.engine->Close();
+                    CHECK(s.ok()) << s.ToString();
+                    shard.engine.reset();
+                }
+            }
+        }
+
+        // Coalesces concurrent Put/Delete requests into shared WriteBatches, call it before Start()
+        void EnableGroupCommit(int window_us, size_t max_batch_size) {
+            for (auto &shard: env_.shards) {
+                shard.committer = std::make_unique<GroupCommitter>(shard.engine.get(), window_us, max_batch_size);
+            }
+            LOG(INFO) << "Group commit is enabled, window: " << window_us << " us, max batch size: "
+                      << max_batch_size;
+        }
+
+        // Caches values of hot keys in front of the DB, call it before Start()
+        void EnableReadCache(size_t capacity_bytes, size_t num_shards) {
+            env_.cache = std::make_unique<ReadCache>(capacity_bytes, num_shards);
+            LOG(INFO) << "Read cache is enabled, capacity: " << capacity_bytes << " bytes, shards: " << num_shards;
+        }
+
+        // Follows primary as a read-only replica, call it before Start(). Every shard tails the
+        // WAL of the same shard of the primary, which must have the same number of shards
+        void ReplicateFrom(const std::string &primary) {
+            CHECK(!env_.dbs().empty()) << "Replication needs the rocksdb engine";
+            env_.read_only = true;
+            replicator_ = std::make_unique<Replicator>(primary, env_.dbs(), [this](const std::string &key) {
+                invalidate(&env_, key);
+            });
+        }
+
+        // Size of the kvs buffered per shard before a bulk load writes them to an SST file
+        void SetBulkLoadChunkBytes(size_t chunk_bytes) {
+            CHECK_GT(chunk_bytes, 0);
+            env_.bulk_load_chunk_bytes = chunk_bytes;
+        }
+
+        // Rewrites path with the Prometheus text of the Stats RPC every interval_sec, for the
+        // textfile collector of a node exporter. The file is replaced by a rename, so a scrape
+        // never reads half of it
+        void EnableStatsDump(const std::string &path, int interval_sec) {
+            CHECK_GT(interval_sec, 0);
+            stats_dump_ = std::thread([this, path, interval_sec]() {
+                std::unique_lock<std::mutex> lock(stats_dump_mutex_);
+
+                while (!stats_dump_cv_.wait_for(lock, std::chrono::seconds(interval_sec),
+                                                [this] { return stopped_; })) {
+                    StatsReq req;
+                    StatsResp resp;
+                    auto tmp = path + ".tmp";
+
+                    fillStats(&env_, req, &resp);
+                    std::ofstream(tmp) << formatPrometheus(resp);
+                    if (rename(tmp.c_str(), path.c_str()) != 0) {
+                        LOG(WARNING) << "Can not write stats to " << path;
+                    }
+                }
+            });
+            LOG(INFO) << "Dumping stats to " << path << " every " << interval_sec << " s";
+        }
+
+        ServerEnv *get_env() {
+            return &env_;
+        }
+
+        // Channel that reaches the server without a socket, waits until Start() has built it. A
+        // server with an empty addr is only reachable this way
+        std::shared_ptr<grpc::Channel> InProcessChannel() {
+            std::unique_lock<std::mutex> lock(running_mutex_);
+
+            running_cv_.wait(lock, [this] { return running_ != nullptr; });
+            return running_->InProcessChannel(grpc::ChannelArguments());
+        }
+
+    protected:
+        // Listens on addr and, with --unix_socket, on the unix socket of its port, which clients
+        // on this host prefer. An empty addr listens nowhere
+        void addListeningPorts(grpc::ServerBuilder *builder, const std::string &addr) {
+            if (addr.empty()) {
+                return;
+            }
+            auto port = endpointPort(addr);
+
+            builder->AddListeningPort(addr, grpc::InsecureServerCredentials());
+            if (FLAGS_unix_socket && !port.empty() && port != "0") {
+                unix_socket_ = unixSocketPath(port);
+                builder->AddListeningPort("unix:" + unix_socket_, grpc::InsecureServerCredentials());
+                LOG(INFO) << "Local clients connect to unix:" << unix_socket_;
+            }
+        }
+
+        void started(grpc::Server *server) {
+            {
+                std::lock_guard<std::mutex> lock(running_mutex_);
+                running_ = server;
+            }
+            running_cv_.notify_all();
+        }
+
+        // Service of the KVReplication RPCs every server registers, starts following the
+        // primary on a replica
+        grpc::Service *startReplication() {
+            replication_service_ = std::make_unique<ReplicationServiceImpl>(env_.dbs(), replicator_.get());
+            if (replicator_ != nullptr) {
+                replicator_->Start();
             }
+            return replication_service_.get();
         }
 
-        rocksdb::DB *get_db() {
-            return db_;
+        // Ends the Replicate streams of replicas, which would keep the server from shutting down,
+        // and stops following the primary
+        void stopReplication() {
+            if (replication_service_ != nullptr) {
+                replication_service_->Stop();
+            }
+            if (replicator_ != nullptr) {
+                replicator_->Stop();
+            }
         }
 
     private:
-        rocksdb::DB *db_{};
+        ServerEnv env_;
+        std::unique_ptr<Replicator> replicator_;
+        std::unique_ptr<ReplicationServiceImpl> replication_service_;
+        std::thread stats_dump_;
+        std::mutex stats_dump_mutex_;
+        std::condition_variable stats_dump_cv_;
+        bool stopped_{};
+        grpc::Server *running_{};
+        std::mutex running_mutex_;
+        std::condition_variable running_cv_;
+        std::string unix_socket_;
+
+        void stopStatsDump() {
+            {
+                std::lock_guard<std::mutex> lock(stats_dump_mutex_);
+                stopped_ = true;
+            }
+            stats_dump_cv_.notify_all();
+            if (stats_dump_.joinable()) {
+                stats_dump_.join();
+            }
+        }
+
+        static std::unique_ptr<StorageEngine> createEngine(const std::string &path) {
+            if (FLAGS_engine == "memory") {
+                return std::make_unique<MemoryEngine>();
+            }
+            CHECK_EQ(FLAGS_engine, "rocksdb") << "Unknown engine " << FLAGS_engine;
+            return std::make_unique<RocksDBEngine>(createAndOpenDB(path));
+        }
 
-        static rocksdb::DB *createAndOpenDB(const char *path) {
+        static rocksdb::DB *createAndOpenDB(const std::string &path) {
             rocksdb::DB *db;
             rocksdb::Options options;
             options.create_if_missing = true;
+            // Replicas tail the WAL, keep it for them after it is no longer needed for recovery
+            options.WAL_ttl_seconds = FLAGS_wal_ttl_sec;
+            if (FLAGS_rocksdb_statistics) {
+                options.statistics = rocksdb::CreateDBStatistics();
+            }
             rocksdb::Status status = rocksdb::DB::Open(options, path, &db);
-            CHECK(status.ok());
+            CHECK(status.ok()) << status.ToString();
             return db;
         }
 
-        static void closeDB(rocksdb::DB *db) {
-            auto s = db->Close();
-            CHECK(s.ok()) << s.ToString();
-            delete db;
+        static std::string shardPath(const std::string &db_file, int shard) {
+            return db_file + "/shard-" + std::to_string(shard);
+        }
+
+        // Refuses to open a sharded DB with a different number of shards than it was created with
+        static void checkShardLayout(const std::string &db_file, int num_shards) {
+            auto *rocks_env = rocksdb::Env::Default();
+            int existing = 0;
+
+            CHECK(rocks_env->CreateDirIfMissing(db_file).ok()) << "Can not create " << db_file;
+            for (int i = 0; i < num_shards; i++) {
+                existing += rocks_env->FileExists(shardPath(db_file, i) + "/CURRENT").ok();
+            }
+            CHECK(existing == 0 || existing == num_shards) << db_file << " has " << existing
+                                                           << " of the requested " << num_shards << " shards";
+            CHECK(rocks_env->FileExists(shardPath(db_file, num_shards) + "/CURRENT").IsNotFound())
+                << db_file << " has more than the requested " << num_shards << " shards";
         }
     };
 
     class KVServerSync : public KVServer {
     public:
-        KVServerSync(const std::string &db_file, std::string addr) :
-                KVServer(db_file),
+        KVServerSync(const std::string &db_file, std::string addr, int num_shards = 1) :
+                KVServer(db_file, num_shards),
                 addr_(std::move(addr)) {
 
         }
 
         void Start() override {
-            sync_service_ = std::make_unique<KVStoreServiceImpl>(get_db());
+            sync_service_ = std::make_unique<KVStoreServiceImpl>(get_env());
             grpc::EnableDefaultHealthCheckService(true);
             grpc::reflection::InitProtoReflectionServerBuilderPlugin();
             grpc::ServerBuilder builder;
-            builder.AddListeningPort(addr_, grpc::InsecureServerCredentials());
+            addListeningPorts(&builder, addr_);
             builder.RegisterService(sync_service_.get());
+            builder.RegisterService(startReplication());
             server_ = builder.BuildAndStart();
+            started(server_.get());
             LOG(INFO) << "Sync Server is listening on " << addr_;
             server_->Wait();
         }
 
         void Stop() override {
+            stopReplication();
             server_->Shutdown();
             KVServer::Stop();
         }
@@ -351,13 +2044,48 @@ namespace kvstore {
         std::unique_ptr<grpc::Server> server_;
     };
 
+    class KVServerCallback : public KVServer {
+    public:
+        KVServerCallback(const std::string &db_file, std::string addr, int num_shards = 1) :
+                KVServer(db_file, num_shards),
+                addr_(std::move(addr)) {
+
+        }
+
+        void Start() override {
+            callback_service_ = std::make_unique<KVStoreCallbackServiceImpl>(get_env());
+            grpc::EnableDefaultHealthCheckService(true);
+            grpc::reflection::InitProtoReflectionServerBuilderPlugin();
+            grpc::ServerBuilder builder;
+            addListeningPorts(&builder, addr_);
+            builder.RegisterService(callback_service_.get());
+            builder.RegisterService(startReplication());
+            server_ = builder.BuildAndStart();
+            started(server_.get());
+            LOG(INFO) << "Callback Server is listening on " << addr_;
+            server_->Wait();
+        }
+
+        void Stop() override {
+            stopReplication();
+            server_->Shutdown();
+            KVServer::Stop();
+        }
+
+    private:
+        std::string addr_;
+        std::unique_ptr<KVStoreCallbackServiceImpl> callback_service_;
+        std::unique_ptr<grpc::Server> server_;
+    };
+
     class KVServerAsync : public KVServer {
     public:
         KVServerAsync(const std::string &db_file, std::string addr,
-                      int num_thread) :
-                KVServer(db_file),
+                      int num_thread, int num_io_thread = 0, int num_shards = 1) :
+                KVServer(db_file, num_shards),
                 addr_(std::move(addr)),
-                num_thread_(num_thread) {
+                num_thread_(num_thread),
+                num_io_thread_(num_io_thread) {
 
         }
 
@@ -366,54 +2094,130 @@ namespace kvstore {
             grpc::reflection::InitProtoReflectionServerBuilderPlugin();
             grpc::ServerBuilder builder;
             builder.SetOption(grpc::MakeChannelArgumentOption(GRPC_ARG_ALLOW_REUSEPORT, 0));
-            builder.AddListeningPort(addr_, grpc::InsecureServerCredentials());
+            addListeningPorts(&builder, addr_);
             builder.RegisterService(&service_);
+            builder.RegisterService(startReplication());
+            if (raw_service_) {
+                builder.RegisterAsyncGenericService(&generic_service_);
+            }
             for (int i = 0; i < num_thread_; i++) {
                 cqs_.emplace_back(builder.AddCompletionQueue());
             }
-            LOG(INFO) << "Async Server is listening on " << addr_ << " Serving thread: " << num_thread_;
+            LOG(INFO) << "Async Server is listening on " << addr_ << " Serving thread: " << num_thread_
+                      << " Storage thread: " << num_io_thread_;
+            if (raw_service_) {
+                LOG(INFO) << "Raw service is enabled on " << RAW_METHOD;
+            }
+            LOG(INFO) << "Serving threads: " << cq_placement_.Describe(num_thread_);
+            if (num_io_thread_ > 0) {
+                LOG(INFO) << "Storage threads: " << io_placement_.Describe(num_io_thread_);
+            }
             server_ = builder.BuildAndStart();
-            auto *db = get_db();
+            auto *env = get_env();
+            if (num_io_thread_ > 0) {
+                env->workers = std::make_unique<WorkerPool>(num_io_thread_, io_placement_);
+            }
+            env->metrics.SetCompletionQueues(num_thread_);
             std::vector<std::thread> ths;
 
             for (int i = 0; i < num_thread_; i++) {
                 auto *cq = cqs_[i].get();
-                new GetCall(&service_, cq, db);
-                new PutCall(&service_, cq, db);
-                new DeleteCall(&service_, cq, db);
-                new ScanCall(&service_, cq, db);
-                new WarmupCall(&service_, cq, db);
+                auto *pool = pools_.emplace_back(
+                        std::make_unique<CallPool>(i, raw_service_ ? &generic_service_ : nullptr)).get();
+
+                pool->Spawn<GetCall>(&service_, cq, env);
+                pool->Spawn<PutCall>(&service_, cq, env);
+                pool->Spawn<DeleteCall>(&service_, cq, env);
+                pool->Spawn<ScanCall>(&service_, cq, env);
+                pool->Spawn<WarmupCall>(&service_, cq, env);
+                pool->Spawn<MultiGetCall>(&service_, cq, env);
+                pool->Spawn<MultiPutCall>(&service_, cq, env);
+                pool->Spawn<MultiDeleteCall>(&service_, cq, env);
+                pool->Spawn<ReleaseSnapshotCall>(&service_, cq, env);
+                pool->Spawn<BulkLoadCall>(&service_, cq, env);
+                pool->Spawn<StatsCall>(&service_, cq, env);
+                if (raw_service_) {
+                    pool->Spawn<RawCall>(&service_, cq, env);
+                }
 
-                ths.emplace_back([cq](int tid) {
+                ths.emplace_back([this, cq](int tid) {
                     void *tag;
+
+                    cq_placement_.Apply(tid);
                     bool ok;
                     while (cq->Next(&tag, &ok)) {
-                        if (ok) {
-                            static_cast<Call *>(tag)->Proceed();
-                        }
+                        static_cast<Call *>(tag)->Handle(ok);
                     }
                 }, i);
             }
+            started(server_.get());
             for (auto &th: ths) {
                 th.join();
             }
         }
 
+        // Pins serving thread i to cq's i-th cpu and storage worker i to io's i-th cpu, must be
+        // called before Start()
+        void SetThreadPlacement(ThreadPlacement cq, ThreadPlacement io) {
+            cq_placement_ = std::move(cq);
+            io_placement_ = std::move(io);
+        }
+
+        // Serves the raw frames of raw_frame.h on RAW_METHOD next to the KVStore service, must be
+        // called before Start()
+        void EnableRawService() {
+            raw_service_ = true;
+        }
+
+        // Traces one in sample_every calls of every serving thread to path, and every call whose
+        // client sends TRACE_METADATA_KEY, must be called before Start()
+        void EnableTracing(uint32_t sample_every, const std::string &path) {
+            get_env()->tracer = std::make_unique<Tracer>(sample_every, path);
+            LOG(INFO) << "Tracing is enabled, sampling 1 in " << sample_every << " calls"
+                      << (path.empty() ? "" : " to " + path);
+        }
+
         void Stop() override {
+            stopReplication();
             server_->Shutdown();
+            // Workers and the committer post finished calls to the completion queues, drain them first
+            if (get_env()->workers != nullptr) {
+                get_env()->workers->Stop();
+            }
+            for (auto &shard: get_env()->shards) {
+                if (shard.committer != nullptr) {
+                    shard.committer->Stop();
+                }
+            }
             for (auto &cq: cqs_) {
                 cq->Shutdown();
             }
+            StatsResp stats;
+            uint64_t allocated = 0, reused = 0;
+
+            get_env()->metrics.Fill(&stats);
+            for (int cq = 0; cq < stats.calls_allocated_size(); cq++) {
+                allocated += stats.calls_allocated(cq);
+                reused += stats.calls_reused(cq);
+            }
+            LOG(INFO) << "Call pool: " << allocated << " calls allocated, " << reused
+                      << " allocations avoided by reuse";
 
             KVServer::Stop();
         }
 
     private:
         std::string addr_;
-        KVStore::AsyncService service_;
+        AsyncKVService service_;
+        grpc::AsyncGenericService generic_service_;
+        bool raw_service_{};
         std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+        std::vector<std::unique_ptr<CallPool>> pools_;
         std::unique_ptr<grpc::Server> server_;
         int num_thread_;
+        int num_io_thread_;
+        ThreadPlacement cq_placement_;
+        ThreadPlacement io_placement_;
     };
 }
 #endif //GRPC_KVSTORE_KV_SERVER_H
@@ -38,17 +38,66 @@ int main(int argc, char *argv[]) {
     auto addr = FLAGS_addr + ":" + std::to_string(FLAGS_port);
     if (FLAGS_server) {
         if (FLAGS_async) {
-            server = std::make_unique<kvstore::KVServerAsync>(FLAGS_db_file, addr, FLAGS_thread);
+            kvstore::CpuTopology topology;
+            auto cq_placement = kvstore::ThreadPlacement::Parse(
+                    topology, FLAGS_cpus.empty() && FLAGS_thread == 0 ? "cores" : FLAGS_cpus, FLAGS_numa_bind);
+            int cq_threads = FLAGS_cq_threads > 0 ? FLAGS_cq_threads :
+                             FLAGS_thread > 0 ? FLAGS_thread : (int) cq_placement.size();
+            auto io_placement = FLAGS_io_cpus.empty() ? cq_placement.Skip(cq_threads) :
+                                kvstore::ThreadPlacement::Parse(topology, FLAGS_io_cpus, FLAGS_numa_bind);
+
+            LOG(INFO) << "Topology: " << topology.cpus().size() << " cpus, " << topology.num_cores()
+                      << " physical cores, " << topology.num_nodes() << " NUMA nodes";
+            auto async_server = std::make_unique<kvstore::KVServerAsync>(FLAGS_db_file, addr, cq_threads,
+                                                                         FLAGS_io_threads, FLAGS_shards);
+            async_server->SetThreadPlacement(cq_placement, io_placement);
+            if (FLAGS_raw) {
+                async_server->EnableRawService();
+            }
+            if (FLAGS_trace) {
+                async_server->EnableTracing(FLAGS_trace_sample, FLAGS_trace_file);
+            }
+            server = std::move(async_server);
+        } else if (FLAGS_callback) {
+            server = std::make_unique<kvstore::KVServerCallback>(FLAGS_db_file, addr, FLAGS_shards);
         } else {
-            server = std::make_unique<kvstore::KVServerSync>(FLAGS_db_file, addr);
+            server = std::make_unique<kvstore::KVServerSync>(FLAGS_db_file, addr, FLAGS_shards);
+        }
+        if (FLAGS_group_commit) {
+            server->EnableGroupCommit(FLAGS_group_commit_window_us, FLAGS_group_commit_max_batch);
+        }
+        if (FLAGS_read_cache_mb > 0) {
+            server->EnableReadCache((size_t) FLAGS_read_cache_mb * 1024 * 1024, FLAGS_read_cache_shards);
+        }
+        server->SetBulkLoadChunkBytes((size_t) FLAGS_bulk_load_chunk_mb * 1024 * 1024);
+        if (!FLAGS_replica_of.empty()) {
+            server->ReplicateFrom(FLAGS_replica_of);
+        }
+        if (!FLAGS_stats_file.empty()) {
+            server->EnableStatsDump(FLAGS_stats_file, FLAGS_stats_interval_sec);
         }
         signal(SIGTERM, signalHandler);
         server->Start();
     } else {
         auto cmd = FLAGS_cmd;
-        auto client = std::make_shared<kvstore::KVClient>(addr);
+        if (!FLAGS_endpoints.empty()) {
+            addr = FLAGS_endpoints;
+        } else {
+            CHECK_NE(FLAGS_addr, "0.0.0.0") << "give me a valid addr?";
+        }
+        std::shared_ptr<kvstore::KVClient> client;
+        if (FLAGS_raw) {
+            CHECK_EQ(kvstore::splitEndpoints(addr).size(), 1) << "The raw client needs a single server";
+            client = std::make_shared<kvstore::RawKVClient>(addr);
+        } else if (!FLAGS_replicas.empty()) {
+            CHECK_LE(FLAGS_pipeline_depth, 1) << "Pipelined requests can not go to replicas";
+            client = kvstore::BenchDriver::NewClient(addr, FLAGS_replicas);
+        } else {
+            client = kvstore::NewKVClient(addr);
+        }
         auto batch_size = FLAGS_batch_size;
-        CHECK_NE(FLAGS_addr, "0.0.0.0") << "give me a valid addr?";
+        CHECK(FLAGS_pipeline_depth <= 1 || kvstore::splitEndpoints(addr).size() == 1)
+            << "Pipelined requests need a single server";
         if (FLAGS_warmup) {
             LOG(INFO) << "Warming up";
             kvstore::Warmup(client, FLAGS_key_size, FLAGS_val_size, FLAGS_variable);
@@ -58,13 +107,55 @@ int main(int argc, char *argv[]) {
             LOG(INFO) << "Repeat: " << i;
 
             if (cmd == "put") {
-                kvstore::TestPut(client, FLAGS_key_size, FLAGS_val_size, batch_size, FLAGS_variable);
+                kvstore::TestPut(client, FLAGS_key_size, FLAGS_val_size, batch_size, FLAGS_variable,
+                                 FLAGS_pipeline_depth);
             } else if (cmd == "scan") {
-                kvstore::TestScan(client, batch_size);
+                kvstore::ScanOptions options;
+
+                options.end = FLAGS_scan_end;
+                options.reverse = FLAGS_scan_reverse;
+                options.keys_only = FLAGS_scan_keys_only;
+                options.max_block_bytes = FLAGS_scan_block_bytes;
+                kvstore::TestScan(client, batch_size, options);
             } else if (cmd == "get") {
-                kvstore::TestGet(client, batch_size);
+                kvstore::TestGet(client, batch_size, FLAGS_pipeline_depth);
+            } else if (cmd == "raw_get") {
+                kvstore::TestRawGet(client, batch_size);
+            } else if (cmd == "replication_status") {
+                kvstore::ShowReplicationStatus(client);
+            } else if (cmd == "trace_get") {
+                kvstore::TraceGet(client, batch_size);
+            } else if (cmd == "stats") {
+                kvstore::ShowStats(client, FLAGS_stats_prometheus);
             } else if (cmd == "delete") {
                 kvstore::TestDelete(client, batch_size);
+            } else if (cmd == "multi_get") {
+                kvstore::TestMultiGet(client, batch_size, FLAGS_multi_size);
+            } else if (cmd == "multi_put") {
+                kvstore::TestMultiPut(client, FLAGS_key_size, FLAGS_val_size, batch_size, FLAGS_variable,
+                                      FLAGS_multi_size);
+            } else if (cmd == "bulkload") {
+                kvstore::TestBulkLoad(client, FLAGS_key_size, FLAGS_val_size, batch_size, FLAGS_variable);
+            } else if (cmd == "multi_delete") {
+                kvstore::TestMultiDelete(client, batch_size, FLAGS_multi_size);
+            } else if (cmd == "bench" || cmd == "workload") {
+                kvstore::DriverOptions options;
+
+                options.addr = addr;
+                options.replicas = FLAGS_replicas;
+                options.threads = FLAGS_client_threads;
+                options.shared_channel = FLAGS_shared_channel;
+                options.duration_sec = FLAGS_duration;
+                options.num_ops = batch_size;
+                options.report_interval_ms = FLAGS_report_interval_ms;
+                options.output = FLAGS_bench_output;
+                if (cmd == "bench") {
+                    kvstore::TestClosedLoop(options, FLAGS_bench_op, FLAGS_key_size, FLAGS_val_size, batch_size,
+                                            FLAGS_variable, FLAGS_scan_length);
+                } else {
+                    kvstore::TestWorkload(options, FLAGS_phase, FLAGS_workload, FLAGS_workload_file,
+                                          FLAGS_workload_props, FLAGS_val_size, FLAGS_variable);
+                }
             } else if (cmd == "pingpong") {
                 kvstore::Warmup(client, FLAGS_big_kv_in_kb * 1024, FLAGS_big_k, FLAGS_big_v);
             } else {
@@ -0,0 +1,66 @@
+#ifndef GRPC_KVSTORE_LOCAL_ENDPOINT_H
+#define GRPC_KVSTORE_LOCAL_ENDPOINT_H
+
+#include <climits>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace kvstore {
+    // Unix domain socket a server listening on port also accepts connections on
+    inline std::string unixSocketPath(const std::string &port) {
+        return "/tmp/kvstore-" + port + ".sock";
+    }
+
+    // Port of "host:port", empty if there is none
+    inline std::string endpointPort(const std::string &endpoint) {
+        auto colon = endpoint.rfind(':');
+
+        return colon == std::string::npos ? "" : endpoint.substr(colon + 1);
+    }
+
+    // A server is listening on path, a socket file left by a server that died refuses the connect
+    inline bool acceptsConnections(const std::string &path) {
+        struct stat st{};
+        struct sockaddr_un addr{};
+
+        if (stat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode) || path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        bool ok = connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        return ok;
+    }
+
+    // Target to open a channel to endpoint with. A server on this host is reached over its unix
+    // socket, which skips the TCP stack of the loopback. Endpoints with a scheme are kept as
+    // they are, e.g. "ipv4:127.0.0.1:12345" forces TCP
+    inline std::string localEndpoint(const std::string &endpoint) {
+        auto port = endpointPort(endpoint);
+
+        if (port.empty() || endpoint.find("://") != std::string::npos || endpoint.rfind("ipv4:", 0) == 0 ||
+            endpoint.rfind("ipv6:", 0) == 0 || endpoint.rfind("unix:", 0) == 0 || endpoint.rfind("dns:", 0) == 0) {
+            return endpoint;
+        }
+        auto host = endpoint.substr(0, endpoint.size() - port.size() - 1);
+        char hostname[HOST_NAME_MAX + 1] = {};
+
+        gethostname(hostname, sizeof(hostname) - 1);
+        if (host != "localhost" && host != "127.0.0.1" && host != "[::1]" && host != hostname) {
+            return endpoint;
+        }
+        auto path = unixSocketPath(port);
+        return acceptsConnections(path) ? "unix:" + path : endpoint;
+    }
+}
+
+#endif //GRPC_KVSTORE_LOCAL_ENDPOINT_H
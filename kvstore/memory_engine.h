@@ -0,0 +1,438 @@
+#ifndef GRPC_KVSTORE_MEMORY_ENGINE_H
+#define GRPC_KVSTORE_MEMORY_ENGINE_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "rocksdb/db.h"
+#include "rocksdb/write_batch.h"
+#include "storage_engine.h"
+
+namespace kvstore {
+    // Volatile engine for a cache tier: nothing is written to disk and everything is lost when
+    // the server stops. Keys live in a skiplist for ordered scans, with a hash index over it
+    // split into stripes for point lookups. Readers of the skiplist take no lock, writers that
+    // add a key are serialized, like in a RocksDB memtable. Each value is an immutable string
+    // swapped atomically, so a reader keeps the value it saw alive while a writer replaces it.
+    // A deleted key is unlinked from the skiplist and the index right away. Its node is freed
+    // once every iterator that could still stand on it is gone, so a long-lived scan cursor holds
+    // back the memory of the keys deleted after it was opened. Writes of a batch are applied one
+    // by one, readers can see part of a batch. Snapshots are not supported and the durability
+    // of writes is ignored.
+    class MemoryEngine : public StorageEngine {
+    public:
+        explicit MemoryEngine(size_t num_stripes = 64) :
+                head_(new Node("", MAX_HEIGHT)), num_stripes_(num_stripes), stripes_(new Stripe[num_stripes]) {}
+
+        MemoryEngine(const MemoryEngine &) = delete;
+
+        ~MemoryEngine() override {
+            auto *node = head_;
+
+            while (node != nullptr) {
+                auto *next = node->next[0].load(std::memory_order_relaxed);
+                delete node;
+                node = next;
+            }
+            for (auto &retired: retired_) {
+                delete retired.second;
+            }
+        }
+
+        using StorageEngine::Get;
+
+        rocksdb::Status Get(const rocksdb::ReadOptions &options, const rocksdb::Slice &key,
+                            rocksdb::PinnableSlice *value) override {
+            Value v;
+            {
+                auto &stripe = stripeOf(key);
+                std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+                auto it = stripe.index.find(std::string_view(key.data(), key.size()));
+
+                if (it != stripe.index.end()) {
+                    v = std::atomic_load(&it->second->value);
+                }
+            }
+            if (v == nullptr) {
+                return rocksdb::Status::NotFound();
+            }
+            if (v->size() < MIN_PINNED_SIZE) {
+                value->PinSelf(*v);
+            } else {
+                // The slice keeps its own reference, a later write does not free the value under it
+                auto *pinned = new Value(std::move(v));
+
+                value->PinSlice(**pinned, [](void *arg, void *) { delete static_cast<Value *>(arg); }, pinned,
+                                nullptr);
+            }
+            return rocksdb::Status::OK();
+        }
+
+        rocksdb::Status Put(const rocksdb::WriteOptions &options, const rocksdb::Slice &key,
+                            const rocksdb::Slice &value) override {
+            store(key, std::make_shared<const std::string>(value.data(), value.size()));
+            return rocksdb::Status::OK();
+        }
+
+        rocksdb::Status Delete(const rocksdb::WriteOptions &options, const rocksdb::Slice &key) override {
+            store(key, nullptr);
+            return rocksdb::Status::OK();
+        }
+
+        rocksdb::Status Write(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *batch) override {
+            Applier applier(this);
+
+            return batch->Iterate(&applier);
+        }
+
+        rocksdb::Iterator *NewIterator(const rocksdb::ReadOptions &options) override {
+            return new Iterator(this, options);
+        }
+
+        const rocksdb::Snapshot *GetSnapshot() override {
+            return nullptr;
+        }
+
+        void ReleaseSnapshot(const rocksdb::Snapshot *snapshot) override {}
+
+        bool GetIntProperty(const std::string &property, uint64_t *value) override {
+            if (property == "rocksdb.estimate-num-keys") {
+                *value = live_keys_.load(std::memory_order_relaxed);
+                return true;
+            }
+            if (property == "rocksdb.cur-size-all-mem-tables") {
+                *value = bytes_.load(std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        rocksdb::Status Close() override {
+            return rocksdb::Status::OK();
+        }
+
+    private:
+        using Value = std::shared_ptr<const std::string>;
+
+        static constexpr int MAX_HEIGHT = 12;
+        static constexpr size_t MIN_PINNED_SIZE = 1024;
+
+        struct Node {
+            Node(std::string k, int height) : key(std::move(k)), next(height) {}
+
+            const std::string key;
+            // nullptr once deleted, only accessed with std::atomic_load and std::atomic_store
+            Value value;
+            std::vector<std::atomic<Node *>> next;
+        };
+
+        // Keys in the index are views of the node keys, an entry is erased before its node is unlinked
+        struct Stripe {
+            std::shared_mutex mutex;
+            std::unordered_map<std::string_view, Node *> index;
+        };
+
+        class Applier : public rocksdb::WriteBatch::Handler {
+        public:
+            explicit Applier(MemoryEngine *engine) : engine_(engine) {}
+
+            void Put(const rocksdb::Slice &key, const rocksdb::Slice &value) override {
+                engine_->Put(rocksdb::WriteOptions(), key, value);
+            }
+
+            void Delete(const rocksdb::Slice &key) override {
+                engine_->Delete(rocksdb::WriteOptions(), key);
+            }
+
+        private:
+            MemoryEngine *engine_;
+        };
+
+        // Skips deleted keys and stops at the bounds of the read options
+        class Iterator : public rocksdb::Iterator {
+        public:
+            Iterator(MemoryEngine *engine, const rocksdb::ReadOptions &options) :
+                    engine_(engine), epoch_(engine->enterEpoch()) {
+                if (options.iterate_lower_bound != nullptr) {
+                    lower_ = options.iterate_lower_bound->ToString();
+                }
+                if (options.iterate_upper_bound != nullptr) {
+                    upper_ = options.iterate_upper_bound->ToString();
+                }
+            }
+
+            ~Iterator() override {
+                engine_->exitEpoch(epoch_);
+            }
+
+            bool Valid() const override {
+                return node_ != nullptr;
+            }
+
+            void SeekToFirst() override {
+                node_ = lower_ ? engine_->findGreaterOrEqual(*lower_, nullptr) : engine_->first();
+                skipForward();
+            }
+
+            void SeekToLast() override {
+                node_ = upper_ ? engine_->findLessThan(*upper_) : engine_->last();
+                skipBackward();
+            }
+
+            void Seek(const rocksdb::Slice &target) override {
+                if (lower_ && target.compare(*lower_) < 0) {
+                    SeekToFirst();
+                    return;
+                }
+                node_ = engine_->findGreaterOrEqual(target, nullptr);
+                skipForward();
+            }
+
+            void SeekForPrev(const rocksdb::Slice &target) override {
+                if (upper_ && target.compare(*upper_) >= 0) {
+                    SeekToLast();
+                    return;
+                }
+                node_ = engine_->findGreaterOrEqual(target, nullptr);
+                if (node_ == nullptr || target.compare(node_->key) != 0) {
+                    node_ = engine_->findLessThan(target);
+                }
+                skipBackward();
+            }
+
+            void Next() override {
+                node_ = node_->next[0].load(std::memory_order_acquire);
+                skipForward();
+            }
+
+            void Prev() override {
+                node_ = engine_->findLessThan(node_->key);
+                skipBackward();
+            }
+
+            rocksdb::Slice key() const override {
+                return node_->key;
+            }
+
+            rocksdb::Slice value() const override {
+                return *value_;
+            }
+
+            rocksdb::Status status() const override {
+                return rocksdb::Status::OK();
+            }
+
+        private:
+            MemoryEngine *engine_;
+            // Nodes unlinked in this epoch or later are not freed while the iterator lives
+            uint64_t epoch_;
+            std::optional<std::string> lower_;
+            std::optional<std::string> upper_;
+            Node *node_{};
+            // Value of node_ when the iterator reached it
+            Value value_;
+
+            void skipForward() {
+                while (node_ != nullptr && (value_ = std::atomic_load(&node_->value)) == nullptr) {
+                    node_ = node_->next[0].load(std::memory_order_acquire);
+                }
+                if (node_ != nullptr && upper_ && rocksdb::Slice(node_->key).compare(*upper_) >= 0) {
+                    node_ = nullptr;
+                }
+            }
+
+            void skipBackward() {
+                while (node_ != nullptr && (value_ = std::atomic_load(&node_->value)) == nullptr) {
+                    node_ = engine_->findLessThan(node_->key);
+                }
+                if (node_ != nullptr && lower_ && rocksdb::Slice(node_->key).compare(*lower_) < 0) {
+                    node_ = nullptr;
+                }
+            }
+        };
+
+        Node *head_;
+        std::atomic_int height_{1};
+        // Serializes adding nodes to the skiplist, taken after the lock of a stripe
+        std::mutex insert_mutex_;
+        std::minstd_rand random_;
+        size_t num_stripes_;
+        std::unique_ptr<Stripe[]> stripes_;
+        std::atomic_size_t live_keys_{0};
+        std::atomic_size_t bytes_{0};
+        // Iterators walk the skiplist without a lock, an unlinked node is freed once no iterator
+        // of its epoch or an earlier one remains
+        std::mutex epoch_mutex_;
+        uint64_t epoch_{};
+        // Number of live iterators per epoch they entered in
+        std::map<uint64_t, size_t> readers_;
+        // Unlinked nodes with the epoch they were unlinked in, oldest first
+        std::deque<std::pair<uint64_t, Node *>> retired_;
+
+        Stripe &stripeOf(const rocksdb::Slice &key) {
+            return stripes_[std::hash<std::string_view>()(std::string_view(key.data(), key.size())) % num_stripes_];
+        }
+
+        void store(const rocksdb::Slice &key, Value value) {
+            auto &stripe = stripeOf(key);
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            auto it = stripe.index.find(std::string_view(key.data(), key.size()));
+            Node *node;
+
+            if (it != stripe.index.end()) {
+                node = it->second;
+            } else if (value == nullptr) {
+                return;
+            } else {
+                node = insert(key);
+                stripe.index.emplace(node->key, node);
+                bytes_.fetch_add(key.size(), std::memory_order_relaxed);
+            }
+            bool live = value != nullptr;
+            size_t size = live ? value->size() : 0;
+            auto old = std::atomic_exchange(&node->value, std::move(value));
+
+            if (old == nullptr && live) {
+                live_keys_.fetch_add(1, std::memory_order_relaxed);
+            } else if (old != nullptr && !live) {
+                live_keys_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            bytes_.fetch_add(size - (old == nullptr ? 0 : old->size()), std::memory_order_relaxed);
+            if (!live) {
+                // Get takes the stripe lock, so only iterators can still reach the node
+                stripe.index.erase(node->key);
+                unlink(node);
+                bytes_.fetch_sub(node->key.size(), std::memory_order_relaxed);
+                retire(node);
+            }
+        }
+
+        // Removes node from every level, it keeps its next pointers for iterators standing on it
+        void unlink(Node *node) {
+            std::lock_guard<std::mutex> lock(insert_mutex_);
+            Node *prev[MAX_HEIGHT];
+
+            findGreaterOrEqual(node->key, prev);
+            for (size_t i = 0; i < node->next.size(); i++) {
+                prev[i]->next[i].store(node->next[i].load(std::memory_order_relaxed), std::memory_order_release);
+            }
+        }
+
+        uint64_t enterEpoch() {
+            std::lock_guard<std::mutex> lock(epoch_mutex_);
+
+            readers_[epoch_]++;
+            return epoch_;
+        }
+
+        void exitEpoch(uint64_t epoch) {
+            std::lock_guard<std::mutex> lock(epoch_mutex_);
+            auto it = readers_.find(epoch);
+
+            if (--it->second == 0) {
+                readers_.erase(it);
+            }
+            reclaim();
+        }
+
+        // Iterators entering after this can not reach node, it was unlinked before
+        void retire(Node *node) {
+            std::lock_guard<std::mutex> lock(epoch_mutex_);
+
+            retired_.emplace_back(epoch_++, node);
+            reclaim();
+        }
+
+        // Frees the nodes unlinked before the oldest live iterator entered, epoch_mutex_ is held
+        void reclaim() {
+            uint64_t oldest = readers_.empty() ? epoch_ : readers_.begin()->first;
+
+            while (!retired_.empty() && retired_.front().first < oldest) {
+                delete retired_.front().second;
+                retired_.pop_front();
+            }
+        }
+
+        // Adds a node without a value, the key must not be in the skiplist yet
+        Node *insert(const rocksdb::Slice &key) {
+            std::lock_guard<std::mutex> lock(insert_mutex_);
+            Node *prev[MAX_HEIGHT];
+            int height = 1;
+
+            findGreaterOrEqual(key, prev);
+            while (height < MAX_HEIGHT && random_() % 4 == 0) {
+                height++;
+            }
+            if (height > height_.load(std::memory_order_relaxed)) {
+                for (int i = height_.load(std::memory_order_relaxed); i < height; i++) {
+                    prev[i] = head_;
+                }
+                height_.store(height, std::memory_order_relaxed);
+            }
+            auto *node = new Node(key.ToString(), height);
+            for (int i = 0; i < height; i++) {
+                node->next[i].store(prev[i]->next[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                prev[i]->next[i].store(node, std::memory_order_release);
+            }
+            return node;
+        }
+
+        // First node with a key >= key, nullptr if none. Fills prev with the last node before it
+        // on every level if given
+        Node *findGreaterOrEqual(const rocksdb::Slice &key, Node **prev) const {
+            auto *node = head_;
+            int level = height_.load(std::memory_order_relaxed) - 1;
+
+            while (true) {
+                auto *next = node->next[level].load(std::memory_order_acquire);
+
+                if (next != nullptr && rocksdb::Slice(next->key).compare(key) < 0) {
+                    node = next;
+                } else {
+                    if (prev != nullptr) {
+                        prev[level] = node;
+                    }
+                    if (level == 0) {
+                        return next;
+                    }
+                    level--;
+                }
+            }
+        }
+
+        // Last node with a key < key, nullptr if none
+        Node *findLessThan(const rocksdb::Slice &key) const {
+            Node *prev[MAX_HEIGHT];
+
+            findGreaterOrEqual(key, prev);
+            return prev[0] == head_ ? nullptr : prev[0];
+        }
+
+        Node *first() const {
+            return head_->next[0].load(std::memory_order_acquire);
+        }
+
+        Node *last() const {
+            auto *node = head_;
+
+            for (int level = height_.load(std::memory_order_relaxed) - 1; level >= 0; level--) {
+                Node *next;
+                while ((next = node->next[level].load(std::memory_order_acquire)) != nullptr) {
+                    node = next;
+                }
+            }
+            return node == head_ ? nullptr : node;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_MEMORY_ENGINE_H
@@ -0,0 +1,328 @@
+#ifndef GRPC_KVSTORE_METRICS_H
+#define GRPC_KVSTORE_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "histogram.h"
+#include "kvstore.pb.h"
+
+namespace kvstore {
+    enum class RpcMethod {
+        GET, SCAN, PUT, DELETE, WARMUP, MULTI_GET, MULTI_PUT, MULTI_DELETE, RELEASE_SNAPSHOT, BULK_LOAD, STATS,
+        RAW, COUNT
+    };
+
+    const char *const RPC_METHOD_NAMES[] = {
+            "Get", "Scan", "Put", "Delete", "Warmup", "MultiGet", "MultiPut", "MultiDelete", "ReleaseSnapshot",
+            "BulkLoad", "Stats", "Raw"
+    };
+
+    // User plus system CPU time of this process in microseconds
+    inline double cpuMicros() {
+        rusage usage{};
+
+        getrusage(RUSAGE_SELF, &usage);
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    inline uint64_t steadyNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Histogram with one writer and any number of readers. The writer updates the relaxed
+    // atomics with plain loads and stores, so recording costs no more than in a Histogram,
+    // and a reader sees every bucket at some recent value.
+    class AtomicHistogram {
+    public:
+        AtomicHistogram() : counts_(new std::atomic_uint64_t[Histogram::BUCKET_COUNT]()) {}
+
+        void Record(uint64_t value) {
+            auto &count = counts_[Histogram::BucketOf(value)];
+
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            if (value < min_.load(std::memory_order_relaxed)) {
+                min_.store(value, std::memory_order_relaxed);
+            }
+            if (value > max_.load(std::memory_order_relaxed)) {
+                max_.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        void AddTo(Histogram *histogram) const {
+            std::vector<uint64_t> counts(Histogram::BUCKET_COUNT);
+
+            for (size_t i = 0; i < counts.size(); i++) {
+                counts[i] = counts_[i].load(std::memory_order_relaxed);
+            }
+            histogram->MergeCounts(counts, sum_.load(std::memory_order_relaxed), min_.load(std::memory_order_relaxed),
+                                   max_.load(std::memory_order_relaxed));
+        }
+
+    private:
+        std::unique_ptr<std::atomic_uint64_t[]> counts_;
+        std::atomic_uint64_t sum_{0};
+        std::atomic_uint64_t min_{std::numeric_limits<uint64_t>::max()};
+        std::atomic_uint64_t max_{0};
+    };
+
+    // Per-RPC latency and traffic of a server. Every thread records into histograms of its own,
+    // registered on its first RPC, so recording takes no lock and shares no cache line with
+    // other threads. A thread that exits folds its histograms into the retired ones, so the
+    // short-lived threads of gRPC's thread pools do not pile up. Fill() merges all of them.
+    class ServerMetrics {
+    public:
+        ServerMetrics() : start_ns_(steadyNanos()), registry_(std::make_shared<Registry>()) {}
+
+        ServerMetrics(const ServerMetrics &) = delete;
+
+        void Record(RpcMethod method, uint64_t latency_ns, uint64_t bytes_in, uint64_t bytes_out) {
+            auto &local = threadMetrics();
+
+            local.latency[(size_t) method].Record(latency_ns);
+            local.bytes_in.store(local.bytes_in.load(std::memory_order_relaxed) + bytes_in,
+                                 std::memory_order_relaxed);
+            local.bytes_out.store(local.bytes_out.load(std::memory_order_relaxed) + bytes_out,
+                                  std::memory_order_relaxed);
+        }
+
+        // Gauges of calls in progress and call pool counters, one per completion queue, call it
+        // before the queues serve
+        void SetCompletionQueues(size_t num_cqs) {
+            num_cqs_ = num_cqs;
+            in_flight_.reset(new std::atomic_int64_t[num_cqs]());
+            calls_allocated_.reset(new std::atomic_uint64_t[num_cqs]());
+            calls_reused_.reset(new std::atomic_uint64_t[num_cqs]());
+        }
+
+        void CallAllocated(size_t cq) {
+            calls_allocated_[cq].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void CallReused(size_t cq) {
+            calls_reused_[cq].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Enter(size_t cq) {
+            in_flight_[cq].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Leave(size_t cq) {
+            in_flight_[cq].fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void Fill(StatsResp *resp) {
+            std::vector<Histogram> merged((size_t) RpcMethod::COUNT);
+            uint64_t bytes_in = 0, bytes_out = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(registry_->mutex);
+
+                for (size_t m = 0; m < merged.size(); m++) {
+                    merged[m].Merge(registry_->retired_latency[m]);
+                }
+                bytes_in = registry_->retired_bytes_in;
+                bytes_out = registry_->retired_bytes_out;
+                for (auto &local: registry_->threads) {
+                    for (size_t m = 0; m < merged.size(); m++) {
+                        local->latency[m].AddTo(&merged[m]);
+                    }
+                    bytes_in += local->bytes_in.load(std::memory_order_relaxed);
+                    bytes_out += local->bytes_out.load(std::memory_order_relaxed);
+                }
+            }
+            for (size_t m = 0; m < merged.size(); m++) {
+                auto &histogram = merged[m];
+
+                if (histogram.count() == 0) {
+                    continue;
+                }
+                auto *latency = resp->add_latencies();
+                latency->set_method(RPC_METHOD_NAMES[m]);
+                latency->set_count(histogram.count());
+                latency->set_mean_us(histogram.mean() / 1000);
+                latency->set_p50_us(histogram.Percentile(50) / 1000.0);
+                latency->set_p99_us(histogram.Percentile(99) / 1000.0);
+                latency->set_p999_us(histogram.Percentile(99.9) / 1000.0);
+                latency->set_max_us(histogram.max() / 1000.0);
+            }
+            for (size_t cq = 0; cq < num_cqs_; cq++) {
+                resp->add_in_flight(in_flight_[cq].load(std::memory_order_relaxed));
+                resp->add_calls_allocated(calls_allocated_[cq].load(std::memory_order_relaxed));
+                resp->add_calls_reused(calls_reused_[cq].load(std::memory_order_relaxed));
+            }
+            resp->set_bytes_in(bytes_in);
+            resp->set_bytes_out(bytes_out);
+            resp->set_uptime_sec((steadyNanos() - start_ns_) / 1e9);
+            resp->set_cpu_sec(cpuMicros() / 1e6);
+        }
+
+    private:
+        struct ThreadMetrics {
+            AtomicHistogram latency[(size_t) RpcMethod::COUNT];
+            std::atomic_uint64_t bytes_in{0};
+            std::atomic_uint64_t bytes_out{0};
+        };
+
+        // Metrics of the live threads and what the exited ones left. Threads hold a reference,
+        // so it outlives the ServerMetrics while a thread that recorded into it runs
+        struct Registry {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ThreadMetrics>> threads;
+            std::vector<Histogram> retired_latency = std::vector<Histogram>((size_t) RpcMethod::COUNT);
+            uint64_t retired_bytes_in{};
+            uint64_t retired_bytes_out{};
+
+            void Retire(ThreadMetrics *local) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (size_t m = 0; m < retired_latency.size(); m++) {
+                    local->latency[m].AddTo(&retired_latency[m]);
+                }
+                retired_bytes_in += local->bytes_in.load(std::memory_order_relaxed);
+                retired_bytes_out += local->bytes_out.load(std::memory_order_relaxed);
+                threads.erase(std::find_if(threads.begin(), threads.end(), [local](auto &t) {
+                    return t.get() == local;
+                }));
+            }
+        };
+
+        // Metrics the thread records into, retired when the thread exits or moves on to the
+        // metrics of another server
+        struct ThreadSlot {
+            std::shared_ptr<Registry> registry;
+            ThreadMetrics *metrics{};
+
+            ~ThreadSlot() {
+                if (registry != nullptr) {
+                    registry->Retire(metrics);
+                }
+            }
+        };
+
+        uint64_t start_ns_;
+        std::shared_ptr<Registry> registry_;
+        size_t num_cqs_{};
+        std::unique_ptr<std::atomic_int64_t[]> in_flight_;
+        std::unique_ptr<std::atomic_uint64_t[]> calls_allocated_;
+        std::unique_ptr<std::atomic_uint64_t[]> calls_reused_;
+
+        ThreadMetrics &threadMetrics() {
+            thread_local ThreadSlot slot;
+
+            // The slot keeps its registry alive, a later one can not reuse the address
+            if (slot.registry != registry_) {
+                if (slot.registry != nullptr) {
+                    slot.registry->Retire(slot.metrics);
+                }
+                std::lock_guard<std::mutex> lock(registry_->mutex);
+
+                slot.registry = registry_;
+                slot.metrics = registry_->threads.emplace_back(std::make_unique<ThreadMetrics>()).get();
+            }
+            return *slot.metrics;
+        }
+    };
+
+    // Records one RPC when it goes out of scope
+    class RpcTimer {
+    public:
+        RpcTimer(ServerMetrics *metrics, RpcMethod method, uint64_t bytes_in = 0) :
+                metrics_(metrics), method_(method), start_ns_(steadyNanos()), bytes_in_(bytes_in) {}
+
+        RpcTimer(const RpcTimer &) = delete;
+
+        ~RpcTimer() {
+            metrics_->Record(method_, steadyNanos() - start_ns_, bytes_in_, bytes_out_);
+        }
+
+        void AddBytes(uint64_t bytes_in, uint64_t bytes_out) {
+            bytes_in_ += bytes_in;
+            bytes_out_ += bytes_out;
+        }
+
+    private:
+        ServerMetrics *metrics_;
+        RpcMethod method_;
+        uint64_t start_ns_;
+        uint64_t bytes_in_;
+        uint64_t bytes_out_{};
+    };
+
+    inline std::string prometheusName(const std::string &name) {
+        std::string sanitized = "kvstore_";
+
+        for (char c: name) {
+            sanitized += isalnum((unsigned char) c) ? c : '_';
+        }
+        return sanitized;
+    }
+
+    // Text exposition format, for a textfile collector or anything else that scrapes it
+    inline std::string formatPrometheus(const StatsResp &stats) {
+        std::stringstream ss;
+        std::map<std::string, std::vector<std::pair<int, uint64_t>>> properties, tickers;
+
+        ss << "# TYPE kvstore_rpc_latency_us summary\n";
+        for (auto &latency: stats.latencies()) {
+            auto label = "method=\"" + latency.method() + "\"";
+
+            ss << "kvstore_rpc_latency_us{" << label << ",quantile=\"0.5\"} " << latency.p50_us() << "\n";
+            ss << "kvstore_rpc_latency_us{" << label << ",quantile=\"0.99\"} " << latency.p99_us() << "\n";
+            ss << "kvstore_rpc_latency_us{" << label << ",quantile=\"0.999\"} " << latency.p999_us() << "\n";
+            ss << "kvstore_rpc_latency_us_sum{" << label << "} " << latency.mean_us() * latency.count() << "\n";
+            ss << "kvstore_rpc_latency_us_count{" << label << "} " << latency.count() << "\n";
+        }
+        ss << "# TYPE kvstore_rpc_latency_max_us gauge\n";
+        for (auto &latency: stats.latencies()) {
+            ss << "kvstore_rpc_latency_max_us{method=\"" << latency.method() << "\"} " << latency.max_us() << "\n";
+        }
+        ss << "# TYPE kvstore_in_flight gauge\n";
+        for (int cq = 0; cq < stats.in_flight_size(); cq++) {
+            ss << "kvstore_in_flight{cq=\"" << cq << "\"} " << stats.in_flight(cq) << "\n";
+        }
+        ss << "# TYPE kvstore_calls_allocated_total counter\n";
+        for (int cq = 0; cq < stats.calls_allocated_size(); cq++) {
+            ss << "kvstore_calls_allocated_total{cq=\"" << cq << "\"} " << stats.calls_allocated(cq) << "\n";
+        }
+        ss << "# TYPE kvstore_calls_reused_total counter\n";
+        for (int cq = 0; cq < stats.calls_reused_size(); cq++) {
+            ss << "kvstore_calls_reused_total{cq=\"" << cq << "\"} " << stats.calls_reused(cq) << "\n";
+        }
+        ss << "# TYPE kvstore_bytes_in_total counter\nkvstore_bytes_in_total " << stats.bytes_in() << "\n";
+        ss << "# TYPE kvstore_bytes_out_total counter\nkvstore_bytes_out_total " << stats.bytes_out() << "\n";
+        ss << "# TYPE kvstore_uptime_seconds gauge\nkvstore_uptime_seconds " << stats.uptime_sec() << "\n";
+        ss << "# TYPE kvstore_cpu_seconds_total counter\nkvstore_cpu_seconds_total " << stats.cpu_sec() << "\n";
+
+        for (int shard = 0; shard < stats.shards_size(); shard++) {
+            for (auto &property: stats.shards(shard).properties()) {
+                properties[prometheusName(property.first)].emplace_back(shard, property.second);
+            }
+            for (auto &ticker: stats.shards(shard).tickers()) {
+                tickers[prometheusName(ticker.first) + "_total"].emplace_back(shard, ticker.second);
+            }
+        }
+        for (auto *metrics: {&properties, &tickers}) {
+            for (auto &metric: *metrics) {
+                ss << "# TYPE " << metric.first << (metrics == &tickers ? " counter\n" : " gauge\n");
+                for (auto &value: metric.second) {
+                    ss << metric.first << "{shard=\"" << value.first << "\"} " << value.second << "\n";
+                }
+            }
+        }
+        return ss.str();
+    }
+}
+
+#endif //GRPC_KVSTORE_METRICS_H
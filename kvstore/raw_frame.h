@@ -0,0 +1,99 @@
+#ifndef GRPC_KVSTORE_RAW_FRAME_H
+#define GRPC_KVSTORE_RAW_FRAME_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "kvstore.pb.h"
+
+namespace kvstore {
+    // Method of the raw service, served by the async generic service next to KVStore
+    const char RAW_METHOD[] = "/kvstore.KVStoreRaw/Call";
+
+    // Fixed-layout frames of the raw service, integers are little endian.
+    // Request:  op (1) | durability (1) | key len (4) | value len (4) | key | value
+    // Response: error code (1) | payload len (4) | payload
+    // The payload of a response is the value of a Get or the message of an error.
+    const size_t RAW_REQUEST_HEADER_SIZE = 10;
+    const size_t RAW_RESPONSE_HEADER_SIZE = 5;
+
+    enum class RawOp : uint8_t {
+        GET = 1, PUT = 2, DELETE = 3
+    };
+
+    // Views into the frame it was parsed from
+    struct RawRequest {
+        RawOp op;
+        Durability durability;
+        std::string_view key;
+        std::string_view value;
+    };
+
+    inline void putUint32(char *p, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (char) (v >> (8 * i));
+        }
+    }
+
+    inline uint32_t getUint32(const char *p) {
+        uint32_t v = 0;
+
+        for (int i = 0; i < 4; i++) {
+            v |= (uint32_t) (uint8_t) p[i] << (8 * i);
+        }
+        return v;
+    }
+
+    inline void encodeRawRequest(RawOp op, Durability durability, std::string_view key, std::string_view value,
+                                 std::string *frame) {
+        frame->resize(RAW_REQUEST_HEADER_SIZE + key.size() + value.size());
+        char *p = &(*frame)[0];
+
+        p[0] = (char) op;
+        p[1] = (char) durability;
+        putUint32(p + 2, key.size());
+        putUint32(p + 6, value.size());
+        memcpy(p + RAW_REQUEST_HEADER_SIZE, key.data(), key.size());
+        memcpy(p + RAW_REQUEST_HEADER_SIZE + key.size(), value.data(), value.size());
+    }
+
+    // Returns false if the frame is truncated or malformed
+    inline bool parseRawRequest(const char *data, size_t size, RawRequest *req) {
+        if (size < RAW_REQUEST_HEADER_SIZE) {
+            return false;
+        }
+        auto op = (uint8_t) data[0];
+        auto durability = (uint8_t) data[1];
+        size_t key_len = getUint32(data + 2);
+        size_t value_len = getUint32(data + 6);
+
+        if (op < (uint8_t) RawOp::GET || op > (uint8_t) RawOp::DELETE || !Durability_IsValid(durability) ||
+            RAW_REQUEST_HEADER_SIZE + key_len + value_len != size) {
+            return false;
+        }
+        req->op = (RawOp) op;
+        req->durability = (Durability) durability;
+        req->key = std::string_view(data + RAW_REQUEST_HEADER_SIZE, key_len);
+        req->value = std::string_view(data + RAW_REQUEST_HEADER_SIZE + key_len, value_len);
+        return true;
+    }
+
+    inline void encodeRawResponseHeader(ErrorCode code, size_t payload_len, char *header) {
+        header[0] = (char) code;
+        putUint32(header + 1, payload_len);
+    }
+
+    // Returns false if the frame is truncated or malformed
+    inline bool parseRawResponse(const char *data, size_t size, ErrorCode *code, std::string_view *payload) {
+        if (size < RAW_RESPONSE_HEADER_SIZE || !ErrorCode_IsValid((uint8_t) data[0]) ||
+            RAW_RESPONSE_HEADER_SIZE + getUint32(data + 1) != size) {
+            return false;
+        }
+        *code = (ErrorCode) (uint8_t) data[0];
+        *payload = std::string_view(data + RAW_RESPONSE_HEADER_SIZE, size - RAW_RESPONSE_HEADER_SIZE);
+        return true;
+    }
+}
+
+#endif //GRPC_KVSTORE_RAW_FRAME_H
@@ -0,0 +1,86 @@
+#ifndef GRPC_KVSTORE_RAW_KV_CLIENT_H
+#define GRPC_KVSTORE_RAW_KV_CLIENT_H
+
+#include <grpcpp/generic/generic_stub.h>
+#include "kv_client.h"
+#include "raw_frame.h"
+
+namespace kvstore {
+    // KVClient sending Get/Put/Delete as raw frames to a server started with the raw service,
+    // the other operations go through the KVStore service as usual
+    class RawKVClient : public KVClient {
+    public:
+        explicit RawKVClient(const std::string &addr) : RawKVClient(createLocalChannel(addr, "Raw client")) {}
+
+        explicit RawKVClient(std::shared_ptr<grpc::Channel> channel) :
+                KVClient(channel), generic_stub_(channel) {}
+
+        Status Get(const std::string &key, std::string &value) override {
+            return call(RawOp::GET, Durability::DURABILITY_DEFAULT, key, "", &value);
+        }
+
+        Status Put(const std::string &key, const std::string &value,
+                   Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return call(RawOp::PUT, durability, key, value, nullptr);
+        }
+
+        Status Delete(const std::string &key, Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return call(RawOp::DELETE, durability, key, "", nullptr);
+        }
+
+    private:
+        grpc::GenericStub generic_stub_;
+
+        // Sends one frame and waits for the response, the payload of a successful Get goes to result
+        Status call(RawOp op, Durability durability, const std::string &key, const std::string &value,
+                    std::string *result) {
+            std::string frame;
+            Status status;
+
+            CHECK(key.size() <= 4 * 1024 * 1024);
+            CHECK(value.size() <= 4 * 1024 * 1024);
+            encodeRawRequest(op, durability, key, value, &frame);
+            grpc::Slice slice(frame);
+            grpc::ByteBuffer request(&slice, 1);
+            grpc::ClientContext cli_ctx;
+            grpc::CompletionQueue cq;
+            grpc::Status grpc_status;
+            grpc::ByteBuffer response;
+            void *tag;
+            bool ok;
+
+            cli_ctx.set_wait_for_ready(true);
+            auto reader = generic_stub_.PrepareUnaryCall(&cli_ctx, RAW_METHOD, request, &cq);
+            reader->StartCall();
+            reader->Finish(&response, &grpc_status, nullptr);
+            CHECK(cq.Next(&tag, &ok));
+            if (!grpc_status.ok()) {
+                status.set_error_code(ErrorCode::CLIENT_ERROR);
+                status.set_error_msg(grpc_status.error_message());
+                return status;
+            }
+
+            grpc::Slice response_slice;
+            if (!response.TrySingleSlice(&response_slice).ok()) {
+                response.DumpToSingleSlice(&response_slice);
+            }
+            ErrorCode code;
+            std::string_view payload;
+            if (!parseRawResponse(reinterpret_cast<const char *>(response_slice.begin()), response_slice.size(),
+                                  &code, &payload)) {
+                status.set_error_code(ErrorCode::CLIENT_ERROR);
+                status.set_error_msg("Malformed raw response");
+                return status;
+            }
+            status.set_error_code(code);
+            if (code != ErrorCode::OK) {
+                status.set_error_msg(std::string(payload));
+            } else if (result != nullptr) {
+                result->assign(payload.data(), payload.size());
+            }
+            return status;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_RAW_KV_CLIENT_H
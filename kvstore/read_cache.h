@@ -0,0 +1,196 @@
+#ifndef GRPC_KVSTORE_READ_CACHE_H
+#define GRPC_KVSTORE_READ_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glog/logging.h"
+
+namespace kvstore {
+    // Memory-bounded cache of decoded values in front of RocksDB, split into shards with one
+    // lock each. Every shard evicts with CLOCK: a hit sets the reference bit of its entry and
+    // the hand clears bits until it finds an entry that was not used since its last visit.
+    // Writers call Invalidate() after their write is applied. A reader that missed remembers
+    // the shard epoch with BeginFill() before it reads the DB and Fill() drops the value if an
+    // invalidation happened in the meantime, so a stale value never enters the cache.
+    class ReadCache {
+    public:
+        ReadCache(size_t capacity_bytes, size_t num_shards) {
+            CHECK_GT(num_shards, 0);
+            for (size_t i = 0; i < num_shards; i++) {
+                shards_.emplace_back(std::make_unique<Shard>(std::max<size_t>(capacity_bytes / num_shards, 1)));
+            }
+        }
+
+        bool Lookup(const std::string &key, std::string *value) {
+            auto &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+
+            if (it == shard.index.end()) {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            auto &entry = shard.slots[it->second];
+            entry.referenced = true;
+            *value = entry.value;
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        uint64_t BeginFill(const std::string &key) {
+            auto &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            return shard.epoch;
+        }
+
+        void Fill(const std::string &key, const std::string &value, uint64_t epoch) {
+            auto &shard = shardOf(key);
+            size_t charge = entryCharge(key, value);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            // Values larger than an eighth of the shard would flush too much of it
+            if (shard.epoch != epoch || charge > shard.capacity / 8 || shard.index.count(key) > 0) {
+                return;
+            }
+            while (shard.usage + charge > shard.capacity && !shard.index.empty()) {
+                evictOne(shard);
+            }
+            size_t slot;
+            if (shard.free_slots.empty()) {
+                slot = shard.slots.size();
+                shard.slots.emplace_back();
+            } else {
+                slot = shard.free_slots.back();
+                shard.free_slots.pop_back();
+            }
+            auto &entry = shard.slots[slot];
+            entry.key = key;
+            entry.value = value;
+            entry.referenced = false;
+            entry.used = true;
+            shard.index.emplace(key, slot);
+            shard.usage += charge;
+            inserts_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Invalidate(const std::string &key) {
+            auto &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+
+            shard.epoch++;
+            if (it != shard.index.end()) {
+                remove(shard, it->second);
+            }
+        }
+
+        // Drops all entries, for writes that bypass Invalidate() such as bulk loads
+        void Clear() {
+            for (auto &shard: shards_) {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+
+                shard->epoch++;
+                shard->slots.clear();
+                shard->free_slots.clear();
+                shard->index.clear();
+                shard->usage = 0;
+                shard->hand = 0;
+            }
+        }
+
+        size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+
+        size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+        size_t inserts() const { return inserts_.load(std::memory_order_relaxed); }
+
+        size_t evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+        size_t usage() {
+            size_t usage = 0;
+
+            for (auto &shard: shards_) {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                usage += shard->usage;
+            }
+            return usage;
+        }
+
+    private:
+        // Rough bookkeeping overhead of an entry besides its key and value
+        static constexpr size_t ENTRY_OVERHEAD = 64;
+
+        struct Entry {
+            std::string key;
+            std::string value;
+            bool referenced{};
+            bool used{};
+        };
+
+        struct Shard {
+            explicit Shard(size_t capacity) : capacity(capacity) {}
+
+            std::mutex mutex;
+            size_t capacity;
+            size_t usage{};
+            uint64_t epoch{};
+            size_t hand{};
+            std::vector<Entry> slots;
+            std::vector<size_t> free_slots;
+            std::unordered_map<std::string, size_t> index;
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        std::atomic_size_t hits_{0};
+        std::atomic_size_t misses_{0};
+        std::atomic_size_t inserts_{0};
+        std::atomic_size_t evictions_{0};
+
+        static size_t entryCharge(const std::string &key, const std::string &value) {
+            return key.size() + value.size() + ENTRY_OVERHEAD;
+        }
+
+        Shard &shardOf(const std::string &key) {
+            return *shards_[std::hash<std::string>()(key) % shards_.size()];
+        }
+
+        void evictOne(Shard &shard) {
+            while (true) {
+                size_t slot = shard.hand;
+                auto &entry = shard.slots[slot];
+
+                shard.hand = (shard.hand + 1) % shard.slots.size();
+                if (!entry.used) {
+                    continue;
+                }
+                if (entry.referenced) {
+                    entry.referenced = false;
+                    continue;
+                }
+                remove(shard, slot);
+                evictions_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        static void remove(Shard &shard, size_t slot) {
+            auto &entry = shard.slots[slot];
+
+            shard.usage -= entryCharge(entry.key, entry.value);
+            shard.index.erase(entry.key);
+            entry.used = false;
+            std::string().swap(entry.key);
+            std::string().swap(entry.value);
+            shard.free_slots.push_back(slot);
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_READ_CACHE_H
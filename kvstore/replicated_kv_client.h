@@ -0,0 +1,96 @@
+#ifndef GRPC_KVSTORE_REPLICATED_KV_CLIENT_H
+#define GRPC_KVSTORE_REPLICATED_KV_CLIENT_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#include "kv_client.h"
+
+namespace kvstore {
+    // Sends writes to the primary and spreads reads round-robin over its replicas. Replicas
+    // apply the primary's writes asynchronously, a read may not see a write acknowledged just
+    // before. Scans with snapshots stay on the primary, snapshots live on one server.
+    class ReplicatedKVClient : public KVClient {
+    public:
+        ReplicatedKVClient(std::shared_ptr<KVClient> primary, std::vector<std::shared_ptr<KVClient>> replicas) :
+                primary_(std::move(primary)), replicas_(std::move(replicas)) {
+            CHECK(!replicas_.empty());
+            LOG(INFO) << "Client is reading from " << replicas_.size() << " replicas";
+        }
+
+        using KVClient::Scan;
+
+        Status Scan(const std::string &start, std::vector<KV> &kvs, size_t batch_size,
+                    const ScanOptions &options, uint64_t *snapshot_id = nullptr) override {
+            if (options.take_snapshot || options.snapshot_id != 0) {
+                return primary_->Scan(start, kvs, batch_size, options, snapshot_id);
+            }
+            return reader().Scan(start, kvs, batch_size, options, snapshot_id);
+        }
+
+        Status ReleaseSnapshot(uint64_t snapshot_id) override {
+            return primary_->ReleaseSnapshot(snapshot_id);
+        }
+
+        Status Get(const std::string &key, std::string &value) override {
+            return reader().Get(key, value);
+        }
+
+        void Warmup(const WarmupReq &req) override {
+            primary_->Warmup(req);
+            for (auto &replica: replicas_) {
+                replica->Warmup(req);
+            }
+        }
+
+        Status Put(const std::string &key, const std::string &value,
+                   Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return primary_->Put(key, value, durability);
+        }
+
+        Status Delete(const std::string &key, Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return primary_->Delete(key, durability);
+        }
+
+        Status MultiGet(const std::vector<std::string> &keys, std::vector<std::string> &values,
+                        std::vector<Status> *statuses = nullptr) override {
+            return reader().MultiGet(keys, values, statuses);
+        }
+
+        Status MultiPut(const std::vector<std::pair<std::string, std::string>> &kvs,
+                        Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return primary_->MultiPut(kvs, durability);
+        }
+
+        Status MultiDelete(const std::vector<std::string> &keys,
+                           Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return primary_->MultiDelete(keys, durability);
+        }
+
+        Status BulkLoad(const std::function<bool(KV *)> &next, uint64_t *loaded = nullptr) override {
+            return primary_->BulkLoad(next, loaded);
+        }
+
+    private:
+        std::shared_ptr<KVClient> primary_;
+        std::vector<std::shared_ptr<KVClient>> replicas_;
+        std::atomic_size_t next_{0};
+
+        KVClient &reader() {
+            return *replicas_[next_.fetch_add(1, std::memory_order_relaxed) % replicas_.size()];
+        }
+    };
+
+    inline grpc::Status GetReplicationStatus(const std::shared_ptr<grpc::Channel> &channel,
+                                             ReplicationStatusResp *resp) {
+        grpc::ClientContext cli_ctx;
+
+        cli_ctx.set_wait_for_ready(true);
+        return KVReplication::NewStub(channel)->ReplicationStatus(&cli_ctx, ReplicationStatusReq(), resp);
+    }
+}
+
+#endif //GRPC_KVSTORE_REPLICATED_KV_CLIENT_H
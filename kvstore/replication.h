@@ -0,0 +1,478 @@
+#ifndef GRPC_KVSTORE_REPLICATION_H
+#define GRPC_KVSTORE_REPLICATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include "glog/logging.h"
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/transaction_log.h"
+#include "rocksdb/write_batch.h"
+#include "kvstore.grpc.pb.h"
+
+namespace kvstore {
+    // How often a caught up Replicate stream looks for new WAL records
+    const int REPLICATION_POLL_MS = 10;
+    // Max silence of a caught up stream, heartbeats tell the replica it is caught up
+    const int REPLICATION_HEARTBEAT_MS = 100;
+    // Bytes of kvs per message of the snapshot copy
+    const size_t REPLICATION_COPY_BLOCK_BYTES = 1024 * 1024;
+    // How often a replica records its applied sequence next to each shard
+    const int REPLICATION_PERSIST_MS = 1000;
+
+    inline int64_t steadyMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Follower side of replication. Every shard has a thread that streams the shard's WAL from
+    // the primary with Replicate and writes each batch to the local shard. The last applied
+    // sequence of the primary is written to <shard>/REPLICATION about once a second, after the
+    // local WAL is synced, and a restarted replica resumes from it. Batches from before that
+    // point may be applied twice, which is harmless for puts and deletes. A shard without that
+    // file is first copied from a snapshot of the primary, so a replica has to start empty.
+    // Shards must match the primary's one to one, keys are routed by their hash modulo the
+    // number of shards. A replica with another number of shards stops following the primary on
+    // the first message, without retrying, and keeps serving the data it already has.
+    class Replicator {
+    public:
+        // Called with every key written by a replicated batch, after the batch is applied
+        using OnWrite = std::function<void(const std::string &key)>;
+
+        Replicator(std::string primary, std::vector<rocksdb::DB *> dbs, OnWrite on_write) :
+                primary_(std::move(primary)), dbs_(std::move(dbs)), on_write_(std::move(on_write)),
+                shards_(dbs_.size()),
+                stub_(KVReplication::NewStub(grpc::CreateChannel(primary_, grpc::InsecureChannelCredentials()))) {
+            for (size_t i = 0; i < dbs_.size(); i++) {
+                std::string state;
+
+                if (rocksdb::ReadFileToString(rocksdb::Env::Default(), statePath(i), &state).ok()) {
+                    shards_[i].applied = std::stoull(state);
+                    shards_[i].persisted = shards_[i].applied;
+                }
+            }
+        }
+
+        ~Replicator() {
+            Stop();
+        }
+
+        void Start() {
+            auto now = steadyMicros();
+
+            for (size_t i = 0; i < shards_.size(); i++) {
+                shards_[i].caught_up_us = now;
+                LOG(INFO) << "Replicating shard " << i << " from " << primary_ << ", applied sequence: "
+                          << shards_[i].applied;
+                threads_.emplace_back([this, i]() { run(i); });
+            }
+        }
+
+        void Stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                stopping_ = true;
+                for (auto &shard: shards_) {
+                    if (shard.ctx != nullptr) {
+                        shard.ctx->TryCancel();
+                    }
+                }
+            }
+            cv_.notify_all();
+            for (auto &th: threads_) {
+                th.join();
+            }
+            threads_.clear();
+        }
+
+        const std::string &primary() const {
+            return primary_;
+        }
+
+        void Fill(ReplicationStatusResp *resp) const {
+            auto now = steadyMicros();
+
+            resp->set_replica(true);
+            resp->set_primary(primary_);
+            for (auto &shard: shards_) {
+                auto *status = resp->add_shards();
+
+                status->set_applied_sequence(shard.applied);
+                status->set_primary_sequence(shard.primary);
+                status->set_lag_ms(shard.caught_up ? 0 : (now - shard.caught_up_us) / 1000);
+                status->set_connected(shard.connected);
+            }
+        }
+
+    private:
+        struct Shard {
+            std::atomic_uint64_t applied{0};
+            std::atomic_uint64_t primary{0};
+            std::atomic_bool connected{false};
+            std::atomic_bool caught_up{false};
+            std::atomic_int64_t caught_up_us{0};
+            uint64_t persisted{};
+            int64_t persisted_us{};
+            grpc::ClientContext *ctx{}; // guarded by mutex_
+        };
+
+        // Gathers the keys of a batch for on_write_
+        class KeyCollector : public rocksdb::WriteBatch::Handler {
+        public:
+            std::vector<std::string> keys;
+
+            void Put(const rocksdb::Slice &key, const rocksdb::Slice &value) override {
+                keys.push_back(key.ToString());
+            }
+
+            void Delete(const rocksdb::Slice &key) override {
+                keys.push_back(key.ToString());
+            }
+
+            void SingleDelete(const rocksdb::Slice &key) override {
+                keys.push_back(key.ToString());
+            }
+
+            void Merge(const rocksdb::Slice &key, const rocksdb::Slice &value) override {
+                keys.push_back(key.ToString());
+            }
+        };
+
+        std::string primary_;
+        std::vector<rocksdb::DB *> dbs_;
+        OnWrite on_write_;
+        std::vector<Shard> shards_;
+        std::unique_ptr<KVReplication::Stub> stub_;
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stopping_{};
+
+        std::string statePath(size_t i) const {
+            return dbs_[i]->GetName() + "/REPLICATION";
+        }
+
+        // Follows the shard until Stop(), reconnecting a second after every failure
+        void run(size_t i) {
+            auto &shard = shards_[i];
+
+            while (true) {
+                grpc::ClientContext ctx;
+                ReplicateReq req;
+                ReplicateResp resp;
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+
+                    if (stopping_) {
+                        break;
+                    }
+                    shard.ctx = &ctx;
+                }
+                req.set_shard(i);
+                req.set_start_sequence(shard.applied == 0 ? 0 : shard.applied + 1);
+                auto reader = stub_->Replicate(&ctx, req);
+                rocksdb::Status s;
+                // Retrying does not help, the shard keeps what it has and stops following
+                bool mismatch = false;
+
+                while (s.ok() && reader->Read(&resp)) {
+                    shard.connected = true;
+                    if (resp.num_shards() != shards_.size()) {
+                        mismatch = true;
+                        s = rocksdb::Status::Aborted(
+                                "The replica has " + std::to_string(shards_.size()) + " shards and the primary has " +
+                                std::to_string(resp.num_shards()) +
+                                (resp.has_status() ? ": " + resp.status().error_msg() : ""));
+                    } else if (resp.has_status() && resp.status().error_code() != ErrorCode::OK) {
+                        s = rocksdb::Status::Aborted(resp.status().error_msg());
+                    } else {
+                        s = apply(i, resp);
+                    }
+                }
+                if (!s.ok()) {
+                    ctx.TryCancel();
+                }
+                auto grpc_status = reader->Finish();
+                shard.connected = false;
+                shard.caught_up = false;
+                persist(i);
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                shard.ctx = nullptr;
+                if (stopping_) {
+                    break;
+                }
+                if (mismatch) {
+                    LOG(ERROR) << "Replication of shard " << i << " from " << primary_ << " stopped for good: "
+                               << s.ToString();
+                    break;
+                }
+                LOG(ERROR) << "Replication of shard " << i << " from " << primary_ << " stopped: "
+                           << (s.ok() ? grpc_status.error_message() : s.ToString()) << ", retrying";
+                cv_.wait_for(lock, std::chrono::seconds(1), [this]() { return stopping_; });
+            }
+        }
+
+        rocksdb::Status apply(size_t i, const ReplicateResp &resp) {
+            auto &shard = shards_[i];
+            bool heartbeat = resp.batch().empty() && !resp.snapshot();
+
+            shard.primary = std::max<uint64_t>(shard.primary, resp.latest_sequence());
+            if (!resp.batch().empty()) {
+                rocksdb::WriteBatch batch(resp.batch());
+                uint64_t last = resp.sequence() + batch.Count() - 1;
+
+                // A batch from before the applied sequence was applied by an earlier stream
+                if (batch.Count() > 0 && (resp.snapshot() || last > shard.applied)) {
+                    KeyCollector collector;
+                    auto s = dbs_[i]->Write(rocksdb::WriteOptions(), &batch);
+
+                    if (!s.ok()) {
+                        return s;
+                    }
+                    batch.Iterate(&collector);
+                    for (auto &key: collector.keys) {
+                        on_write_(key);
+                    }
+                    if (!resp.snapshot()) {
+                        shard.applied = last;
+                    }
+                }
+            } else if (resp.snapshot()) {
+                shard.applied = resp.sequence();
+                LOG(INFO) << "Copied shard " << i << " from " << primary_ << " at sequence " << resp.sequence();
+                persist(i);
+            }
+            // The primary only sends heartbeats when it has nothing left to send
+            bool caught_up = heartbeat || (!resp.snapshot() && shard.applied >= resp.latest_sequence());
+
+            if (caught_up) {
+                shard.caught_up_us = steadyMicros();
+            }
+            shard.caught_up = caught_up;
+            if (steadyMicros() - shard.persisted_us >= REPLICATION_PERSIST_MS * 1000) {
+                persist(i);
+            }
+            return rocksdb::Status::OK();
+        }
+
+        // The applied sequence is only recorded once the writes up to it are synced
+        void persist(size_t i) {
+            auto &shard = shards_[i];
+            uint64_t applied = shard.applied;
+
+            shard.persisted_us = steadyMicros();
+            if (applied == shard.persisted) {
+                return;
+            }
+            auto s = dbs_[i]->SyncWAL();
+            if (s.ok()) {
+                s = rocksdb::WriteStringToFile(rocksdb::Env::Default(), std::to_string(applied), statePath(i), true);
+            }
+            if (s.ok()) {
+                shard.persisted = applied;
+            } else {
+                LOG(WARNING) << "Cannot record applied sequence " << applied << " of shard " << i << ": "
+                             << s.ToString();
+            }
+        }
+    };
+
+    // Served by every server. Replicate streams a shard's WAL from GetUpdatesSince: it first
+    // sends everything the WAL still has from the requested sequence on, then polls for new
+    // records every REPLICATION_POLL_MS. Requests for sequence 0 get a copy of the shard from a
+    // snapshot first. The WAL has to be kept around for lagging replicas with WAL_ttl_seconds,
+    // writes without WAL and bulk loads are not replicated.
+    class ReplicationServiceImpl final : public KVReplication::Service {
+    public:
+        ReplicationServiceImpl(std::vector<rocksdb::DB *> dbs, const Replicator *replicator) :
+                dbs_(std::move(dbs)), replicator_(replicator) {}
+
+        // Ends all Replicate streams, the server can not shut down while they run
+        void Stop() {
+            stopping_ = true;
+        }
+
+        grpc::Status Replicate(grpc::ServerContext *context, const ReplicateReq *request,
+                               grpc::ServerWriter<ReplicateResp> *writer) override {
+            auto resp = newResp();
+
+            if (dbs_.empty()) {
+                resp.mutable_status()->set_error_code(ErrorCode::SERVER_ERROR);
+                resp.mutable_status()->set_error_msg("Replication needs the rocksdb engine on the primary");
+                writer->Write(resp);
+                return grpc::Status::OK;
+            }
+            if (request->shard() >= dbs_.size()) {
+                resp.mutable_status()->set_error_code(ErrorCode::CLIENT_ERROR);
+                resp.mutable_status()->set_error_msg("Shard " + std::to_string(request->shard()) +
+                                                     " does not exist, the primary has " +
+                                                     std::to_string(dbs_.size()) + " shards");
+                writer->Write(resp);
+                return grpc::Status::OK;
+            }
+            auto *db = dbs_[request->shard()];
+            uint64_t next = request->start_sequence();
+
+            if (db->GetDBOptions().WAL_ttl_seconds == 0 && db->GetDBOptions().WAL_size_limit_MB == 0) {
+                LOG(WARNING) << "WAL files are not kept for replicas, a lagging replica can lose its place";
+            }
+            LOG(INFO) << "Replica " << context->peer() << " follows shard " << request->shard()
+                      << " from sequence " << next;
+            if (next == 0 && !copy(db, writer, &next)) {
+                return grpc::Status::OK;
+            }
+            tail(context, db, writer, next);
+            LOG(INFO) << "Replica " << context->peer() << " stopped following shard " << request->shard();
+            return grpc::Status::OK;
+        }
+
+        grpc::Status ReplicationStatus(grpc::ServerContext *context, const ReplicationStatusReq *request,
+                                       ReplicationStatusResp *response) override {
+            if (replicator_ != nullptr) {
+                replicator_->Fill(response);
+            } else {
+                for (auto *db: dbs_) {
+                    auto *status = response->add_shards();
+
+                    status->set_applied_sequence(db->GetLatestSequenceNumber());
+                    status->set_primary_sequence(db->GetLatestSequenceNumber());
+                }
+            }
+            response->mutable_status()->set_error_code(ErrorCode::OK);
+            return grpc::Status::OK;
+        }
+
+    private:
+        std::vector<rocksdb::DB *> dbs_;
+        const Replicator *replicator_;
+        std::atomic_bool stopping_{false};
+
+        // Sends the shard as of a snapshot and sets next to the first sequence after it
+        bool copy(rocksdb::DB *db, grpc::ServerWriter<ReplicateResp> *writer, uint64_t *next) {
+            const rocksdb::Snapshot *snapshot = db->GetSnapshot();
+            uint64_t sequence = snapshot->GetSequenceNumber();
+            rocksdb::ReadOptions options;
+            rocksdb::WriteBatch batch;
+            bool ok = true;
+
+            options.snapshot = snapshot;
+            options.fill_cache = false;
+            std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(options));
+            for (it->SeekToFirst(); ok && it->Valid() && !stopping_; it->Next()) {
+                batch.Put(it->key(), it->value());
+                if (batch.GetDataSize() >= REPLICATION_COPY_BLOCK_BYTES) {
+                    ok = send(db, writer, batch, sequence, true);
+                    batch.Clear();
+                }
+            }
+            if (ok && !it->status().ok()) {
+                auto resp = newResp();
+
+                resp.mutable_status()->set_error_code(ErrorCode::SERVER_ERROR);
+                resp.mutable_status()->set_error_msg(it->status().ToString());
+                writer->Write(resp);
+                ok = false;
+            }
+            ok = ok && !stopping_;
+            if (ok && batch.Count() > 0) {
+                ok = send(db, writer, batch, sequence, true);
+            }
+            if (ok) {
+                // The empty batch ends the copy
+                ok = writer->Write(message(db, "", sequence, true));
+            }
+            it.reset();
+            db->ReleaseSnapshot(snapshot);
+            *next = sequence + 1;
+            return ok;
+        }
+
+        void tail(grpc::ServerContext *context, rocksdb::DB *db, grpc::ServerWriter<ReplicateResp> *writer,
+                  uint64_t next) {
+            auto last_sent_us = steadyMicros();
+
+            while (!stopping_ && !context->IsCancelled()) {
+                bool progress = false;
+
+                if (next <= db->GetLatestSequenceNumber()) {
+                    std::unique_ptr<rocksdb::TransactionLogIterator> iter;
+                    auto s = db->GetUpdatesSince(next, &iter);
+
+                    if (!s.ok()) {
+                        auto resp = newResp();
+
+                        resp.mutable_status()->set_error_code(ErrorCode::SERVER_ERROR);
+                        resp.mutable_status()->set_error_msg("Cannot read the WAL from sequence " +
+                                                             std::to_string(next) + ", the replica has to be "
+                                                             "rebuilt: " + s.ToString());
+                        writer->Write(resp);
+                        return;
+                    }
+                    // A gap left by writes without WAL invalidates the iterator, the next round
+                    // starts after it
+                    for (; iter->Valid() && !stopping_; iter->Next()) {
+                        auto result = iter->GetBatch();
+                        uint64_t count = result.writeBatchPtr->Count();
+
+                        if (result.sequence + count <= next) {
+                            continue;
+                        }
+                        if (!send(db, writer, *result.writeBatchPtr, result.sequence, false)) {
+                            return;
+                        }
+                        next = result.sequence + count;
+                        progress = true;
+                    }
+                }
+                if (progress) {
+                    last_sent_us = steadyMicros();
+                    continue;
+                }
+                if (steadyMicros() - last_sent_us >= REPLICATION_HEARTBEAT_MS * 1000) {
+                    if (!writer->Write(message(db, "", next - 1, false))) {
+                        return;
+                    }
+                    last_sent_us = steadyMicros();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_POLL_MS));
+            }
+        }
+
+        // Every message carries the number of shards, so a replica can check it matches
+        ReplicateResp newResp() const {
+            ReplicateResp resp;
+
+            resp.set_num_shards(dbs_.size());
+            return resp;
+        }
+
+        ReplicateResp message(rocksdb::DB *db, const std::string &batch, uint64_t sequence, bool snapshot) const {
+            auto resp = newResp();
+
+            resp.set_batch(batch);
+            resp.set_sequence(sequence);
+            resp.set_snapshot(snapshot);
+            resp.set_latest_sequence(db->GetLatestSequenceNumber());
+            return resp;
+        }
+
+        bool send(rocksdb::DB *db, grpc::ServerWriter<ReplicateResp> *writer, const rocksdb::WriteBatch &batch,
+                  uint64_t sequence, bool snapshot) {
+            return writer->Write(message(db, batch.Data(), sequence, snapshot));
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_REPLICATION_H
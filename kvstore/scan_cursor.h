@@ -0,0 +1,296 @@
+#ifndef GRPC_KVSTORE_SCAN_CURSOR_H
+#define GRPC_KVSTORE_SCAN_CURSOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "glog/logging.h"
+#include "rocksdb/db.h"
+#include "kvstore.pb.h"
+#include "storage_engine.h"
+
+namespace kvstore {
+    const size_t DEFAULT_SCAN_BLOCK_BYTES = 64 * 1024;
+    const size_t MAX_SCAN_BLOCK_BYTES = 2 * 1024 * 1024;
+
+    // Snapshots handed out to clients for paginated scans, they stay alive until the client
+    // releases them, the server stops or no scan used them for ttl_sec. The lease keeps a client
+    // that crashed from pinning old versions, which compaction can not drop, for good. A scan
+    // holds its own reference, so a concurrent release or expiry never pulls the snapshot from
+    // under a running iterator. With several shards a snapshot holds one rocksdb::Snapshot per
+    // shard, taken one after another.
+    class SnapshotRegistry {
+    public:
+        using Snapshots = std::vector<const rocksdb::Snapshot *>;
+        using SnapshotPtr = std::shared_ptr<const Snapshots>;
+
+        // A ttl_sec of 0 keeps snapshots until they are released
+        explicit SnapshotRegistry(std::vector<StorageEngine *> engines, int ttl_sec = 0) :
+                engines_(std::move(engines)), ttl_(std::chrono::seconds(ttl_sec)) {}
+
+        // Returns 0 without a snapshot if an engine does not support them
+        uint64_t Take(SnapshotPtr *snapshot) {
+            auto engines = engines_;
+            auto *snapshots = new Snapshots();
+
+            for (auto *engine: engines) {
+                snapshots->push_back(engine->GetSnapshot());
+            }
+            SnapshotPtr taken(snapshots, [engines](const Snapshots *s) {
+                for (size_t i = 0; i < engines.size(); i++) {
+                    if ((*s)[i] != nullptr) {
+                        engines[i]->ReleaseSnapshot((*s)[i]);
+                    }
+                }
+                delete s;
+            });
+            if (std::find(snapshots->begin(), snapshots->end(), nullptr) != snapshots->end()) {
+                return 0;
+            }
+            auto expired = sweep();
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t id = next_id_++;
+
+            snapshots_[id] = {taken, Clock::now()};
+            *snapshot = std::move(taken);
+            return id;
+        }
+
+        // Renews the lease of the snapshot
+        SnapshotPtr Get(uint64_t id) {
+            auto expired = sweep();
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = snapshots_.find(id);
+
+            if (it == snapshots_.end()) {
+                return nullptr;
+            }
+            it->second.last_used = Clock::now();
+            return it->second.snapshot;
+        }
+
+        bool Release(uint64_t id) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            return snapshots_.erase(id) > 0;
+        }
+
+        void Clear() {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            snapshots_.clear();
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Lease {
+            SnapshotPtr snapshot;
+            Clock::time_point last_used;
+        };
+
+        std::vector<StorageEngine *> engines_;
+        Clock::duration ttl_;
+        std::mutex mutex_;
+        uint64_t next_id_{1};
+        std::unordered_map<uint64_t, Lease> snapshots_;
+
+        // Drops the expired snapshots from the registry. They are released when the caller drops
+        // the result, outside of the lock, or later by a scan still reading them
+        std::vector<SnapshotPtr> sweep() {
+            std::vector<SnapshotPtr> expired;
+
+            if (ttl_ == Clock::duration::zero()) {
+                return expired;
+            }
+            auto now = Clock::now();
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (auto it = snapshots_.begin(); it != snapshots_.end();) {
+                if (now - it->second.last_used > ttl_) {
+                    LOG(INFO) << "Snapshot " << it->first << " expired";
+                    expired.push_back(std::move(it->second.snapshot));
+                    it = snapshots_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            return expired;
+        }
+    };
+
+    // Iterator state of one Scan request over [start, end), forward or reverse. The bounds
+    // are handed to RocksDB as iterate_lower_bound/iterate_upper_bound so it can skip SSTs
+    // outside the range. The cursor must not move while it is open, ReadOptions point into it.
+    // Keys are hash partitioned over the shards, so the cursor opens one iterator per shard and
+    // merges them in key order.
+    class ScanCursor {
+    public:
+        ScanCursor() = default;
+
+        ScanCursor(const ScanCursor &) = delete;
+
+        ~ScanCursor() {
+            Close();
+        }
+
+        // Returns false with an error in status if the requested snapshot is unknown or can not
+        // be taken, the status of a successful open is sent with the first block
+        bool Open(const std::vector<StorageEngine *> &engines, SnapshotRegistry *snapshots, const ScanReq &req,
+                  Status *status) {
+            rocksdb::ReadOptions options;
+
+            rest_size_ = req.has_limit() ? req.limit() : std::numeric_limits<size_t>::max();
+            max_bytes_ = req.has_max_block_bytes() && req.max_block_bytes() > 0 ?
+                         std::min<size_t>(req.max_block_bytes(), MAX_SCAN_BLOCK_BYTES) : DEFAULT_SCAN_BLOCK_BYTES;
+            max_kvs_ = req.has_max_block_kvs() && req.max_block_kvs() > 0 ?
+                       req.max_block_kvs() : std::numeric_limits<size_t>::max();
+            reverse_ = req.reverse();
+            keys_only_ = req.keys_only();
+            snapshot_id_ = 0;
+            first_block_ = true;
+
+            if (req.has_snapshot_id()) {
+                snapshot_ = snapshots->Get(req.snapshot_id());
+                if (snapshot_ == nullptr) {
+                    status->set_error_code(ErrorCode::CLIENT_ERROR);
+                    status->set_error_msg("Unknown snapshot " + std::to_string(req.snapshot_id()));
+                    return false;
+                }
+            } else if (req.take_snapshot()) {
+                snapshot_id_ = snapshots->Take(&snapshot_);
+                if (snapshot_id_ == 0) {
+                    snapshot_.reset();
+                    status->set_error_code(ErrorCode::CLIENT_ERROR);
+                    status->set_error_msg("The storage engine does not support snapshots");
+                    return false;
+                }
+            }
+            if (req.has_start()) {
+                lower_ = req.start();
+                options.iterate_lower_bound = &lower_;
+            }
+            if (req.has_end()) {
+                upper_ = req.end();
+                options.iterate_upper_bound = &upper_;
+            }
+
+            for (size_t i = 0; i < engines.size(); i++) {
+                options.snapshot = snapshot_ == nullptr ? nullptr : (*snapshot_)[i];
+                auto *it = engines[i]->NewIterator(options);
+
+                if (reverse_) {
+                    it->SeekToLast();
+                } else if (req.has_start()) {
+                    it->Seek(lower_);
+                } else {
+                    it->SeekToFirst();
+                }
+                its_.push_back(it);
+            }
+            return true;
+        }
+
+        // Moves up to max_block_kvs kvs or roughly max_block_bytes bytes into resp, a block always
+        // holds at least one kv. The first block carries the status and the snapshot id and is
+        // sent even if the range is empty. Returns false once the range or the limit is exhausted
+        bool Fill(ScanResp *resp) {
+            size_t bytes = 0;
+
+            resp->Clear();
+            if (first_block_) {
+                resp->mutable_status()->set_error_code(ErrorCode::OK);
+                resp->set_snapshot_id(snapshot_id_);
+                first_block_ = false;
+            }
+            rocksdb::Iterator *it;
+
+            while ((it = current()) != nullptr && rest_size_ > 0 && (size_t) resp->kvs_size() < max_kvs_) {
+                auto key = it->key();
+                size_t size = key.size();
+                rocksdb::Slice value;
+
+                if (!keys_only_) {
+                    value = it->value();
+                    size += value.size();
+                }
+                if (resp->kvs_size() > 0 && bytes + size > max_bytes_) {
+                    break;
+                }
+                auto *kv = resp->add_kvs();
+                kv->mutable_key()->assign(key.data(), key.size());
+                if (!keys_only_) {
+                    kv->mutable_value()->assign(value.data(), value.size());
+                }
+                bytes += size;
+                rest_size_--;
+                if (reverse_) {
+                    it->Prev();
+                } else {
+                    it->Next();
+                }
+            }
+            for (auto *shard_it: its_) {
+                CHECK(shard_it->status().ok()) << shard_it->status().ToString();
+            }
+            return current() != nullptr && rest_size_ > 0;
+        }
+
+        void Close() {
+            for (auto *it: its_) {
+                delete it;
+            }
+            its_.clear();
+            snapshot_.reset();
+        }
+
+        bool is_open() const {
+            return !its_.empty();
+        }
+
+        // Id of the snapshot taken by this scan, 0 if none was taken
+        uint64_t snapshot_id() const {
+            return snapshot_id_;
+        }
+
+    private:
+        std::vector<rocksdb::Iterator *> its_;
+        SnapshotRegistry::SnapshotPtr snapshot_;
+        uint64_t snapshot_id_{};
+        rocksdb::Slice lower_;
+        rocksdb::Slice upper_;
+        size_t rest_size_{};
+        size_t max_bytes_{};
+        size_t max_kvs_{};
+        bool reverse_{};
+        bool keys_only_{};
+        bool first_block_{};
+
+        // Iterator positioned on the next key in scan order, nullptr once all are exhausted.
+        // A linear pick is cheaper than a heap for the handful of shards of one server
+        rocksdb::Iterator *current() const {
+            rocksdb::Iterator *next = nullptr;
+
+            for (auto *it: its_) {
+                if (!it->Valid()) {
+                    continue;
+                }
+                if (next == nullptr) {
+                    next = it;
+                } else {
+                    int cmp = it->key().compare(next->key());
+                    if (reverse_ ? cmp > 0 : cmp < 0) {
+                        next = it;
+                    }
+                }
+            }
+            return next;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_SCAN_CURSOR_H
@@ -0,0 +1,347 @@
+#ifndef GRPC_KVSTORE_SHARDED_KV_CLIENT_H
+#define GRPC_KVSTORE_SHARDED_KV_CLIENT_H
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#include "kv_client.h"
+
+namespace kvstore {
+    // FNV-1a followed by the murmur3 finalizer, FNV alone clusters similar keys on the ring
+    inline uint64_t ringHash(const std::string &s) {
+        uint64_t h = 0xCBF29CE484222325ull;
+
+        for (unsigned char c: s) {
+            h = (h ^ c) * 1099511628211ull;
+        }
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Splits "host1:port1,host2:port2" into its endpoints
+    inline std::vector<std::string> splitEndpoints(const std::string &list) {
+        std::vector<std::string> endpoints;
+        std::stringstream ss(list);
+        std::string endpoint;
+
+        while (std::getline(ss, endpoint, ',')) {
+            if (!endpoint.empty()) {
+                endpoints.push_back(endpoint);
+            }
+        }
+        return endpoints;
+    }
+
+    // Spreads keys over several kv_store servers with a consistent-hash ring, every server owns
+    // vnodes points of the ring so adding a server only moves about 1/N of the keys. Keeps one
+    // channel per server. Multi-key operations are split by server and sent in parallel, scans
+    // go to all servers and are merged by key. Snapshots are per server and not supported.
+    class ShardedKVClient : public KVClient {
+    public:
+        static constexpr int DEFAULT_VNODES = 160;
+
+        explicit ShardedKVClient(const std::vector<std::string> &endpoints, int vnodes = DEFAULT_VNODES) :
+                ShardedKVClient(endpoints, newChannels(endpoints), vnodes) {}
+
+        ShardedKVClient(const std::vector<std::string> &endpoints,
+                        const std::vector<std::shared_ptr<grpc::Channel>> &channels,
+                        int vnodes = DEFAULT_VNODES) : endpoints_(endpoints) {
+            CHECK(!endpoints.empty());
+            CHECK_EQ(endpoints.size(), channels.size());
+            CHECK_GT(vnodes, 0);
+            for (size_t i = 0; i < endpoints.size(); i++) {
+                clients_.push_back(std::make_unique<KVClient>(channels[i]));
+                stubs_.push_back(KVStore::NewStub(channels[i]));
+                // Points depend on the endpoint name only, so every client builds the same ring
+                for (int v = 0; v < vnodes; v++) {
+                    ring_.emplace_back(ringHash(endpoints[i] + "#" + std::to_string(v)), i);
+                }
+            }
+            std::sort(ring_.begin(), ring_.end());
+            LOG(INFO) << "Client is spreading keys over " << endpoints.size() << " servers";
+        }
+
+        size_t ServerOf(const std::string &key) const {
+            auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(ringHash(key), (size_t) 0));
+
+            return it == ring_.end() ? ring_.front().second : it->second;
+        }
+
+        const std::vector<std::string> &endpoints() const {
+            return endpoints_;
+        }
+
+        using KVClient::Scan;
+
+        // Scans every server for up to batch_size kvs and merges them, so the result is the
+        // first batch_size kvs of the range in the requested order
+        Status Scan(const std::string &start, std::vector<KV> &kvs, size_t batch_size,
+                    const ScanOptions &options, uint64_t *snapshot_id = nullptr) override {
+            if (options.take_snapshot || options.snapshot_id != 0) {
+                return clientError("Snapshots are not supported across servers");
+            }
+            std::vector<std::future<Status>> futures;
+            std::vector<std::vector<KV>> parts(clients_.size());
+
+            for (size_t i = 0; i < clients_.size(); i++) {
+                futures.push_back(std::async(std::launch::async, [&, i]() {
+                    return clients_[i]->Scan(start, parts[i], batch_size, options);
+                }));
+            }
+            Status status;
+            status.set_error_code(ErrorCode::OK);
+            for (auto &future: futures) {
+                auto s = future.get();
+                if (s.error_code() != ErrorCode::OK && status.error_code() == ErrorCode::OK) {
+                    status = s;
+                }
+            }
+            if (status.error_code() != ErrorCode::OK) {
+                return status;
+            }
+
+            std::vector<size_t> pos(parts.size());
+            while (batch_size-- > 0) {
+                int next = -1;
+
+                for (size_t i = 0; i < parts.size(); i++) {
+                    if (pos[i] == parts[i].size()) {
+                        continue;
+                    }
+                    if (next < 0) {
+                        next = (int) i;
+                    } else {
+                        auto &key = parts[i][pos[i]].key();
+                        auto &next_key = parts[next][pos[next]].key();
+                        if (options.reverse ? key > next_key : key < next_key) {
+                            next = (int) i;
+                        }
+                    }
+                }
+                if (next < 0) {
+                    break;
+                }
+                kvs.push_back(std::move(parts[next][pos[next]++]));
+            }
+            return status;
+        }
+
+        Status ReleaseSnapshot(uint64_t snapshot_id) override {
+            return clientError("Snapshots are not supported across servers");
+        }
+
+        Status Get(const std::string &key, std::string &value) override {
+            return clients_[ServerOf(key)]->Get(key, value);
+        }
+
+        void Warmup(const WarmupReq &req) override {
+            for (auto &client: clients_) {
+                client->Warmup(req);
+            }
+        }
+
+        Status Put(const std::string &key, const std::string &value,
+                   Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return clients_[ServerOf(key)]->Put(key, value, durability);
+        }
+
+        Status Delete(const std::string &key, Durability durability = Durability::DURABILITY_DEFAULT) override {
+            return clients_[ServerOf(key)]->Delete(key, durability);
+        }
+
+        Status MultiGet(const std::vector<std::string> &keys, std::vector<std::string> &values,
+                        std::vector<Status> *statuses = nullptr) override {
+            std::vector<MultiGetReq> reqs(clients_.size());
+            std::vector<MultiGetResp> resps(clients_.size());
+            std::vector<std::pair<size_t, int>> where; // (server, index in its response) of each key
+
+            where.reserve(keys.size());
+            for (auto &key: keys) {
+                auto server = ServerOf(key);
+
+                where.emplace_back(server, reqs[server].keys_size());
+                reqs[server].add_keys(key);
+            }
+            auto status = fanOut(reqs, resps, [](KVStore::Stub *stub, grpc::ClientContext *ctx,
+                                                  const MultiGetReq &req, grpc::CompletionQueue *cq) {
+                return stub->PrepareAsyncMultiGet(ctx, req, cq);
+            }, [](const MultiGetReq &req) { return req.keys_size() > 0; });
+            if (status.error_code() != ErrorCode::OK) {
+                return status;
+            }
+            values.clear();
+            values.reserve(keys.size());
+            if (statuses != nullptr) {
+                statuses->clear();
+                statuses->reserve(keys.size());
+            }
+            for (auto &w: where) {
+                auto &resp = resps[w.first];
+
+                values.push_back(std::move(*resp.mutable_values(w.second)));
+                if (statuses != nullptr) {
+                    statuses->push_back(resp.statuses(w.second));
+                }
+            }
+            return status;
+        }
+
+        Status MultiPut(const std::vector<std::pair<std::string, std::string>> &kvs,
+                        Durability durability = Durability::DURABILITY_DEFAULT) override {
+            std::vector<MultiPutReq> reqs(clients_.size());
+            std::vector<MultiPutResp> resps(clients_.size());
+
+            for (auto &kv: kvs) {
+                auto *req_kv = reqs[ServerOf(kv.first)].add_kvs();
+                *req_kv->mutable_key() = kv.first;
+                *req_kv->mutable_value() = kv.second;
+            }
+            for (auto &req: reqs) {
+                req.set_durability(durability);
+            }
+            return fanOut(reqs, resps, [](KVStore::Stub *stub, grpc::ClientContext *ctx,
+                                          const MultiPutReq &req, grpc::CompletionQueue *cq) {
+                return stub->PrepareAsyncMultiPut(ctx, req, cq);
+            }, [](const MultiPutReq &req) { return req.kvs_size() > 0; });
+        }
+
+        Status MultiDelete(const std::vector<std::string> &keys,
+                           Durability durability = Durability::DURABILITY_DEFAULT) override {
+            std::vector<MultiDeleteReq> reqs(clients_.size());
+            std::vector<MultiDeleteResp> resps(clients_.size());
+
+            for (auto &key: keys) {
+                reqs[ServerOf(key)].add_keys(key);
+            }
+            for (auto &req: reqs) {
+                req.set_durability(durability);
+            }
+            return fanOut(reqs, resps, [](KVStore::Stub *stub, grpc::ClientContext *ctx,
+                                          const MultiDeleteReq &req, grpc::CompletionQueue *cq) {
+                return stub->PrepareAsyncMultiDelete(ctx, req, cq);
+            }, [](const MultiDeleteReq &req) { return req.keys_size() > 0; });
+        }
+
+        // Opens one stream per server and routes every kv to its server. Each server ingests
+        // its part on its own, so a failure can leave the other parts loaded
+        Status BulkLoad(const std::function<bool(KV *)> &next, uint64_t *loaded = nullptr) override {
+            std::vector<std::unique_ptr<BulkLoadWriter>> writers;
+            Status status;
+            KV kv;
+
+            for (auto &stub: stubs_) {
+                writers.push_back(std::make_unique<BulkLoadWriter>(stub.get()));
+            }
+            while (next(&kv)) {
+                writers[ServerOf(kv.key())]->Add(kv.key(), kv.value());
+            }
+            status.set_error_code(ErrorCode::OK);
+            if (loaded != nullptr) {
+                *loaded = 0;
+            }
+            for (size_t i = 0; i < writers.size(); i++) {
+                uint64_t server_loaded = 0;
+                auto s = writers[i]->Finish(&server_loaded);
+
+                if (s.error_code() != ErrorCode::OK && status.error_code() == ErrorCode::OK) {
+                    status = s;
+                    status.set_error_msg(endpoints_[i] + ": " + s.error_msg());
+                }
+                if (loaded != nullptr) {
+                    *loaded += server_loaded;
+                }
+            }
+            return status;
+        }
+
+    private:
+        std::vector<std::string> endpoints_;
+        std::vector<std::unique_ptr<KVClient>> clients_;
+        std::vector<std::unique_ptr<KVStore::Stub>> stubs_;
+        std::vector<std::pair<uint64_t, size_t>> ring_;
+
+        static std::vector<std::shared_ptr<grpc::Channel>> newChannels(const std::vector<std::string> &endpoints) {
+            std::vector<std::shared_ptr<grpc::Channel>> channels;
+
+            for (auto &endpoint: endpoints) {
+                channels.push_back(grpc::CreateChannel(localEndpoint(endpoint), grpc::InsecureChannelCredentials()));
+            }
+            return channels;
+        }
+
+        static Status clientError(const std::string &msg) {
+            Status status;
+
+            status.set_error_code(ErrorCode::CLIENT_ERROR);
+            status.set_error_msg(msg);
+            return status;
+        }
+
+        // Sends reqs[i] to every server i whose request is needed on one completion queue and
+        // waits for all responses. Returns the first failure
+        template<typename REQ_T, typename RESP_T, typename PREPARE_T, typename NEEDED_T>
+        Status fanOut(const std::vector<REQ_T> &reqs, std::vector<RESP_T> &resps, PREPARE_T prepare,
+                      NEEDED_T needed) {
+            size_t n = reqs.size();
+            grpc::CompletionQueue cq;
+            std::vector<grpc::ClientContext> ctxs(n);
+            std::vector<grpc::Status> grpc_statuses(n);
+            std::vector<std::unique_ptr<grpc::ClientAsyncResponseReader<RESP_T>>> readers(n);
+            size_t pending = 0;
+
+            for (size_t i = 0; i < n; i++) {
+                if (!needed(reqs[i])) {
+                    continue;
+                }
+                ctxs[i].set_wait_for_ready(true);
+                readers[i] = prepare(stubs_[i].get(), &ctxs[i], reqs[i], &cq);
+                readers[i]->StartCall();
+                readers[i]->Finish(&resps[i], &grpc_statuses[i], reinterpret_cast<void *>(i));
+                pending++;
+            }
+            while (pending > 0) {
+                void *tag;
+                bool ok;
+
+                CHECK(cq.Next(&tag, &ok));
+                pending--;
+            }
+
+            Status status;
+            status.set_error_code(ErrorCode::OK);
+            for (size_t i = 0; i < n; i++) {
+                if (readers[i] == nullptr) {
+                    continue;
+                }
+                if (!grpc_statuses[i].ok()) {
+                    return clientError(endpoints_[i] + ": " + grpc_statuses[i].error_message());
+                }
+                if (resps[i].status().error_code() != ErrorCode::OK && status.error_code() == ErrorCode::OK) {
+                    status = resps[i].status();
+                }
+            }
+            return status;
+        }
+    };
+
+    // Client for a single "host:port" or a comma separated list of them
+    inline std::shared_ptr<KVClient> NewKVClient(const std::string &endpoints) {
+        auto list = splitEndpoints(endpoints);
+
+        if (list.size() > 1) {
+            return std::make_shared<ShardedKVClient>(list);
+        }
+        return std::make_shared<KVClient>(endpoints);
+    }
+}
+
+#endif //GRPC_KVSTORE_SHARDED_KV_CLIENT_H
@@ -0,0 +1,132 @@
+#ifndef GRPC_KVSTORE_STORAGE_ENGINE_H
+#define GRPC_KVSTORE_STORAGE_ENGINE_H
+
+#include <memory>
+#include <string>
+#include "rocksdb/db.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/write_batch.h"
+
+namespace kvstore {
+    // Storage of one shard. Engines speak in RocksDB's Status, Slice, WriteBatch and Iterator,
+    // so the RocksDB engine passes calls straight through and the serving code is the same for
+    // every engine. Engines without snapshots return nullptr from GetSnapshot().
+    class StorageEngine {
+    public:
+        virtual ~StorageEngine() = default;
+
+        virtual rocksdb::Status Get(const rocksdb::ReadOptions &options, const rocksdb::Slice &key,
+                                    rocksdb::PinnableSlice *value) = 0;
+
+        rocksdb::Status Get(const rocksdb::ReadOptions &options, const rocksdb::Slice &key, std::string *value) {
+            rocksdb::PinnableSlice slice(value);
+            auto s = Get(options, key, &slice);
+
+            if (s.ok() && slice.IsPinned()) {
+                value->assign(slice.data(), slice.size());
+            }
+            return s;
+        }
+
+        // Looks up n keys, engines that can batch the lookups override it
+        virtual void MultiGet(const rocksdb::ReadOptions &options, size_t n, const rocksdb::Slice *keys,
+                              rocksdb::PinnableSlice *values, rocksdb::Status *statuses) {
+            for (size_t i = 0; i < n; i++) {
+                statuses[i] = Get(options, keys[i], &values[i]);
+            }
+        }
+
+        virtual rocksdb::Status Put(const rocksdb::WriteOptions &options, const rocksdb::Slice &key,
+                                    const rocksdb::Slice &value) = 0;
+
+        virtual rocksdb::Status Delete(const rocksdb::WriteOptions &options, const rocksdb::Slice &key) = 0;
+
+        virtual rocksdb::Status Write(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *batch) = 0;
+
+        // Honors iterate_lower_bound and iterate_upper_bound of options
+        virtual rocksdb::Iterator *NewIterator(const rocksdb::ReadOptions &options) = 0;
+
+        virtual const rocksdb::Snapshot *GetSnapshot() = 0;
+
+        virtual void ReleaseSnapshot(const rocksdb::Snapshot *snapshot) = 0;
+
+        // Integer rocksdb.* property, false if the engine does not know it
+        virtual bool GetIntProperty(const std::string &property, uint64_t *value) = 0;
+
+        // Tickers of the engine, nullptr if it does not collect them
+        virtual std::shared_ptr<rocksdb::Statistics> statistics() { return nullptr; }
+
+        virtual rocksdb::Status Close() = 0;
+
+        // The DB behind the engine, nullptr if there is none. Bulk loads and replication work
+        // on SST files and the WAL and are only available with it
+        virtual rocksdb::DB *rocksdb() { return nullptr; }
+    };
+
+    class RocksDBEngine : public StorageEngine {
+    public:
+        explicit RocksDBEngine(rocksdb::DB *db) : db_(db) {}
+
+        ~RocksDBEngine() override {
+            delete db_;
+        }
+
+        using StorageEngine::Get;
+
+        rocksdb::Status Get(const rocksdb::ReadOptions &options, const rocksdb::Slice &key,
+                            rocksdb::PinnableSlice *value) override {
+            return db_->Get(options, db_->DefaultColumnFamily(), key, value);
+        }
+
+        void MultiGet(const rocksdb::ReadOptions &options, size_t n, const rocksdb::Slice *keys,
+                      rocksdb::PinnableSlice *values, rocksdb::Status *statuses) override {
+            db_->MultiGet(options, db_->DefaultColumnFamily(), n, keys, values, statuses);
+        }
+
+        rocksdb::Status Put(const rocksdb::WriteOptions &options, const rocksdb::Slice &key,
+                            const rocksdb::Slice &value) override {
+            return db_->Put(options, key, value);
+        }
+
+        rocksdb::Status Delete(const rocksdb::WriteOptions &options, const rocksdb::Slice &key) override {
+            return db_->Delete(options, key);
+        }
+
+        rocksdb::Status Write(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *batch) override {
+            return db_->Write(options, batch);
+        }
+
+        rocksdb::Iterator *NewIterator(const rocksdb::ReadOptions &options) override {
+            return db_->NewIterator(options);
+        }
+
+        const rocksdb::Snapshot *GetSnapshot() override {
+            return db_->GetSnapshot();
+        }
+
+        void ReleaseSnapshot(const rocksdb::Snapshot *snapshot) override {
+            db_->ReleaseSnapshot(snapshot);
+        }
+
+        bool GetIntProperty(const std::string &property, uint64_t *value) override {
+            return db_->GetIntProperty(property, value);
+        }
+
+        std::shared_ptr<rocksdb::Statistics> statistics() override {
+            return db_->GetDBOptions().statistics;
+        }
+
+        rocksdb::Status Close() override {
+            return db_->Close();
+        }
+
+        rocksdb::DB *rocksdb() override {
+            return db_;
+        }
+
+    private:
+        rocksdb::DB *db_;
+    };
+}
+
+#endif //GRPC_KVSTORE_STORAGE_ENGINE_H
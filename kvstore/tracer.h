@@ -0,0 +1,260 @@
+#ifndef GRPC_KVSTORE_TRACER_H
+#define GRPC_KVSTORE_TRACER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "glog/logging.h"
+#include "rocksdb/iostats_context.h"
+#include "rocksdb/perf_context.h"
+#include "rocksdb/perf_level.h"
+#include "metrics.h"
+
+namespace kvstore {
+    using PerfCounter = std::pair<const char *, uint64_t rocksdb::PerfContext::*>;
+    using IOStatsCounter = std::pair<const char *, uint64_t rocksdb::IOStatsContext::*>;
+
+    // Where a read or write spent its time inside RocksDB: memtable, block cache, disk, WAL
+    const PerfCounter PERF_COUNTERS[] = {
+            {"get_snapshot_time",               &rocksdb::PerfContext::get_snapshot_time},
+            {"get_from_memtable_time",          &rocksdb::PerfContext::get_from_memtable_time},
+            {"get_from_memtable_count",         &rocksdb::PerfContext::get_from_memtable_count},
+            {"get_from_output_files_time",      &rocksdb::PerfContext::get_from_output_files_time},
+            {"get_post_process_time",           &rocksdb::PerfContext::get_post_process_time},
+            {"seek_on_memtable_time",           &rocksdb::PerfContext::seek_on_memtable_time},
+            {"seek_child_seek_time",            &rocksdb::PerfContext::seek_child_seek_time},
+            {"user_key_comparison_count",       &rocksdb::PerfContext::user_key_comparison_count},
+            {"internal_key_skipped_count",      &rocksdb::PerfContext::internal_key_skipped_count},
+            {"internal_delete_skipped_count",   &rocksdb::PerfContext::internal_delete_skipped_count},
+            {"block_cache_hit_count",           &rocksdb::PerfContext::block_cache_hit_count},
+            {"block_read_count",                &rocksdb::PerfContext::block_read_count},
+            {"block_read_byte",                 &rocksdb::PerfContext::block_read_byte},
+            {"block_read_time",                 &rocksdb::PerfContext::block_read_time},
+            {"block_decompress_time",           &rocksdb::PerfContext::block_decompress_time},
+            {"bloom_sst_hit_count",             &rocksdb::PerfContext::bloom_sst_hit_count},
+            {"bloom_sst_miss_count",            &rocksdb::PerfContext::bloom_sst_miss_count},
+            {"write_wal_time",                  &rocksdb::PerfContext::write_wal_time},
+            {"write_memtable_time",             &rocksdb::PerfContext::write_memtable_time},
+            {"write_delay_time",                &rocksdb::PerfContext::write_delay_time},
+            {"write_pre_and_post_process_time", &rocksdb::PerfContext::write_pre_and_post_process_time},
+    };
+
+    const IOStatsCounter IOSTATS_COUNTERS[] = {
+            {"bytes_read",    &rocksdb::IOStatsContext::bytes_read},
+            {"read_nanos",    &rocksdb::IOStatsContext::read_nanos},
+            {"bytes_written", &rocksdb::IOStatsContext::bytes_written},
+            {"write_nanos",   &rocksdb::IOStatsContext::write_nanos},
+            {"fsync_nanos",   &rocksdb::IOStatsContext::fsync_nanos},
+    };
+
+    const size_t PERF_COUNTER_COUNT = std::size(PERF_COUNTERS) + std::size(IOSTATS_COUNTERS);
+
+    struct TraceSpan {
+        const char *name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    // Stages of one sampled request. The thread serving the call marks the stages it waits
+    // for, a storage worker adds the spans it runs, possibly while the call thread waits for
+    // a write, so both go through the mutex.
+    class RequestTrace {
+    public:
+        RequestTrace(RpcMethod method, bool requested) :
+                method_(method), requested_(requested), begin_ns_(steadyNanos()), counters_(PERF_COUNTER_COUNT) {}
+
+        RpcMethod method() const { return method_; }
+
+        // The client asked for the breakdown in the trailing metadata
+        bool requested() const { return requested_; }
+
+        // Ends the open stage and opens name, nullptr only ends it
+        void Mark(const char *name) {
+            auto now = steadyNanos();
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (open_ != nullptr) {
+                spans_.push_back({open_, open_begin_ns_, now});
+            }
+            open_ = name;
+            open_begin_ns_ = now;
+        }
+
+        void Add(const char *name, uint64_t begin_ns, uint64_t end_ns) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            spans_.push_back({name, begin_ns, end_ns});
+        }
+
+        // Runs the storage work with the PerfContext and IOStatsContext of this thread enabled
+        // and adds up their counters
+        template<typename FUNC_T>
+        void Storage(FUNC_T &&storage) {
+            auto *perf = rocksdb::get_perf_context();
+            auto *iostats = rocksdb::get_iostats_context();
+            auto level = rocksdb::GetPerfLevel();
+
+            rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableTimeExceptForMutex);
+            perf->Reset();
+            iostats->Reset();
+            auto begin_ns = steadyNanos();
+            storage();
+            auto end_ns = steadyNanos();
+            rocksdb::SetPerfLevel(level);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t i = 0;
+
+            spans_.push_back({"storage", begin_ns, end_ns});
+            for (auto &counter: PERF_COUNTERS) {
+                counters_[i++] += perf->*counter.second;
+            }
+            for (auto &counter: IOSTATS_COUNTERS) {
+                counters_[i++] += iostats->*counter.second;
+            }
+        }
+
+        void Finish() {
+            Mark(nullptr);
+            end_ns_ = steadyNanos();
+        }
+
+        // Time per stage so far and the non-zero counters, e.g.
+        // "server_us=85.2 storage_us=61.0 block_read_count=1 block_read_time=48211"
+        std::string Summary() {
+            std::vector<std::pair<const char *, uint64_t>> stages;
+            std::stringstream ss;
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            ss << "server_us=" << (steadyNanos() - begin_ns_) / 1000.0;
+            for (auto &span: spans_) {
+                auto it = std::find_if(stages.begin(), stages.end(), [&span](auto &stage) {
+                    return strcmp(stage.first, span.name) == 0;
+                });
+
+                if (it == stages.end()) {
+                    stages.emplace_back(span.name, span.end_ns - span.begin_ns);
+                } else {
+                    it->second += span.end_ns - span.begin_ns;
+                }
+            }
+            for (auto &stage: stages) {
+                ss << " " << stage.first << "_us=" << stage.second / 1000.0;
+            }
+            forEachCounter([&ss](const char *name, uint64_t value) {
+                ss << " " << name << "=" << value;
+            });
+            return ss.str();
+        }
+
+    private:
+        friend class Tracer;
+
+        RpcMethod method_;
+        bool requested_;
+        uint64_t begin_ns_;
+        uint64_t end_ns_{};
+        std::mutex mutex_;
+        std::vector<TraceSpan> spans_;
+        const char *open_{};
+        uint64_t open_begin_ns_{};
+        std::vector<uint64_t> counters_;
+
+        template<typename FUNC_T>
+        void forEachCounter(FUNC_T &&func) const {
+            size_t i = 0;
+
+            for (auto &counter: PERF_COUNTERS) {
+                if (counters_[i] > 0) {
+                    func(counter.first, counters_[i]);
+                }
+                i++;
+            }
+            for (auto &counter: IOSTATS_COUNTERS) {
+                if (counters_[i] > 0) {
+                    func(counter.first, counters_[i]);
+                }
+                i++;
+            }
+        }
+    };
+
+    // Picks the requests to trace and appends the finished ones to a file in the Chrome trace
+    // event format (chrome://tracing, Perfetto), every request on a row of its own. The array is
+    // left open, which both viewers accept, so the file is valid at any time.
+    class Tracer {
+    public:
+        // Traces one in sample_every requests of every thread, 0 only traces the requests that
+        // ask for it. An empty path does not write the traces
+        Tracer(uint32_t sample_every, const std::string &path) :
+                sample_every_(sample_every), begin_ns_(steadyNanos()) {
+            if (!path.empty()) {
+                out_.open(path, std::ios::trunc);
+                CHECK(out_.good()) << "Can not open " << path;
+                out_ << "[";
+            }
+        }
+
+        Tracer(const Tracer &) = delete;
+
+        ~Tracer() {
+            if (out_.is_open()) {
+                out_ << "\n]\n";
+            }
+        }
+
+        bool Sample() {
+            thread_local uint64_t requests = 0;
+
+            return sample_every_ > 0 && ++requests % sample_every_ == 0;
+        }
+
+        void Emit(RequestTrace *trace) {
+            if (!out_.is_open()) {
+                return;
+            }
+            std::stringstream ss;
+            auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+            auto *method = RPC_METHOD_NAMES[(size_t) trace->method_];
+
+            ss << R"({"name":")" << method << R"(","cat":"rpc","ph":"X","pid":1,"tid":)" << id
+               << R"(,"ts":)" << micros(trace->begin_ns_) << R"(,"dur":)"
+               << (trace->end_ns_ - trace->begin_ns_) / 1000.0 << R"(,"args":{)";
+            bool first = true;
+            trace->forEachCounter([&ss, &first](const char *name, uint64_t value) {
+                ss << (first ? "" : ",") << '"' << name << "\":" << value;
+                first = false;
+            });
+            ss << "}}";
+            for (auto &span: trace->spans_) {
+                ss << ",\n" << R"({"name":")" << span.name << R"(","cat":")" << method << R"(","ph":"X","pid":1,"tid":)" << id
+                   << R"(,"ts":)" << micros(span.begin_ns) << R"(,"dur":)"
+                   << (span.end_ns - span.begin_ns) / 1000.0 << "}";
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            out_ << (empty_ ? "\n" : ",\n") << ss.str();
+            empty_ = false;
+        }
+
+    private:
+        uint32_t sample_every_;
+        uint64_t begin_ns_;
+        std::atomic_uint64_t next_id_{1};
+        std::mutex mutex_;
+        std::ofstream out_;
+        bool empty_{true};
+
+        double micros(uint64_t ns) const {
+            return (ns - begin_ns_) / 1000.0;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_TRACER_H
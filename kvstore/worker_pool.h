@@ -0,0 +1,195 @@
+#ifndef GRPC_KVSTORE_WORKER_POOL_H
+#define GRPC_KVSTORE_WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "glog/logging.h"
+#include "cpu_topology.h"
+
+namespace kvstore {
+    class WorkerTask {
+    public:
+        virtual ~WorkerTask() = default;
+
+        virtual void Execute() = 0;
+
+    private:
+        friend class MPSCQueue;
+
+        std::atomic<WorkerTask *> next_{nullptr};
+    };
+
+    // Dmitry Vyukov's intrusive multi-producer single-consumer queue. Push() is wait-free,
+    // Pop() may only be called by the owning consumer and can return nullptr while a
+    // concurrent Push() is half done, the caller retries in that case.
+    class MPSCQueue {
+    public:
+        MPSCQueue() : head_(&stub_), tail_(&stub_) {}
+
+        void Push(WorkerTask *task) {
+            task->next_.store(nullptr, std::memory_order_relaxed);
+            WorkerTask *prev = head_.exchange(task, std::memory_order_seq_cst);
+            prev->next_.store(task, std::memory_order_seq_cst);
+        }
+
+        WorkerTask *Pop() {
+            WorkerTask *tail = tail_;
+            WorkerTask *next = tail->next_.load(std::memory_order_acquire);
+
+            if (tail == &stub_) {
+                if (next == nullptr) {
+                    return nullptr;
+                }
+                tail_ = next;
+                tail = next;
+                next = next->next_.load(std::memory_order_acquire);
+            }
+            if (next != nullptr) {
+                tail_ = next;
+                return tail;
+            }
+            if (tail != head_.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            Push(&stub_);
+            next = tail->next_.load(std::memory_order_acquire);
+            if (next != nullptr) {
+                tail_ = next;
+                return tail;
+            }
+            return nullptr;
+        }
+
+        // Consumer only
+        bool Empty() const {
+            return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+        }
+
+    private:
+        struct Stub : public WorkerTask {
+            void Execute() override {}
+        };
+
+        std::atomic<WorkerTask *> head_;
+        WorkerTask *tail_;
+        Stub stub_;
+    };
+
+    // Fixed set of threads running WorkerTasks, every worker owns one MPSCQueue and tasks are
+    // spread over the workers round-robin. An idle worker spins for a while before it parks.
+    // Worker i is pinned by placement.Apply(i).
+    class WorkerPool {
+    public:
+        explicit WorkerPool(int num_workers, const ThreadPlacement &placement = ThreadPlacement()) {
+            CHECK_GT(num_workers, 0);
+            for (int i = 0; i < num_workers; i++) {
+                workers_.emplace_back(std::make_unique<Worker>());
+            }
+            for (size_t i = 0; i < workers_.size(); i++) {
+                auto *w = workers_[i].get();
+                w->thread = std::thread([this, w, i, placement]() {
+                    placement.Apply(i);
+                    run(*w);
+                });
+            }
+        }
+
+        ~WorkerPool() {
+            Stop();
+        }
+
+        // Once Stop() has begun the task runs inline on the caller, nothing would pop it
+        void Submit(WorkerTask *task) {
+            submitting_.fetch_add(1, std::memory_order_seq_cst);
+            if (stopped_.load(std::memory_order_seq_cst)) {
+                submitting_.fetch_sub(1, std::memory_order_relaxed);
+                task->Execute();
+                return;
+            }
+            auto &worker = *workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+
+            worker.queue.Push(task);
+            if (worker.sleeping.load(std::memory_order_seq_cst)) {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.cv.notify_one();
+            }
+            submitting_.fetch_sub(1, std::memory_order_release);
+        }
+
+        // Runs the tasks already submitted and joins the workers
+        void Stop() {
+            stopped_.store(true, std::memory_order_seq_cst);
+            // A Submit() that missed the flag finishes its push before the workers drain
+            while (submitting_.load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+            for (auto &worker: workers_) {
+                {
+                    std::lock_guard<std::mutex> lock(worker->mutex);
+                    worker->stopped = true;
+                }
+                worker->cv.notify_one();
+            }
+            for (auto &worker: workers_) {
+                if (worker->thread.joinable()) {
+                    worker->thread.join();
+                }
+            }
+        }
+
+        size_t size() const {
+            return workers_.size();
+        }
+
+    private:
+        static constexpr int SPIN_ROUNDS = 1024;
+
+        struct Worker {
+            MPSCQueue queue;
+            std::atomic_bool sleeping{false};
+            bool stopped{};
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::atomic_size_t next_{0};
+        std::atomic_bool stopped_{false};
+        // Submit() calls between reading stopped_ and pushing their task
+        std::atomic_size_t submitting_{0};
+
+        static void run(Worker &worker) {
+            int idle = 0;
+
+            while (true) {
+                auto *task = worker.queue.Pop();
+
+                if (task != nullptr) {
+                    task->Execute();
+                    idle = 0;
+                    continue;
+                }
+                if (!worker.queue.Empty() || ++idle < SPIN_ROUNDS) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                worker.sleeping.store(true, std::memory_order_seq_cst);
+                worker.cv.wait(lock, [&worker]() { return worker.stopped || !worker.queue.Empty(); });
+                worker.sleeping.store(false, std::memory_order_relaxed);
+                if (worker.stopped && worker.queue.Empty()) {
+                    break;
+                }
+                idle = 0;
+            }
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_WORKER_POOL_H
@@ -0,0 +1,371 @@
+#ifndef GRPC_KVSTORE_WORKLOAD_H
+#define GRPC_KVSTORE_WORKLOAD_H
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "glog/logging.h"
+#include "bench_driver.h"
+#include "generators.h"
+#include "kv_client.h"
+
+namespace kvstore {
+    using Properties = std::map<std::string, std::string>;
+
+    // Native port of YCSB's CoreWorkload with one value field per record. Understands the YCSB
+    // property names (recordcount, readproportion, requestdistribution, ...), so the stock
+    // workloads/workload[a-f] files can be used as they are
+    class CoreWorkload {
+    public:
+        enum OpType {
+            READ = 0, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE
+        };
+
+        explicit CoreWorkload(const Properties &props) {
+            record_count_ = get<uint64_t>(props, "recordcount", 1000);
+            operation_count_ = get<uint64_t>(props, "operationcount", 1000);
+            insert_start_ = get<uint64_t>(props, "insertstart", 0);
+            field_length_ = get<size_t>(props, "fieldlength", 100);
+            variable_field_length_ = get<std::string>(props, "fieldlengthdistribution", "constant") == "uniform";
+            read_proportion_ = get<double>(props, "readproportion", 0.95);
+            update_proportion_ = get<double>(props, "updateproportion", 0.05);
+            insert_proportion_ = get<double>(props, "insertproportion", 0);
+            scan_proportion_ = get<double>(props, "scanproportion", 0);
+            rmw_proportion_ = get<double>(props, "readmodifywriteproportion", 0);
+            request_distribution_ = get<std::string>(props, "requestdistribution", "uniform");
+            max_scan_length_ = get<uint64_t>(props, "maxscanlength", 1000);
+            scan_length_distribution_ = get<std::string>(props, "scanlengthdistribution", "uniform");
+            ordered_inserts_ = get<std::string>(props, "insertorder", "hashed") != "hashed";
+            zero_padding_ = get<size_t>(props, "zeropadding", 1);
+            key_prefix_ = get<std::string>(props, "keyprefix", "user");
+
+            CHECK_GT(record_count_, 1);
+            CHECK(request_distribution_ == "uniform" || request_distribution_ == "zipfian" ||
+                  request_distribution_ == "scrambled_zipfian" || request_distribution_ == "latest")
+                << "Bad requestdistribution: " << request_distribution_;
+            CHECK(scan_length_distribution_ == "uniform" || scan_length_distribution_ == "zipfian")
+                << "Bad scanlengthdistribution: " << scan_length_distribution_;
+            double total = read_proportion_ + update_proportion_ + insert_proportion_ + scan_proportion_ +
+                           rmw_proportion_;
+            CHECK_GT(total, 0) << "All operation proportions are zero";
+            proportions_ = {read_proportion_ / total, update_proportion_ / total, insert_proportion_ / total,
+                            scan_proportion_ / total, rmw_proportion_ / total};
+
+            transaction_inserts_ = std::make_unique<AcknowledgedCounter>(insert_start_ + record_count_);
+            load_inserts_ = std::make_unique<AcknowledgedCounter>(insert_start_);
+
+            // Zeta sums are O(items), they are computed once here and shared by all threads
+            if (request_distribution_ == "zipfian") {
+                key_zetan_ = ZipfianGenerator::zeta(0, record_count_ + newKeys(),
+                                                    ZipfianGenerator::ZIPFIAN_CONSTANT, 0);
+            } else if (request_distribution_ == "latest") {
+                latest_items_ = std::max<uint64_t>(transaction_inserts_->Last(), 1) + 1;
+                key_zetan_ = ZipfianGenerator::zeta(0, latest_items_, ZipfianGenerator::ZIPFIAN_CONSTANT, 0);
+            }
+            if (scan_length_distribution_ == "zipfian") {
+                scan_zetan_ = ZipfianGenerator::zeta(0, max_scan_length_, ZipfianGenerator::ZIPFIAN_CONSTANT, 0);
+            }
+        }
+
+        // Core workloads A-F as shipped with YCSB
+        static Properties Preset(const std::string &name) {
+            Properties props{{"recordcount",          "1000"},
+                             {"operationcount",       "1000"},
+                             {"requestdistribution",  "zipfian"},
+                             {"readproportion",       "0"},
+                             {"updateproportion",     "0"},
+                             {"insertproportion",     "0"},
+                             {"scanproportion",       "0"},
+                             {"readmodifywriteproportion", "0"}};
+
+            if (name == "a") {
+                props["readproportion"] = "0.5";
+                props["updateproportion"] = "0.5";
+            } else if (name == "b") {
+                props["readproportion"] = "0.95";
+                props["updateproportion"] = "0.05";
+            } else if (name == "c") {
+                props["readproportion"] = "1";
+            } else if (name == "d") {
+                props["readproportion"] = "0.95";
+                props["insertproportion"] = "0.05";
+                props["requestdistribution"] = "latest";
+            } else if (name == "e") {
+                props["scanproportion"] = "0.95";
+                props["insertproportion"] = "0.05";
+                props["maxscanlength"] = "100";
+                props["scanlengthdistribution"] = "uniform";
+            } else if (name == "f") {
+                props["readproportion"] = "0.5";
+                props["readmodifywriteproportion"] = "0.5";
+            } else {
+                LOG(FATAL) << "Unknown workload: " << name << ", expect one of a-f";
+            }
+            return props;
+        }
+
+        // Merges "key=value" lines of a YCSB workload file into props, '#' starts a comment
+        static void LoadFile(const std::string &path, Properties &props) {
+            std::ifstream in(path);
+            std::string line;
+
+            CHECK(in.is_open()) << "Can not open workload file " << path;
+            while (std::getline(in, line)) {
+                ParseLine(line, props);
+            }
+        }
+
+        // Merges a comma separated list of "key=value" pairs into props
+        static void LoadString(const std::string &list, Properties &props) {
+            std::stringstream ss(list);
+            std::string item;
+
+            while (std::getline(ss, item, ',')) {
+                ParseLine(item, props);
+            }
+        }
+
+        static const std::vector<std::string> &OpNames() {
+            static const std::vector<std::string> names{"READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"};
+            return names;
+        }
+
+        // Each call inserts the next record of the load phase, threads stop once record_count are in
+        BenchDriver::OpFactory LoadOps() {
+            return [this](int tid) -> BenchDriver::Op {
+                auto rng = std::make_shared<Rng>(seed(tid));
+
+                return [this, rng](KVClient &cli) {
+                    uint64_t keynum = load_inserts_->Next();
+
+                    if (keynum >= insert_start_ + record_count_) {
+                        return -1;
+                    }
+                    insert(cli, *rng, keynum);
+                    return (int) INSERT;
+                };
+            };
+        }
+
+        BenchDriver::OpFactory RunOps() {
+            return [this](int tid) -> BenchDriver::Op {
+                auto state = std::make_shared<ThreadState>(*this, seed(tid));
+
+                return [this, state](KVClient &cli) {
+                    return (int) doTransaction(cli, *state);
+                };
+            };
+        }
+
+        std::string BuildKeyName(uint64_t keynum) const {
+            if (!ordered_inserts_) {
+                keynum = fnvhash64(keynum);
+            }
+            std::string value = std::to_string(keynum);
+            std::string key = key_prefix_;
+
+            if (value.size() < zero_padding_) {
+                key.append(zero_padding_ - value.size(), '0');
+            }
+            return key + value;
+        }
+
+        uint64_t record_count() const { return record_count_; }
+
+        uint64_t operation_count() const { return operation_count_; }
+
+        size_t failed() const { return failed_; }
+
+    private:
+        struct ThreadState {
+            Rng rng;
+            std::unique_ptr<Generator> key_chooser;
+            std::unique_ptr<Generator> scan_length;
+
+            ThreadState(const CoreWorkload &workload, uint64_t seed) : rng(seed) {
+                uint64_t first = workload.insert_start_;
+                uint64_t last = first + workload.record_count_ - 1;
+                auto &dist = workload.request_distribution_;
+
+                if (dist == "uniform") {
+                    key_chooser = std::make_unique<UniformGenerator>(first, last);
+                } else if (dist == "latest") {
+                    key_chooser = std::make_unique<SkewedLatestGenerator>(*workload.transaction_inserts_,
+                                                                          workload.latest_items_, workload.key_zetan_);
+                } else if (dist == "zipfian") {
+                    key_chooser = std::make_unique<ZipfianGenerator>(first, last + workload.newKeys(),
+                                                                     ZipfianGenerator::ZIPFIAN_CONSTANT,
+                                                                     workload.key_zetan_);
+                } else {
+                    key_chooser = std::make_unique<ScrambledZipfianGenerator>(first, last + workload.newKeys());
+                }
+                if (workload.scan_length_distribution_ == "uniform") {
+                    scan_length = std::make_unique<UniformGenerator>(1, workload.max_scan_length_);
+                } else {
+                    scan_length = std::make_unique<ZipfianGenerator>(1, workload.max_scan_length_,
+                                                                     ZipfianGenerator::ZIPFIAN_CONSTANT,
+                                                                     workload.scan_zetan_);
+                }
+            }
+        };
+
+        uint64_t record_count_;
+        uint64_t operation_count_;
+        uint64_t insert_start_;
+        size_t field_length_;
+        bool variable_field_length_;
+        double read_proportion_, update_proportion_, insert_proportion_, scan_proportion_, rmw_proportion_;
+        std::vector<double> proportions_;
+        std::string request_distribution_;
+        uint64_t max_scan_length_;
+        std::string scan_length_distribution_;
+        bool ordered_inserts_;
+        size_t zero_padding_;
+        std::string key_prefix_;
+        std::unique_ptr<AcknowledgedCounter> load_inserts_;
+        std::unique_ptr<AcknowledgedCounter> transaction_inserts_;
+        // Zeta of the key and scan length zipfians, items of the latest one when it was computed
+        double key_zetan_{};
+        double scan_zetan_{};
+        uint64_t latest_items_{};
+        std::atomic_size_t failed_{0};
+
+        // Room left in the zipfian key space for the keys inserted during the run, like YCSB does
+        uint64_t newKeys() const {
+            return (uint64_t) (operation_count_ * proportions_[INSERT] * 2);
+        }
+
+        template<typename T>
+        static T get(const Properties &props, const std::string &key, const T &default_value) {
+            auto it = props.find(key);
+
+            if (it == props.end()) {
+                return default_value;
+            }
+            std::stringstream ss(it->second);
+            T value;
+
+            ss >> value;
+            CHECK(!ss.fail()) << "Bad value of property " << key << ": " << it->second;
+            return value;
+        }
+
+        static void ParseLine(std::string line, Properties &props) {
+            auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.resize(comment);
+            }
+            auto eq = line.find('=');
+            if (eq == std::string::npos) {
+                return;
+            }
+            auto trim = [](const std::string &s) {
+                auto begin = s.find_first_not_of(" \t\r");
+                auto end = s.find_last_not_of(" \t\r");
+                return begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+            };
+            props[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+        }
+
+        static uint64_t seed(int tid) {
+            return fnvhash64(tid + 1);
+        }
+
+        OpType chooseOp(Rng &rng) const {
+            double u = next_double(rng);
+
+            for (size_t i = 0; i < proportions_.size(); i++) {
+                if (u < proportions_[i]) {
+                    return static_cast<OpType>(i);
+                }
+                u -= proportions_[i];
+            }
+            return READ;
+        }
+
+        uint64_t nextKeynum(ThreadState &state) const {
+            uint64_t keynum;
+
+            do {
+                keynum = state.key_chooser->Next(state.rng);
+            } while (keynum > transaction_inserts_->Last());
+            return keynum;
+        }
+
+        std::string buildValue(Rng &rng) const {
+            size_t len = variable_field_length_ ? 1 + rng() % field_length_ : field_length_;
+            std::string value(len, 0);
+
+            for (auto &c: value) {
+                c = (char) ('a' + rng() % 26);
+            }
+            return value;
+        }
+
+        bool insert(KVClient &cli, Rng &rng, uint64_t keynum) {
+            auto status = cli.Put(BuildKeyName(keynum), buildValue(rng));
+
+            if (status.error_code() != ErrorCode::OK) {
+                LOG(ERROR) << "Insert Error: " << status.error_code() << " msg: " << status.error_msg();
+                failed_++;
+                return false;
+            }
+            return true;
+        }
+
+        OpType doTransaction(KVClient &cli, ThreadState &state) {
+            auto op = chooseOp(state.rng);
+
+            switch (op) {
+                case READ: {
+                    std::string value;
+
+                    if (cli.Get(BuildKeyName(nextKeynum(state)), value).error_code() != ErrorCode::OK) {
+                        failed_++;
+                    }
+                    break;
+                }
+                case UPDATE: {
+                    if (cli.Put(BuildKeyName(nextKeynum(state)), buildValue(state.rng)).error_code() !=
+                        ErrorCode::OK) {
+                        failed_++;
+                    }
+                    break;
+                }
+                case INSERT: {
+                    uint64_t keynum = transaction_inserts_->Next();
+
+                    // A failed insert stays unacknowledged, reads never go past it
+                    if (insert(cli, state.rng, keynum)) {
+                        transaction_inserts_->Acknowledge(keynum);
+                    }
+                    break;
+                }
+                case SCAN: {
+                    std::vector<KV> kvs;
+
+                    if (cli.Scan(BuildKeyName(nextKeynum(state)), kvs,
+                                 state.scan_length->Next(state.rng)).error_code() != ErrorCode::OK) {
+                        failed_++;
+                    }
+                    break;
+                }
+                case READ_MODIFY_WRITE: {
+                    auto key = BuildKeyName(nextKeynum(state));
+                    std::string value;
+
+                    if (cli.Get(key, value).error_code() != ErrorCode::OK ||
+                        cli.Put(key, buildValue(state.rng)).error_code() != ErrorCode::OK) {
+                        failed_++;
+                    }
+                    break;
+                }
+            }
+            return op;
+        }
+    };
+}
+
+#endif //GRPC_KVSTORE_WORKLOAD_H
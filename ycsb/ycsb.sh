@@ -11,6 +11,7 @@ FIRST_CLIENT=$(head -n 2 "$HOSTS_PATH" | tail -n 1 | cut -d" " -f1,1)
 NP=$(awk '{ sum += $1 } END { print sum }' <(tail -n +2 "$HOSTS_PATH" | cut -d"=" -f2,2))
 MPI_LIB=$(realpath "$(which mpirun | xargs dirname)"/../lib)
 ASYNC=false
+CALLBACK=false
 THREAD=$(nproc)
 OVERWRITE=false
 
@@ -42,6 +43,10 @@ for i in "$@"; do
     ASYNC=true
     shift
     ;;
+  --callback)
+    CALLBACK=true
+    shift
+    ;;
   --overwrite)
     OVERWRITE=true
     shift
@@ -74,6 +79,8 @@ function get_logs_dir() {
     LOG_PATH="$LOG_PATH/${GRPC_PLATFORM_TYPE}_$NP"
     if [[ $ASYNC == true ]]; then
       LOG_PATH="${LOG_PATH}_async"
+    elif [[ $CALLBACK == true ]]; then
+      LOG_PATH="${LOG_PATH}_callback"
     else
       LOG_PATH="${LOG_PATH}_sync"
     fi
@@ -105,7 +112,7 @@ function start_server() {
   # Launch server
   mpirun --bind-to none -x GRPC_PLATFORM_TYPE -x GRPC_BP_TIMEOUT \
     -n 1 -host "$SERVER" \
-    "$KVSTORE_HOME"/kv_store -server -async=$ASYNC -db_file="$db_file" -thread="$THREAD" &
+    "$KVSTORE_HOME"/kv_store -server -async=$ASYNC -callback=$CALLBACK -db_file="$db_file" -thread="$THREAD" &
 }
 
 function load() {